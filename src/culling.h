@@ -0,0 +1,205 @@
+#pragma once
+
+#include "types.h"
+#include "os.h"
+#include "maths.h"
+
+/*
+ * CPU frustum culling. Bounds live in structure-of-arrays form so the kernels test BATCH_LANE_COUNT objects per
+ * instruction against each plane, and every kernel appends the indices of the objects that are not entirely outside
+ * the frustum to a visible-index list, in ascending order.
+ */
+
+/*
+ * Gribb-Hartmann plane extraction from a column-major view-projection with a [0, 1] depth range.
+ * Planes are normalized and point inwards: left, right, bottom, top, near, far.
+ */
+static inline void frustum_planes_from_matrix(mat4f m, vec4f planes[6])
+{
+    vec4f rows[4];
+    for (u32 i = 0; i < 4; i++)
+    {
+        rows[i] = (vec4f) { .x = m.row[0].v[i], .y = m.row[1].v[i], .z = m.row[2].v[i], .w = m.row[3].v[i] };
+    }
+
+    planes[0] = vec4_add(rows[3], rows[0]);
+    planes[1] = vec4_add(rows[3], vec4_scale(rows[0], -1.0f));
+    planes[2] = vec4_add(rows[3], rows[1]);
+    planes[3] = vec4_add(rows[3], vec4_scale(rows[1], -1.0f));
+    planes[4] = rows[2];
+    planes[5] = vec4_add(rows[3], vec4_scale(rows[2], -1.0f));
+
+    for (u32 i = 0; i < 6; i++)
+    {
+        f32 length = sqrtf(planes[i].x * planes[i].x + planes[i].y * planes[i].y + planes[i].z * planes[i].z);
+        planes[i] = vec4_scale(planes[i], 1.0f / length);
+    }
+}
+
+// World-space bounds, one array per component. The sphere and box share the center
+typedef struct BoundsBatch
+{
+    f32* center_x;
+    f32* center_y;
+    f32* center_z;
+    f32* radius;
+    f32* extent_x; /* AABB half extents */
+    f32* extent_y;
+    f32* extent_z;
+    u32 count;
+} BoundsBatch;
+
+#define BOUNDS_BATCH_COMPONENT_COUNT (7)
+
+static inline void BoundsBatch_init(BoundsBatch* bounds, u32 count)
+{
+    f32* components = NEW(f32, (usize)count * BOUNDS_BATCH_COMPONENT_COUNT);
+    memset(components, 0, (usize)count * BOUNDS_BATCH_COMPONENT_COUNT * sizeof(f32));
+    *bounds = (BoundsBatch)
+    {
+        .center_x = components,
+        .center_y = components + (usize)count,
+        .center_z = components + (usize)count * 2,
+        .radius = components + (usize)count * 3,
+        .extent_x = components + (usize)count * 4,
+        .extent_y = components + (usize)count * 5,
+        .extent_z = components + (usize)count * 6,
+        .count = count,
+    };
+}
+
+static inline void BoundsBatch_deinit(BoundsBatch* bounds)
+{
+    free_chunk(bounds->center_x);
+    *bounds = (BoundsBatch) ZERO_INIT;
+}
+
+// Signed distance of the center from the plane, summed in the same order by every lane layout
+static inline f32 plane_distance(vec4f plane, f32 x, f32 y, f32 z)
+{
+    return ((plane.x * x + plane.y * y) + plane.z * z) + plane.w;
+}
+
+// Projected half extent of the box onto the plane normal
+static inline f32 plane_box_radius(vec4f plane, f32 x, f32 y, f32 z)
+{
+    return (fabsf(plane.x) * x + fabsf(plane.y) * y) + fabsf(plane.z) * z;
+}
+
+static inline bool frustum_test_sphere(const vec4f planes[6], const BoundsBatch* bounds, u32 i)
+{
+    bool inside = true;
+    for (u32 p = 0; p < 6; p++)
+    {
+        inside &= plane_distance(planes[p], bounds->center_x[i], bounds->center_y[i], bounds->center_z[i]) >= -bounds->radius[i];
+    }
+    return inside;
+}
+
+static inline bool frustum_test_aabb(const vec4f planes[6], const BoundsBatch* bounds, u32 i)
+{
+    bool inside = true;
+    for (u32 p = 0; p < 6; p++)
+    {
+        inside &= plane_distance(planes[p], bounds->center_x[i], bounds->center_y[i], bounds->center_z[i]) >= -plane_box_radius(planes[p], bounds->extent_x[i], bounds->extent_y[i], bounds->extent_z[i]);
+    }
+    return inside;
+}
+
+#if BATCH_LANE_COUNT == 16
+typedef __mmask16 BatchMask;
+#define BATCH_MASK_ALL ((BatchMask)0xFFFF)
+#define BATCH_GE(a, b) _mm512_cmp_ps_mask(a, b, _CMP_GE_OQ)
+#define BATCH_NEG(a) _mm512_castsi512_ps(_mm512_xor_si512(_mm512_castps_si512(a), _mm512_set1_epi32((s32)0x80000000)))
+#elif BATCH_LANE_COUNT == 8
+typedef u32 BatchMask;
+#define BATCH_MASK_ALL ((BatchMask)0xFF)
+#define BATCH_GE(a, b) ((BatchMask)_mm256_movemask_ps(_mm256_cmp_ps(a, b, _CMP_GE_OQ)))
+#define BATCH_NEG(a) _mm256_xor_ps(a, _mm256_set1_ps(-0.0f))
+#endif
+
+#if BATCH_LANE_COUNT > 1
+// Appends first + lane for every set lane of the mask
+static inline u32 append_visible_lanes(BatchMask mask, u32 first, u32* visible, u32 visible_count)
+{
+#if BATCH_LANE_COUNT == 16
+    __m512i indices = _mm512_add_epi32(_mm512_set1_epi32((s32)first), _mm512_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15));
+    _mm512_mask_compressstoreu_epi32(visible + visible_count, mask, indices);
+    return visible_count + (u32)_mm_popcnt_u32(mask);
+#else
+    for (u32 lane = 0; lane < 8; lane++)
+    {
+        visible[visible_count] = first + lane;
+        visible_count += (mask >> lane) & 1;
+    }
+    return visible_count;
+#endif
+}
+#endif
+
+/*
+ * Writes the indices of the spheres that intersect or lie inside the frustum to visible (room for bounds->count
+ * entries) and returns how many there are.
+ */
+static inline u32 frustum_cull_spheres(const vec4f planes[6], const BoundsBatch* bounds, u32* visible)
+{
+    u32 visible_count = 0;
+    u32 i = 0;
+#if BATCH_LANE_COUNT > 1
+    for (; i + BATCH_LANE_COUNT <= bounds->count; i += BATCH_LANE_COUNT)
+    {
+        BatchLane x = BATCH_LOAD(bounds->center_x + i);
+        BatchLane y = BATCH_LOAD(bounds->center_y + i);
+        BatchLane z = BATCH_LOAD(bounds->center_z + i);
+        BatchLane negative_radius = BATCH_NEG(BATCH_LOAD(bounds->radius + i));
+        BatchMask inside = BATCH_MASK_ALL;
+        for (u32 p = 0; p < 6; p++)
+        {
+            BatchLane distance = BATCH_ADD(BATCH_MUL(BATCH_SET1(planes[p].x), x), BATCH_MUL(BATCH_SET1(planes[p].y), y));
+            distance = BATCH_ADD(BATCH_ADD(distance, BATCH_MUL(BATCH_SET1(planes[p].z), z)), BATCH_SET1(planes[p].w));
+            inside &= BATCH_GE(distance, negative_radius);
+        }
+        visible_count = append_visible_lanes(inside, i, visible, visible_count);
+    }
+#endif
+    for (; i < bounds->count; i++)
+    {
+        visible[visible_count] = i;
+        visible_count += frustum_test_sphere(planes, bounds, i);
+    }
+    return visible_count;
+}
+
+// Same as frustum_cull_spheres for the boxes; tighter than spheres for elongated objects
+static inline u32 frustum_cull_aabbs(const vec4f planes[6], const BoundsBatch* bounds, u32* visible)
+{
+    u32 visible_count = 0;
+    u32 i = 0;
+#if BATCH_LANE_COUNT > 1
+    for (; i + BATCH_LANE_COUNT <= bounds->count; i += BATCH_LANE_COUNT)
+    {
+        BatchLane x = BATCH_LOAD(bounds->center_x + i);
+        BatchLane y = BATCH_LOAD(bounds->center_y + i);
+        BatchLane z = BATCH_LOAD(bounds->center_z + i);
+        BatchLane extent_x = BATCH_LOAD(bounds->extent_x + i);
+        BatchLane extent_y = BATCH_LOAD(bounds->extent_y + i);
+        BatchLane extent_z = BATCH_LOAD(bounds->extent_z + i);
+        BatchMask inside = BATCH_MASK_ALL;
+        for (u32 p = 0; p < 6; p++)
+        {
+            BatchLane distance = BATCH_ADD(BATCH_MUL(BATCH_SET1(planes[p].x), x), BATCH_MUL(BATCH_SET1(planes[p].y), y));
+            distance = BATCH_ADD(BATCH_ADD(distance, BATCH_MUL(BATCH_SET1(planes[p].z), z)), BATCH_SET1(planes[p].w));
+            BatchLane radius = BATCH_ADD(BATCH_MUL(BATCH_SET1(fabsf(planes[p].x)), extent_x), BATCH_MUL(BATCH_SET1(fabsf(planes[p].y)), extent_y));
+            radius = BATCH_ADD(radius, BATCH_MUL(BATCH_SET1(fabsf(planes[p].z)), extent_z));
+            inside &= BATCH_GE(distance, BATCH_NEG(radius));
+        }
+        visible_count = append_visible_lanes(inside, i, visible, visible_count);
+    }
+#endif
+    for (; i < bounds->count; i++)
+    {
+        visible[visible_count] = i;
+        visible_count += frustum_test_aabb(planes, bounds, i);
+    }
+    return visible_count;
+}
@@ -1,13 +1,15 @@
 #include "types.h"
 #include "os.h"
 #include "maths.h"
+#include "culling.h"
+#include "obj.h"
 #include "dependencies/volk.h"
 #include "dependencies/vk_mem_alloc.h"
-#include "dependencies/fast_obj.h"
 #include <meshoptimizer.h>
 #include <GLFW/glfw3.h>
 #include <GLFW/glfw3native.h>
 #include <math.h>
+#include <float.h>
 #include <vulkan/vulkan_core.h>
 #ifdef RED_OS_WINDOWS
 #include <spirv-headers/spirv.h>
@@ -17,6 +19,7 @@
 
 static u32 space_selector = 0;
 
+// The layout meshes are loaded and processed in
 typedef struct Vertex
 {
     f32 position[3];
@@ -24,6 +27,26 @@ typedef struct Vertex
     f32 color[3];
 } Vertex;
 
+// 16 bytes instead of 36. Positions are dequantized against the mesh bounds by the vertex shader
+typedef struct PackedVertex
+{
+    u16 position[4]; /* unorm16 within the mesh bounds, w unused */
+    s16 normal[2]; /* octahedral, snorm16 */
+    u8 color[4]; /* unorm8, alpha unused */
+} PackedVertex;
+
+// Layout of the vertices a mesh is uploaded with. Each one gets its own pipelines
+typedef enum VertexFormat
+{
+    VERTEX_FORMAT_FLOAT, /* Vertex */
+    VERTEX_FORMAT_PACKED, /* PackedVertex */
+} VertexFormat;
+
+static inline usize VertexFormat_stride(VertexFormat format)
+{
+    return format == VERTEX_FORMAT_PACKED ? sizeof(PackedVertex) : sizeof(Vertex);
+}
+
 GEN_BUFFER_STRUCT(VkVertexInputBindingDescription)
 GEN_BUFFER_STRUCT(VkVertexInputAttributeDescription)
 GEN_BUFFER_FUNCTIONS(vertex_binding, vb, VkVertexInputBindingDescriptionBuffer, VkVertexInputBindingDescription)
@@ -56,20 +79,226 @@ typedef struct MeshPushConstants
 {
     vec4f data;
     mat4f render_matrix;
+    // Packed positions only: object-space position = unorm16 position * scale + offset. Pushed per mesh
+    vec4f position_scale;
+    vec4f position_offset;
 } MeshPushConstants;
 
+GEN_BUFFER_STRUCT(u32)
+GEN_BUFFER_FUNCTIONS(indices, ib, u32Buffer, u32)
+
+#define MESHLET_MAX_VERTICES (64)
+#define MESHLET_MAX_TRIANGLES (124)
+#define MESHLET_CONE_WEIGHT (0.25f)
+
+// Mirrors MeshletData in meshlet_cull.comp (std430). The triangles are a range of the mesh's index buffer
+typedef struct Meshlet
+{
+    vec4f bounding_sphere; /* object-space center, radius in w */
+    vec4f cone; /* object-space axis, cutoff in w */
+    u32 first_index;
+    u32 index_count;
+    u32 padding[2];
+} Meshlet;
+
+#define MESH_MAX_LOD_COUNT (6)
+// Each LOD aims for this fraction of the previous one's triangles
+#define LOD_TRIANGLE_RATIO (0.5f)
+// Relative to the mesh extents; LODs stop once the simplifier can not get under it
+#define LOD_MAX_SIMPLIFICATION_ERROR (0.05f)
+// A LOD is drawn once its simplification error projects to at most this many pixels
+#define LOD_MAX_ERROR_PIXELS (1.0f)
+
+// A range of the mesh's index buffer drawing the whole mesh at some level of detail. LOD 0 is the full mesh and comes first
+typedef struct MeshLod
+{
+    u32 first_index;
+    u32 index_count;
+    f32 error; /* object-space distance the simplified surface may be off from the full one */
+} MeshLod;
+
+// Compressed cooked meshes are encoded in chunks of this many elements, each decodable on its own, so a mesh decodes on
+// all the job threads. Index chunks hold whole triangles
+#define MESH_CODEC_CHUNK_VERTICES (8192)
+#define MESH_CODEC_CHUNK_INDICES (3 * 8192)
+
+// Vertices or indices compressed with meshoptimizer's vertex or index codec
+typedef struct EncodedBuffer
+{
+    const u8* data; /* a u32 encoded size per chunk, then the chunks back to back */
+    u64 size;
+    u32 element_count;
+    u32 element_size; /* once decoded */
+    u32 chunk_element_count;
+    bool indices;
+} EncodedBuffer;
+
 typedef struct Mesh
 {
+    // Vertices the processing passes work on. Like indices, meshes coming from the cooked cache do not have them
     VertexBuffer vertices;
+    // 32-bit indices the processing passes work on
+    u32Buffer indices;
+    // Vertices laid out as vertex_format, ready to be copied into the GPU vertex buffer
+    void* vertex_data;
+    u32 vertex_count;
+    VertexFormat vertex_format;
+    // Indices laid out as index_type, ready to be copied into the GPU index buffer
+    void* index_data;
+    u32 index_count;
+    VkIndexType index_type;
+    f32 bounds_min[3];
+    f32 bounds_max[3];
+    MeshLod lods[MESH_MAX_LOD_COUNT];
+    u32 lod_count;
+    // Set when the mesh was split into meshlets; LOD 0 then lists their triangles one meshlet after the other
+    Meshlet* meshlets;
+    u32 meshlet_count;
+    // Set instead of vertex_data and index_data when the cooked file holds them compressed. They are decoded while uploading
+    EncodedBuffer encoded_vertices;
+    EncodedBuffer encoded_indices;
+    // Set when vertex_data, index_data, meshlets and the encoded buffers point into a mapped cooked file
+    FileMapping mapping;
     AllocatedBuffer buffer;
+    AllocatedBuffer index_buffer;
+    AllocatedBuffer meshlet_buffer;
+    // Meshlet culling: the meshlets and index buffer as storage buffers, written once the mesh is resident
+    VkDescriptorSet meshlet_descriptor_set;
+    // Set on the render thread once the GPU buffers may be drawn from
+    bool resident;
 } Mesh;
 
+static inline usize Mesh_index_size(Mesh* mesh)
+{
+    return mesh->index_type == VK_INDEX_TYPE_UINT16 ? sizeof(u16) : sizeof(u32);
+}
+
+// The part of the push constants that changes with the mesh
+static inline void Mesh_push_position_decode(Mesh* mesh, VkCommandBuffer cmd, VkPipelineLayout layout)
+{
+    if (mesh->vertex_format != VERTEX_FORMAT_PACKED)
+    {
+        return;
+    }
+
+    vec4f decode[2] = ZERO_INIT;
+    for (u32 axis = 0; axis < 3; axis++)
+    {
+        decode[0].v[axis] = mesh->bounds_max[axis] - mesh->bounds_min[axis];
+        decode[1].v[axis] = mesh->bounds_min[axis];
+    }
+    vkCmdPushConstants(cmd, layout, VK_SHADER_STAGE_VERTEX_BIT, offsetof(MeshPushConstants, position_scale), sizeof(decode), decode);
+}
+
 typedef struct Material
 {
     VkPipeline pipeline;
     VkPipelineLayout layout;
 } Material;
 
+typedef struct RenderObject
+{
+    Mesh* mesh;
+    Material* material;
+    vec3f position;
+    vec4f color;
+} RenderObject;
+
+GEN_BUFFER_STRUCT(RenderObject)
+GEN_BUFFER_FUNCTIONS(render_objects, rob, RenderObjectBuffer, RenderObject)
+
+// Per-instance vertex attributes, fetched from the instance binding at VK_VERTEX_INPUT_RATE_INSTANCE
+typedef struct InstanceData
+{
+    mat4f model;
+    vec4f color;
+} InstanceData;
+
+// A run of render objects sharing mesh and material, drawn with a single instanced call
+typedef struct DrawBatch
+{
+    Mesh* mesh;
+    Material* material;
+    u32 first_instance;
+    u32 instance_count;
+    u32 lod; /* CPU-recorded draws only; the GPU-driven path picks LODs per object */
+} DrawBatch;
+
+GEN_BUFFER_STRUCT(DrawBatch)
+GEN_BUFFER_FUNCTIONS(draw_batches, dbb, DrawBatchBuffer, DrawBatch)
+
+// GPU-driven mode: mirrors ObjectData in cull.comp (std430)
+typedef struct GpuObject
+{
+    vec4f position; /* w unused */
+    vec4f color;
+    vec4f bounding_sphere; /* object-space center, radius in w */
+    u32 batch_index;
+    u32 padding[3];
+} GpuObject;
+
+// Mirrors LodData in cull.comp
+typedef struct GpuLod
+{
+    u32 first_index;
+    u32 index_count;
+    f32 error;
+    u32 padding;
+} GpuLod;
+
+// Mirrors BatchData in cull.comp. Each batch owns instance_count instance slots starting at first_instance, which the
+// culling pass fills with the visible ones, LOD by LOD, and MESH_MAX_LOD_COUNT instanced draw commands. Meshlet culling
+// adds instance_count command slots at meshlet_first_command and as many at overflow_first_command for the instances
+// it leaves to the mesh's own index buffer
+typedef struct GpuBatch
+{
+    u32 first_instance;
+    u32 meshlet_first_command;
+    u32 overflow_first_command;
+    u32 lod_count;
+    GpuLod lods[MESH_MAX_LOD_COUNT];
+} GpuBatch;
+
+typedef struct CullPushConstants
+{
+    vec4f frustum_planes[6];
+    vec4f camera_position; /* w unused */
+    f32 angle;
+    u32 object_count;
+    f32 lod_error_scale;
+    u32 pass; /* 0 culls and counts the visible instances, 1 compacts them and writes the draw commands */
+} CullPushConstants;
+
+// Meshlet culling runs once per batch whose mesh has meshlets, one workgroup per visible LOD 0 instance of the batch
+typedef struct MeshletCullPushConstants
+{
+    vec4f frustum_planes[6];
+    vec4f camera_position; /* w unused */
+    u32 batch_index;
+    u32 batch_count;
+    u32 meshlet_count;
+    u32 index_capacity;
+} MeshletCullPushConstants;
+
+#define CULL_WORKGROUP_SIZE (64)
+#define CULL_DESCRIPTOR_COUNT (6)
+// The compacted index buffer follows the culling pass's bindings; the mesh's meshlets and indices are in a set of their own
+#define MESHLET_CULL_DESCRIPTOR_COUNT (CULL_DESCRIPTOR_COUNT + 1)
+#define MESHLET_DESCRIPTOR_COUNT (2)
+#define MAX_COMPUTE_WORKGROUP_COUNT (65535)
+// Per frame. Objects whose visible meshlets do not fit are drawn whole from the mesh's own index buffer
+#define MESHLET_INDEX_BUFFER_SIZE MEGABYTE(64)
+
+// Sphere around the mesh AABB, in object space
+static inline vec4f Mesh_bounding_sphere(Mesh* mesh)
+{
+    vec3f center = VEC3(0.5f * (mesh->bounds_min[0] + mesh->bounds_max[0]), 0.5f * (mesh->bounds_min[1] + mesh->bounds_max[1]), 0.5f * (mesh->bounds_min[2] + mesh->bounds_max[2]));
+    vec3f half_extent = VEC3(0.5f * (mesh->bounds_max[0] - mesh->bounds_min[0]), 0.5f * (mesh->bounds_max[1] - mesh->bounds_min[1]), 0.5f * (mesh->bounds_max[2] - mesh->bounds_min[2]));
+    vec4f sphere = vec4f_cast(center);
+    sphere.w = vec3_norm(half_extent);
+    return sphere;
+}
+
 const f32 yaw = -90.0f;
 const f32 pitch = 0.0f;
 const f32 speed = 0.10f;
@@ -278,7 +507,7 @@ static inline VkPhysicalDevice pick_physical_device(VkPhysicalDevice* device_buf
     }
 }
 
-static inline VkDevice create_device(VkAllocationCallbacks* pAllocator, VkPhysicalDevice pd, const char* const* device_extensions, u32 device_extension_count, u32* queue_family_indices, u32 queue_family_count)
+static inline VkDevice create_device(VkAllocationCallbacks* pAllocator, VkPhysicalDevice pd, const char* const* device_extensions, u32 device_extension_count, u32* queue_family_indices, u32 queue_family_count, const VkPhysicalDeviceFeatures2* enabled_features)
 {
     f32 queue_priorities[] = { 1.0f };
     VkDeviceQueueCreateInfo queue_create_infos[100] = ZERO_INIT;
@@ -297,6 +526,7 @@ static inline VkDevice create_device(VkAllocationCallbacks* pAllocator, VkPhysic
     VkDeviceCreateInfo device_ci =
     {
         .sType = VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO,
+        .pNext = enabled_features,
         .ppEnabledExtensionNames = device_extension_count > 0 ? device_extensions : NULL,
         .enabledExtensionCount = device_extension_count,
         .pQueueCreateInfos = queue_create_infos,
@@ -409,6 +639,8 @@ typedef struct ShaderProgram
 {
     const char* shaders[2];
     bool vertex_buffer;
+    VertexFormat vertex_format;
+    bool instanced;
 } ShaderProgram;
 
 typedef struct ShaderProgramVK
@@ -416,48 +648,105 @@ typedef struct ShaderProgramVK
     VkPipelineShaderStageCreateInfo shader_stages[2];
 } ShaderProgramVK;
 
-VertexInputDescription Vertex_get_description(void)
+#define VERTEX_BINDING_COUNT (1)
+#define VERTEX_ATTRIBUTE_COUNT (3)
+
+// The description is only needed while creating pipelines, so it lives in the given (usually scratch) arena
+VertexInputDescription Vertex_get_description(Arena* arena, VertexFormat format)
 {
     VertexInputDescription description = ZERO_INIT;
+    description.bindings.ptr = ARENA_NEW(arena, VkVertexInputBindingDescription, VERTEX_BINDING_COUNT);
+    description.bindings.cap = VERTEX_BINDING_COUNT;
+    description.attributes.ptr = ARENA_NEW(arena, VkVertexInputAttributeDescription, VERTEX_ATTRIBUTE_COUNT);
+    description.attributes.cap = VERTEX_ATTRIBUTE_COUNT;
 
     VkVertexInputBindingDescription main_binding =
     {
         .binding = 0,
-        .stride = sizeof(Vertex),
+        .stride = (u32)VertexFormat_stride(format),
         .inputRate = VK_VERTEX_INPUT_RATE_VERTEX,
     };
 
-    vertex_binding_append(&description.bindings, main_binding);
+    vertex_binding_append_assuming_capacity(&description.bindings, main_binding);
 
+    const bool packed = format == VERTEX_FORMAT_PACKED;
     VkVertexInputAttributeDescription position_attribute =
     {
         .binding = 0,
         .location = 0,
-        .format = VK_FORMAT_R32G32B32_SFLOAT,
-        .offset = offsetof(Vertex, position),
+        .format = packed ? VK_FORMAT_R16G16B16A16_UNORM : VK_FORMAT_R32G32B32_SFLOAT,
+        .offset = packed ? offsetof(PackedVertex, position) : offsetof(Vertex, position),
     };
     VkVertexInputAttributeDescription normal_attribute =
     {
         .binding = 0,
         .location = 1,
-        .format = VK_FORMAT_R32G32B32_SFLOAT,
-        .offset = offsetof(Vertex, normal),
+        .format = packed ? VK_FORMAT_R16G16_SNORM : VK_FORMAT_R32G32B32_SFLOAT,
+        .offset = packed ? offsetof(PackedVertex, normal) : offsetof(Vertex, normal),
     };
     VkVertexInputAttributeDescription color_attribute =
     {
         .binding = 0,
         .location = 2,
-        .format = VK_FORMAT_R32G32B32_SFLOAT,
-        .offset = offsetof(Vertex, color),
+        .format = packed ? VK_FORMAT_R8G8B8A8_UNORM : VK_FORMAT_R32G32B32_SFLOAT,
+        .offset = packed ? offsetof(PackedVertex, color) : offsetof(Vertex, color),
     };
 
-    vertex_attribute_append(&description.attributes, position_attribute);
-    vertex_attribute_append(&description.attributes, normal_attribute);
-    vertex_attribute_append(&description.attributes, color_attribute);
+    vertex_attribute_append_assuming_capacity(&description.attributes, position_attribute);
+    vertex_attribute_append_assuming_capacity(&description.attributes, normal_attribute);
+    vertex_attribute_append_assuming_capacity(&description.attributes, color_attribute);
 
     return description;
 }
 
+#define INSTANCE_BINDING (1)
+#define INSTANCE_ATTRIBUTE_LOCATION (3)
+#define INSTANCE_ATTRIBUTE_COUNT (5)
+
+// Adds the per-instance binding to a vertex description: the model matrix as four vec4 columns and the color
+static void InstanceData_add_description(VertexInputDescription* description, Arena* arena)
+{
+    VkVertexInputBindingDescription* bindings = ARENA_NEW(arena, VkVertexInputBindingDescription, description->bindings.len + 1);
+    memcpy(bindings, description->bindings.ptr, description->bindings.len * sizeof(*bindings));
+    description->bindings.ptr = bindings;
+    description->bindings.cap = description->bindings.len + 1;
+
+    VkVertexInputAttributeDescription* attributes = ARENA_NEW(arena, VkVertexInputAttributeDescription, description->attributes.len + INSTANCE_ATTRIBUTE_COUNT);
+    memcpy(attributes, description->attributes.ptr, description->attributes.len * sizeof(*attributes));
+    description->attributes.ptr = attributes;
+    description->attributes.cap = description->attributes.len + INSTANCE_ATTRIBUTE_COUNT;
+
+    VkVertexInputBindingDescription instance_binding =
+    {
+        .binding = INSTANCE_BINDING,
+        .stride = sizeof(InstanceData),
+        .inputRate = VK_VERTEX_INPUT_RATE_INSTANCE,
+    };
+
+    vertex_binding_append_assuming_capacity(&description->bindings, instance_binding);
+
+    for (u32 column = 0; column < 4; column++)
+    {
+        VkVertexInputAttributeDescription model_column_attribute =
+        {
+            .binding = INSTANCE_BINDING,
+            .location = INSTANCE_ATTRIBUTE_LOCATION + column,
+            .format = VK_FORMAT_R32G32B32A32_SFLOAT,
+            .offset = offsetof(InstanceData, model) + column * sizeof(vec4f),
+        };
+        vertex_attribute_append_assuming_capacity(&description->attributes, model_column_attribute);
+    }
+
+    VkVertexInputAttributeDescription color_attribute =
+    {
+        .binding = INSTANCE_BINDING,
+        .location = INSTANCE_ATTRIBUTE_LOCATION + 4,
+        .format = VK_FORMAT_R32G32B32A32_SFLOAT,
+        .offset = offsetof(InstanceData, color),
+    };
+    vertex_attribute_append_assuming_capacity(&description->attributes, color_attribute);
+}
+
 static inline VkImageCreateInfo image_create_info(VkFormat format, VkImageUsageFlagBits usage_flags, VkExtent3D extent)
 {
     VkImageCreateInfo image_create_info =
@@ -514,29 +803,43 @@ static inline VkPipelineDepthStencilStateCreateInfo depth_stencil_create_info(bo
 
 static Mesh mesh_load(const char* path)
 {
-    fastObjMesh* obj = fast_obj_read(path);
-    redassert(obj);
+    ObjFile obj;
+    if (!obj_parse(path, &obj))
+    {
+        RED_PANIC("Failed to read mesh file %s", path);
+    }
     u64 index_count = 0;
-    u32 face_count = obj->face_count;
+    u32 face_count = obj.face_count;
 
     for (u32 i = 0; i < face_count; i++)
     {
-        index_count += 3 * (obj->face_vertices[i] - 2);
+        index_count += 3 * (obj.face_vertices[i] - 2);
     }
 
+    // The de-indexed corners are only a staging step towards the indexed mesh
+    ArenaTemp temp = arena_begin_temp(os_scratch_arena());
     VertexBuffer vb = ZERO_INIT;
-    vertices_resize(&vb, index_count);
+    vb.ptr = ARENA_NEW(temp.arena, Vertex, index_count);
     vb.len = index_count;
+    vb.cap = index_count;
 
     u64 vertex_offset = 0;
     u64 index_offset = 0;
 
+    // The bounds are gathered while the corners are written; deduplication and optimization never move a position
+    Mesh mesh = ZERO_INIT;
+    for (u32 axis = 0; axis < 3; axis++)
+    {
+        mesh.bounds_min[axis] = FLT_MAX;
+        mesh.bounds_max[axis] = -FLT_MAX;
+    }
+
     for (u32 i = 0; i < face_count; i++)
     {
-        u32 face_vertices = obj->face_vertices[i];
+        u32 face_vertices = obj.face_vertices[i];
         for (u32 j = 0; j < face_vertices; j++)
         {
-            fastObjIndex gi = obj->indices[index_offset + j];
+            ObjIndex gi = obj.indices[index_offset + j];
 
             if (j >= 3)
             {
@@ -547,207 +850,2635 @@ static Mesh mesh_load(const char* path)
 
             vb.ptr[vertex_offset++] = (Vertex)
             {
-                .position[0] = obj->positions[gi.p * 3 + 0],
-                .position[1] = obj->positions[gi.p * 3 + 1],
-                .position[2] = obj->positions[gi.p * 3 + 2],
+                .position[0] = obj.positions[gi.p * 3 + 0],
+                .position[1] = obj.positions[gi.p * 3 + 1],
+                .position[2] = obj.positions[gi.p * 3 + 2],
 
-                .normal[0] = obj->normals[gi.n * 3 + 0],
-                .normal[1] = obj->normals[gi.n * 3 + 1],
-                .normal[2] = obj->normals[gi.n * 3 + 2],
+                .normal[0] = obj.normals[gi.n * 3 + 0],
+                .normal[1] = obj.normals[gi.n * 3 + 1],
+                .normal[2] = obj.normals[gi.n * 3 + 2],
 
-                .color[0] = obj->normals[gi.n * 3 + 0],
-                .color[1] = obj->normals[gi.n * 3 + 1],
-                .color[2] = obj->normals[gi.n * 3 + 2],
+                .color[0] = obj.normals[gi.n * 3 + 0],
+                .color[1] = obj.normals[gi.n * 3 + 1],
+                .color[2] = obj.normals[gi.n * 3 + 2],
             };
+
+            for (u32 axis = 0; axis < 3; axis++)
+            {
+                mesh.bounds_min[axis] = MIN(mesh.bounds_min[axis], obj.positions[gi.p * 3 + axis]);
+                mesh.bounds_max[axis] = MAX(mesh.bounds_max[axis], obj.positions[gi.p * 3 + axis]);
+            }
         }
 
-        index_offset += obj->face_vertices[i];
+        index_offset += obj.face_vertices[i];
     }
 
     redassert(vertex_offset == index_count);
-    fast_obj_destroy(obj);
+    obj_free(&obj);
 
-    Mesh mesh = ZERO_INIT;
-    /*u32* remap = NEW(u32, index_count);*/
-    /*u64 vertex_count = meshopt_generateVertexRemap(remap, NULL, index_count, vb.ptr, index_count, sizeof(Vertex));*/
+    // Collapse the de-indexed corners into unique vertices so the post-transform cache can be used
+    u32* remap = ARENA_NEW(temp.arena, u32, index_count);
+    u64 vertex_count = meshopt_generateVertexRemap(remap, null, index_count, vb.ptr, index_count, sizeof(Vertex));
+
+    vertices_resize(&mesh.vertices, vertex_count);
+    mesh.vertices.len = vertex_count;
+    meshopt_remapVertexBuffer(mesh.vertices.ptr, vb.ptr, index_count, sizeof(Vertex), remap);
 
-    /*vertices_resize(&mesh.vertices, vertex_count);*/
-    /*mesh.vertices.len = vertex_count;*/
+    indices_resize(&mesh.indices, index_count);
+    mesh.indices.len = index_count;
+    meshopt_remapIndexBuffer(mesh.indices.ptr, null, index_count, remap);
+    arena_end_temp(temp);
+
+    print("Loaded %s: %" RED_PRI_u64 " indices, %" RED_PRI_u64 " unique vertices (%.02fx fewer)\n", path, index_count, vertex_count, (f64)index_count / (f64)vertex_count);
 
-    /*meshopt_remapVertexBuffer(mesh.vertices.ptr, vb.ptr, , size_t vertex_size, const unsigned int *remap)*/
-    /*meshopt_remapIndexBuffer(m.indices, NULL, indexCount, remap);*/
-    mesh.vertices = vb;
     return mesh;
 }
 
-static void glfw_mouse_callback(GLFWwindow* window, double x, double y)
+#define VERTEX_CACHE_SIZE (16)
+#define OVERDRAW_THRESHOLD (1.05f)
+
+static inline void Mesh_print_statistics(Mesh* mesh, const char* stage)
 {
-    Application* app = (Application*) glfwGetWindowUserPointer(window);
-    if (app->first_mouse)
-    {
-        app->camera.last_x = x;
-        app->camera.last_y = y;
-        app->first_mouse = false;
-    }
+    meshopt_VertexCacheStatistics vcs = meshopt_analyzeVertexCache(mesh->indices.ptr, mesh->indices.len, mesh->vertices.len, VERTEX_CACHE_SIZE, 0, 0);
+    meshopt_OverdrawStatistics os = meshopt_analyzeOverdraw(mesh->indices.ptr, mesh->indices.len, &mesh->vertices.ptr[0].position[0], mesh->vertices.len, sizeof(Vertex));
+    meshopt_VertexFetchStatistics vfs = meshopt_analyzeVertexFetch(mesh->indices.ptr, mesh->indices.len, mesh->vertices.len, sizeof(Vertex));
+    print("[%s]\tACMR: %.03f\tATVR: %.03f\tOverdraw: %.03f\tOverfetch: %.03f\n", stage, vcs.acmr, vcs.atvr, os.overdraw, vfs.overfetch);
+}
 
-    f32 x_offset = (x - app->camera.last_x) * app->camera.mouse_sensitivity;
-    f32 y_offset = (y - app->camera.last_y) * app->camera.mouse_sensitivity;
+// Reorders triangles for the post-transform cache, then for overdraw, then reorders vertices to match the index stream
+static void mesh_optimize(Mesh* mesh)
+{
+    redassert(mesh->indices.len % 3 == 0);
+    Mesh_print_statistics(mesh, "Before optimization");
 
-    app->camera.last_x = x;
-    app->camera.last_y = y;
+    meshopt_optimizeVertexCache(mesh->indices.ptr, mesh->indices.ptr, mesh->indices.len, mesh->vertices.len);
+    meshopt_optimizeOverdraw(mesh->indices.ptr, mesh->indices.ptr, mesh->indices.len, &mesh->vertices.ptr[0].position[0], mesh->vertices.len, sizeof(Vertex), OVERDRAW_THRESHOLD);
+    u64 vertex_count = meshopt_optimizeVertexFetch(mesh->vertices.ptr, mesh->indices.ptr, mesh->indices.len, mesh->vertices.ptr, mesh->vertices.len, sizeof(Vertex));
+    mesh->vertices.len = vertex_count;
 
-    app->camera.yaw += x_offset;
-    app->camera.pitch -= y_offset;
+    Mesh_print_statistics(mesh, "After optimization");
 }
 
-static inline mat4f Camera_update_view(Camera* camera)
+// Splits the mesh into meshlets of at most MESHLET_MAX_VERTICES vertices and MESHLET_MAX_TRIANGLES triangles, with the
+// bounding sphere and normal cone the GPU culls them by. The index buffer is rewritten in meshlet order
+static void mesh_build_meshlets(Mesh* mesh)
 {
-    camera->pitch = MIN(camera->pitch, 89.0f);
-    camera->pitch = MAX(camera->pitch, -89.0f);
-
-    camera->front.x = -sinf(rad(camera->yaw)) * cosf(rad(camera->pitch));
-    camera->front.y = sinf(rad(camera->pitch));
-    camera->front.z = cosf(rad(camera->yaw)) * cosf(rad(camera->pitch));
+    redassert(mesh->indices.len % 3 == 0);
+    ArenaTemp temp = arena_begin_temp(os_scratch_arena());
+    usize max_meshlet_count = meshopt_buildMeshletsBound(mesh->indices.len, MESHLET_MAX_VERTICES, MESHLET_MAX_TRIANGLES);
+    meshopt_Meshlet* built = ARENA_NEW(temp.arena, meshopt_Meshlet, max_meshlet_count);
+    u32* meshlet_vertices = ARENA_NEW(temp.arena, u32, max_meshlet_count * MESHLET_MAX_VERTICES);
+    u8* meshlet_triangles = ARENA_NEW(temp.arena, u8, max_meshlet_count * MESHLET_MAX_TRIANGLES * 3);
+    const f32* positions = &mesh->vertices.ptr[0].position[0];
+    usize meshlet_count = meshopt_buildMeshlets(built, meshlet_vertices, meshlet_triangles, mesh->indices.ptr, mesh->indices.len, positions, mesh->vertices.len, sizeof(Vertex), MESHLET_MAX_VERTICES, MESHLET_MAX_TRIANGLES, MESHLET_CONE_WEIGHT);
+
+    mesh->meshlets = NEW(Meshlet, meshlet_count);
+    mesh->meshlet_count = meshlet_count;
+    u32 index = 0;
+    for (u32 i = 0; i < meshlet_count; i++)
+    {
+        meshopt_Meshlet* m = &built[i];
+        meshopt_Bounds bounds = meshopt_computeMeshletBounds(&meshlet_vertices[m->vertex_offset], &meshlet_triangles[m->triangle_offset], m->triangle_count, positions, mesh->vertices.len, sizeof(Vertex));
+        mesh->meshlets[i] = (Meshlet)
+        {
+            .bounding_sphere = { .x = bounds.center[0], .y = bounds.center[1], .z = bounds.center[2], .w = bounds.radius },
+            .cone = { .x = bounds.cone_axis[0], .y = bounds.cone_axis[1], .z = bounds.cone_axis[2], .w = bounds.cone_cutoff },
+            .first_index = index,
+            .index_count = m->triangle_count * 3,
+        };
 
-    camera->front = vec3_normalize(camera->front);
-    camera->right = vec3_normalize(vec3_cross(VEC3(0, 1.f, 0), camera->front));
-    camera->up = vec3_normalize(vec3_cross(camera->front, camera->right));
+        // Meshlet triangles index the meshlet's vertex list; the mesh index buffer gets the vertices they point to
+        for (u32 j = 0; j < m->triangle_count * 3; j++)
+        {
+            mesh->indices.ptr[index++] = meshlet_vertices[m->vertex_offset + meshlet_triangles[m->triangle_offset + j]];
+        }
+    }
+    redassert(index == mesh->indices.len);
+    arena_end_temp(temp);
 
-    mat4f view_mat = lookat(camera->position, vec3_add(camera->position, camera->front), camera->up);
-    mat4f_print(view_mat);
-    return view_mat;
+    print("Split into %u meshlets, %.1f triangles each on average\n", mesh->meshlet_count, (f64)mesh->indices.len / (3.0 * (f64)mesh->meshlet_count));
+    Mesh_print_statistics(mesh, "Meshlet order");
 }
 
-static inline void Camera_process_scroll(Camera* camera, f32 offset)
+// Appends up to MESH_MAX_LOD_COUNT - 1 simplified copies of the index buffer, each with about LOD_TRIANGLE_RATIO times the
+// triangles of the one before. They reuse the mesh's vertices; the simplifier reports the error each one is drawn by
+static void mesh_build_lods(Mesh* mesh)
 {
-    camera->zoom -= offset;
-    if (camera->zoom < 1.0f)
+    redassert(mesh->indices.len % 3 == 0);
+    const u32 base_index_count = mesh->indices.len;
+    const f32* positions = &mesh->vertices.ptr[0].position[0];
+    const f32 error_scale = meshopt_simplifyScale(positions, mesh->vertices.len, sizeof(Vertex));
+
+    mesh->lods[0] = (MeshLod) { .first_index = 0, .index_count = base_index_count, .error = 0.0f };
+    mesh->lod_count = 1;
+
+    ArenaTemp temp = arena_begin_temp(os_scratch_arena());
+    u32* lod_indices = ARENA_NEW(temp.arena, u32, base_index_count);
+    f32 target_ratio = 1.0f;
+    while (mesh->lod_count < MESH_MAX_LOD_COUNT)
     {
-        camera->zoom = 1.0f;
+        MeshLod* previous = &mesh->lods[mesh->lod_count - 1];
+        target_ratio *= LOD_TRIANGLE_RATIO;
+        usize target_index_count = (usize)((f32)base_index_count * target_ratio) / 3 * 3;
+        f32 error = 0.0f;
+        // From the full mesh every time, so each LOD's error is measured against it rather than against the previous LOD
+        usize index_count = meshopt_simplify(lod_indices, mesh->indices.ptr, base_index_count, positions, mesh->vertices.len, sizeof(Vertex), target_index_count, LOD_MAX_SIMPLIFICATION_ERROR, 0, &error);
+        if (index_count == 0 || (f32)index_count > 0.9f * (f32)previous->index_count)
+        {
+            break;
+        }
+
+        meshopt_optimizeVertexCache(lod_indices, lod_indices, index_count, mesh->vertices.len);
+        MeshLod lod =
+        {
+            .first_index = mesh->indices.len,
+            .index_count = index_count,
+            .error = error * error_scale,
+        };
+        indices_resize(&mesh->indices, mesh->indices.len + index_count);
+        memcpy(mesh->indices.ptr + lod.first_index, lod_indices, index_count * sizeof(u32));
+        mesh->indices.len += index_count;
+        mesh->lods[mesh->lod_count++] = lod;
     }
-    if (camera->zoom > 45.0f)
+    arena_end_temp(temp);
+
+    for (u32 i = 0; i < mesh->lod_count; i++)
     {
-        camera->zoom = 45.0f;
+        print("LOD %u: %u triangles, error %.5f\n", i, mesh->lods[i].index_count / 3, mesh->lods[i].error);
     }
 }
 
-static void glfw_scroll_callback(GLFWwindow* window, double x, double y)
+// Quantizes the processed vertices into PackedVertex: positions relative to the mesh bounds, normals octahedral
+static PackedVertex* mesh_pack_vertices(Mesh* mesh)
 {
-    Application* app = (Application*) glfwGetWindowUserPointer(window);
-    Camera_process_scroll(&app->camera, y);
+    f32 inverse_extent[3];
+    for (u32 axis = 0; axis < 3; axis++)
+    {
+        f32 extent = mesh->bounds_max[axis] - mesh->bounds_min[axis];
+        inverse_extent[axis] = extent > 0.0f ? 1.0f / extent : 0.0f;
+    }
+
+    PackedVertex* packed = NEW(PackedVertex, mesh->vertices.len);
+    for (u32 i = 0; i < mesh->vertices.len; i++)
+    {
+        Vertex* vertex = &mesh->vertices.ptr[i];
+        PackedVertex* out = &packed[i];
+        for (u32 axis = 0; axis < 3; axis++)
+        {
+            out->position[axis] = (u16)quantize_unorm((vertex->position[axis] - mesh->bounds_min[axis]) * inverse_extent[axis], 16);
+            // Negative components render black in the float layout as well
+            out->color[axis] = (u8)quantize_unorm(vertex->color[axis], 8);
+        }
+        out->position[3] = 0;
+        out->color[3] = UINT8_MAX;
+
+        f32 encoded[2];
+        octahedral_encode(VEC3(vertex->normal[0], vertex->normal[1], vertex->normal[2]), encoded);
+        out->normal[0] = (s16)quantize_snorm(encoded[0], 16);
+        out->normal[1] = (s16)quantize_snorm(encoded[1], 16);
+    }
+
+    return packed;
 }
 
-static void app_handle_input(Application* app)
+// Packs the processed vertices and indices into the layouts the GPU buffers use
+static void mesh_finalize(Mesh* mesh, VertexFormat vertex_format)
 {
-    f32 camera_speed = app->camera.movement_speed * app->delta_time;
+    redassert(mesh->vertices.len > 0);
+    mesh->vertex_count = mesh->vertices.len;
+    mesh->vertex_format = vertex_format;
+    if (vertex_format == VERTEX_FORMAT_PACKED)
+    {
+        mesh->vertex_data = mesh_pack_vertices(mesh);
+        print("Packed %u vertices into %" RED_PRI_u64 " bytes each instead of %" RED_PRI_u64 "\n", mesh->vertex_count, (u64)sizeof(PackedVertex), (u64)sizeof(Vertex));
+    }
+    else
+    {
+        mesh->vertex_data = mesh->vertices.ptr;
+    }
 
-    GLFWwindow* window = app->window.handle.glfw;
+    mesh->index_count = mesh->indices.len;
+    if (!mesh->lod_count)
+    {
+        mesh->lods[0] = (MeshLod) { .first_index = 0, .index_count = mesh->index_count, .error = 0.0f };
+        mesh->lod_count = 1;
+    }
+    // The meshlet culling shader reads the index buffer as uints
+    mesh->index_type = mesh->vertices.len <= UINT16_MAX && !mesh->meshlet_count ? VK_INDEX_TYPE_UINT16 : VK_INDEX_TYPE_UINT32;
 
-    if (glfwGetKey(window, GLFW_KEY_ESCAPE) == GLFW_PRESS)
+    if (mesh->index_type == VK_INDEX_TYPE_UINT16)
     {
-        glfwSetWindowShouldClose(window, true);
-        return;
+        u16* index_data = NEW(u16, mesh->index_count);
+        for (u32 i = 0; i < mesh->index_count; i++)
+        {
+            index_data[i] = (u16)mesh->indices.ptr[i];
+        }
+        mesh->index_data = index_data;
     }
-    if (glfwGetKey(window, GLFW_KEY_W) == GLFW_PRESS)
+    else
     {
-        app->camera.position = vec3_add(app->camera.position, vec3_scale(app->camera.front, camera_speed));
+        mesh->index_data = mesh->indices.ptr;
     }
-    if (glfwGetKey(window, GLFW_KEY_S) == GLFW_PRESS)
+}
+
+#define MESH_CACHE_MAGIC (0x48534d52) // "RMSH"
+#define MESH_CACHE_VERSION (4)
+#define MESH_CACHE_EXTENSION ".rmesh"
+#define MESH_CACHE_MAX_ATTRIBUTE_COUNT (8)
+#define MESH_CACHE_BLOB_ALIGNMENT (16)
+
+typedef enum MeshCacheFlags
+{
+    MESH_CACHE_FLAG_OPTIMIZED = 1 << 0,
+    MESH_CACHE_FLAG_PACKED_VERTICES = 1 << 1,
+    MESH_CACHE_FLAG_MESHLETS = 1 << 2,
+    MESH_CACHE_FLAG_LODS = 1 << 3,
+    MESH_CACHE_FLAG_COMPRESSED = 1 << 4,
+} MeshCacheFlags;
+
+static inline VertexFormat MeshCacheFlags_vertex_format(u32 flags)
+{
+    return (flags & MESH_CACHE_FLAG_PACKED_VERTICES) ? VERTEX_FORMAT_PACKED : VERTEX_FORMAT_FLOAT;
+}
+
+typedef struct MeshCacheAttribute
+{
+    u32 location;
+    u32 format;
+    u32 offset;
+} MeshCacheAttribute;
+
+typedef struct MeshCacheHeader
+{
+    u32 magic;
+    u32 version;
+    u32 flags;
+    u32 vertex_stride;
+    u64 source_size;
+    u64 source_modification_time;
+    u32 attribute_count;
+    MeshCacheAttribute attributes[MESH_CACHE_MAX_ATTRIBUTE_COUNT];
+    u32 index_type;
+    u32 index_count;
+    u32 vertex_count;
+    f32 bounds_min[3];
+    f32 bounds_max[3];
+    u64 index_offset;
+    u64 index_size; /* encoded size when MESH_CACHE_FLAG_COMPRESSED is set, like vertex_size */
+    u64 vertex_offset;
+    u64 vertex_size;
+    u32 meshlet_count;
+    u32 reserved;
+    u64 meshlet_offset;
+    u64 meshlet_size;
+    u32 lod_count;
+    MeshLod lods[MESH_MAX_LOD_COUNT];
+} MeshCacheHeader;
+
+static inline u64 align_u64(u64 value, u64 alignment)
+{
+    return (value + alignment - 1) & ~(alignment - 1);
+}
+
+// The header describes the vertex layout the data was cooked with so a layout change invalidates old caches
+static inline void MeshCacheHeader_set_layout(MeshCacheHeader* header, VertexFormat format)
+{
+    ArenaTemp temp = arena_begin_temp(os_scratch_arena());
+    VertexInputDescription description = Vertex_get_description(temp.arena, format);
+    redassert(description.attributes.len <= MESH_CACHE_MAX_ATTRIBUTE_COUNT);
+    redassert(description.bindings.len == 1);
+
+    header->vertex_stride = description.bindings.ptr[0].stride;
+    header->attribute_count = description.attributes.len;
+    for (u32 i = 0; i < description.attributes.len; i++)
     {
-        app->camera.position = vec3_sub(app->camera.position, vec3_scale(app->camera.front, camera_speed));
+        header->attributes[i] = (MeshCacheAttribute)
+        {
+            .location = description.attributes.ptr[i].location,
+            .format = description.attributes.ptr[i].format,
+            .offset = description.attributes.ptr[i].offset,
+        };
     }
-    if (glfwGetKey(window, GLFW_KEY_A) == GLFW_PRESS)
+
+    arena_end_temp(temp);
+}
+
+// Written so a corrupt offset or size can not wrap around
+static inline bool blob_in_file(u64 offset, u64 size, u64 file_size)
+{
+    return size <= file_size && offset <= file_size - size;
+}
+
+static inline u32 EncodedBuffer_chunk_count(const EncodedBuffer* buffer)
+{
+    return (buffer->element_count + buffer->chunk_element_count - 1) / buffer->chunk_element_count;
+}
+
+static inline u64 EncodedBuffer_decoded_size(const EncodedBuffer* buffer)
+{
+    return (u64)buffer->element_count * buffer->element_size;
+}
+
+// Checks the chunk size table against the blob, so decoding never reads past it
+static bool EncodedBuffer_valid(const EncodedBuffer* buffer)
+{
+    u32 chunk_count = EncodedBuffer_chunk_count(buffer);
+    u64 size = (u64)chunk_count * sizeof(u32);
+    if (size > buffer->size)
     {
-        app->camera.position = vec3_add(app->camera.position, vec3_scale(app->camera.right, camera_speed));
+        return false;
     }
-    if (glfwGetKey(window, GLFW_KEY_D) == GLFW_PRESS)
+
+    const u32* chunk_sizes = (const u32*)buffer->data;
+    for (u32 i = 0; i < chunk_count; i++)
     {
-        app->camera.position = vec3_sub(app->camera.position, vec3_scale(app->camera.right, camera_speed));
+        size += chunk_sizes[i];
     }
+    return size == buffer->size;
 }
 
-static inline Camera Camera_init(void)
+// Where each chunk starts within data
+static u64* EncodedBuffer_chunk_offsets(const EncodedBuffer* buffer, Arena* arena)
 {
-    Camera camera =
+    u32 chunk_count = EncodedBuffer_chunk_count(buffer);
+    const u32* chunk_sizes = (const u32*)buffer->data;
+    u64* offsets = ARENA_NEW(arena, u64, chunk_count);
+    u64 offset = (u64)chunk_count * sizeof(u32);
+    for (u32 i = 0; i < chunk_count; i++)
     {
-        .position = VEC3(0.0f, 0.0f, -20.0f),
-        .yaw = 0.0f,
-        .pitch = 0.0f,
-        .movement_speed = speed,
-        .mouse_sensitivity = sensitivity,
-        .zoom = zoom,
-    };
-    return camera;
+        offsets[i] = offset;
+        offset += chunk_sizes[i];
+    }
+    return offsets;
 }
 
-typedef struct Frame
+/*
+ * Cook side of EncodedBuffer: encodes element_count vertices of element_size bytes, or u32 indices into vertex_count
+ * vertices, chunk by chunk. Returns the blob, allocated with NEW, and its size.
+ */
+static u8* encode_chunks(const void* elements, u32 element_count, u32 element_size, u32 vertex_count, bool indices, u64* size)
 {
-    struct
+    u32 chunk_element_count = indices ? MESH_CODEC_CHUNK_INDICES : MESH_CODEC_CHUNK_VERTICES;
+    u32 chunk_count = (element_count + chunk_element_count - 1) / chunk_element_count;
+    u32 bound_element_count = MIN(element_count, chunk_element_count);
+    usize chunk_bound = indices ? meshopt_encodeIndexBufferBound(bound_element_count, vertex_count) : meshopt_encodeVertexBufferBound(bound_element_count, element_size);
+
+    u8* blob = NEW(u8, ((u64)chunk_count * (sizeof(u32) + chunk_bound)));
+    u32* chunk_sizes = (u32*)blob;
+    u64 offset = (u64)chunk_count * sizeof(u32);
+    for (u32 i = 0; i < chunk_count; i++)
     {
-        VkSemaphore present_sem, render_sem;
-        VkFence render_fence;
-        VkCommandPool command_pool;
-        VkCommandBuffer command_buffer;
-    } sync;
-
-    AllocatedBuffer camera_buffer;
-    VkDescriptorSet global_descriptor;
-} Frame;
+        u32 first = i * chunk_element_count;
+        u32 count = MIN(chunk_element_count, element_count - first);
+        usize chunk_size = indices ?
+            meshopt_encodeIndexBuffer(blob + offset, chunk_bound, (const u32*)elements + first, count) :
+            meshopt_encodeVertexBuffer(blob + offset, chunk_bound, (const u8*)elements + (u64)first * element_size, count, element_size);
+        redassert(chunk_size > 0);
+        chunk_sizes[i] = (u32)chunk_size;
+        offset += chunk_size;
+    }
 
-#define FRAME_OVERLAP (2)
-const u32 frame_overlap = FRAME_OVERLAP;
+    *size = offset;
+    return blob;
+}
 
-static inline AllocatedBuffer create_buffer(VmaAllocator allocator, usize allocation_size, VkBufferUsageFlags usage, VmaMemoryUsage memory_usage)
+static bool mesh_cache_read(const char* cache_path, FileInfo* source_info, u32 flags, Mesh* mesh)
 {
-    VkBufferCreateInfo ci = 
+    FileInfo cache_info;
+    if (!os_file_get_info(cache_path, &cache_info) || cache_info.size < sizeof(MeshCacheHeader))
     {
-        .sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO,
-        .size = allocation_size,
-        .usage = usage,
-    };
+        return false;
+    }
 
-    VmaAllocationCreateInfo ai =
+    // All of the file is going to be copied to the GPU right away, so ask the kernel to read it ahead
+    FileMapping mapping;
+    if (!os_file_map(cache_path, FILE_ACCESS_HINT_WILLNEED, &mapping))
     {
-        .usage = memory_usage,
-    };
+        return false;
+    }
 
-    AllocatedBuffer buffer;
+    u8* file = (u8*)mapping.ptr;
+    u64 file_size = mapping.size;
+    MeshCacheHeader* header = (MeshCacheHeader*)file;
+    VertexFormat vertex_format = MeshCacheFlags_vertex_format(flags);
+    MeshCacheHeader expected_layout = ZERO_INIT;
+    MeshCacheHeader_set_layout(&expected_layout, vertex_format);
+    bool compressed = (flags & MESH_CACHE_FLAG_COMPRESSED) != 0;
+    u32 index_size = header->index_type == VK_INDEX_TYPE_UINT16 ? sizeof(u16) : sizeof(u32);
+
+    bool valid = header->magic == MESH_CACHE_MAGIC && header->version == MESH_CACHE_VERSION && header->flags == flags &&
+        header->source_size == source_info->size && header->source_modification_time == source_info->modification_time &&
+        header->vertex_stride == expected_layout.vertex_stride && header->attribute_count == expected_layout.attribute_count &&
+        memcmp(header->attributes, expected_layout.attributes, sizeof(header->attributes)) == 0 &&
+        (header->index_type == VK_INDEX_TYPE_UINT16 || header->index_type == VK_INDEX_TYPE_UINT32) &&
+        blob_in_file(header->index_offset, header->index_size, file_size) && blob_in_file(header->vertex_offset, header->vertex_size, file_size) &&
+        blob_in_file(header->meshlet_offset, header->meshlet_size, file_size) &&
+        header->meshlet_size == (u64)header->meshlet_count * sizeof(Meshlet) &&
+        (compressed || header->vertex_size == (u64)header->vertex_count * header->vertex_stride) &&
+        (compressed || header->index_size == (u64)header->index_count * index_size);
+
+    valid = valid && header->lod_count >= 1 && header->lod_count <= MESH_MAX_LOD_COUNT;
+    for (u32 i = 0; valid && i < header->lod_count; i++)
+    {
+        valid = (u64)header->lods[i].first_index + header->lods[i].index_count <= header->index_count;
+    }
 
-    VKCHECK(vmaCreateBuffer(allocator, &ci, &ai, &buffer.handle, &buffer.allocation, null));
+    // The meshlet culling shader reads the index buffer as uints, from the meshlet ranges as they are
+    valid = valid && (!header->meshlet_count || (header->index_type == VK_INDEX_TYPE_UINT32 && header->meshlet_offset % MESH_CACHE_BLOB_ALIGNMENT == 0));
+    const Meshlet* meshlets = (const Meshlet*)(file + header->meshlet_offset);
+    for (u32 i = 0; valid && i < header->meshlet_count; i++)
+    {
+        valid = (u64)meshlets[i].first_index + meshlets[i].index_count <= header->index_count;
+    }
 
-    return buffer;
+    EncodedBuffer encoded_vertices = ZERO_INIT;
+    EncodedBuffer encoded_indices = ZERO_INIT;
+    if (valid && compressed)
+    {
+        encoded_vertices = (EncodedBuffer)
+        {
+            .data = file + header->vertex_offset,
+            .size = header->vertex_size,
+            .element_count = header->vertex_count,
+            .element_size = header->vertex_stride,
+            .chunk_element_count = MESH_CODEC_CHUNK_VERTICES,
+        };
+        encoded_indices = (EncodedBuffer)
+        {
+            .data = file + header->index_offset,
+            .size = header->index_size,
+            .element_count = header->index_count,
+            .element_size = index_size,
+            .chunk_element_count = MESH_CODEC_CHUNK_INDICES,
+            .indices = true,
+        };
+        valid = EncodedBuffer_valid(&encoded_vertices) && EncodedBuffer_valid(&encoded_indices);
+    }
+
+    if (!valid)
+    {
+        print("Mesh cache %s is stale or invalid\n", cache_path);
+        os_file_unmap(&mapping);
+        return false;
+    }
+
+    // The cooked blobs are used in place: no parsing nor conversion before the GPU upload
+    *mesh = (Mesh) ZERO_INIT;
+    mesh->mapping = mapping;
+    mesh->vertex_data = compressed ? null : file + header->vertex_offset;
+    mesh->vertex_count = header->vertex_count;
+    mesh->vertex_format = vertex_format;
+    mesh->index_data = compressed ? null : file + header->index_offset;
+    mesh->encoded_vertices = encoded_vertices;
+    mesh->encoded_indices = encoded_indices;
+    mesh->index_count = header->index_count;
+    mesh->index_type = (VkIndexType)header->index_type;
+    mesh->meshlets = header->meshlet_count ? (Meshlet*)(file + header->meshlet_offset) : null;
+    mesh->meshlet_count = header->meshlet_count;
+    memcpy(mesh->lods, header->lods, sizeof(mesh->lods));
+    mesh->lod_count = header->lod_count;
+    memcpy(mesh->bounds_min, header->bounds_min, sizeof(mesh->bounds_min));
+    memcpy(mesh->bounds_max, header->bounds_max, sizeof(mesh->bounds_max));
+
+    return true;
 }
 
-s32 main(s32 argc, char* argv[])
+static void mesh_cache_write(const char* cache_path, FileInfo* source_info, u32 flags, Mesh* mesh)
 {
-    os_init();
-
-    Application app =
+    MeshCacheHeader header =
     {
-        .title = "Hello world",
-        .window.width = 1024,
-        .window.height = 768, 
-        .version = 1,
-        .delta_time = 0,
-        .camera = Camera_init(),
-        .first_mouse = true,
+        .magic = MESH_CACHE_MAGIC,
+        .version = MESH_CACHE_VERSION,
+        .flags = flags,
+        .source_size = source_info->size,
+        .source_modification_time = source_info->modification_time,
+        .index_type = mesh->index_type,
+        .index_count = mesh->index_count,
+        .vertex_count = mesh->vertex_count,
+        .meshlet_count = mesh->meshlet_count,
+        .lod_count = mesh->lod_count,
     };
 
-    Frame frame[FRAME_OVERLAP] = ZERO_INIT;
+    MeshCacheHeader_set_layout(&header, mesh->vertex_format);
+    memcpy(header.bounds_min, mesh->bounds_min, sizeof(header.bounds_min));
+    memcpy(header.bounds_max, mesh->bounds_max, sizeof(header.bounds_max));
+    memcpy(header.lods, mesh->lods, sizeof(header.lods));
+
+    const void* index_data = mesh->index_data;
+    const void* vertex_data = mesh->vertex_data;
+    u8* encoded_indices = null;
+    u8* encoded_vertices = null;
+    header.index_size = (u64)mesh->index_count * Mesh_index_size(mesh);
+    header.vertex_size = (u64)mesh->vertex_count * VertexFormat_stride(mesh->vertex_format);
+    if (flags & MESH_CACHE_FLAG_COMPRESSED)
+    {
+        // The index codec takes 32-bit indices; it decodes to either size
+        u64 decoded_size = header.index_size + header.vertex_size;
+        index_data = encoded_indices = encode_chunks(mesh->indices.ptr, mesh->index_count, sizeof(u32), mesh->vertex_count, true, &header.index_size);
+        vertex_data = encoded_vertices = encode_chunks(mesh->vertex_data, mesh->vertex_count, VertexFormat_stride(mesh->vertex_format), 0, false, &header.vertex_size);
+        u64 encoded_size = header.index_size + header.vertex_size;
+        print("Compressed the vertices and indices of %s from %.2f MB to %.2f MB (%.2fx)\n", cache_path, (f64)decoded_size / MEGABYTE(1), (f64)encoded_size / MEGABYTE(1), (f64)decoded_size / (f64)encoded_size);
+    }
 
-    s32 result = glfwInit();
-    glfwWindowHint(GLFW_CLIENT_API, GLFW_NO_API);
-    volkInitialize();
-    redassert(result == GLFW_TRUE);
-    app.window.handle.glfw = glfwCreateWindow(app.window.width, app.window.height, app.title, NULL, NULL);
-    redassert(app.window.handle.glfw);
-    glfwSetWindowUserPointer(app.window.handle.glfw, &app);
-    glfwSetCursorPosCallback(app.window.handle.glfw, glfw_mouse_callback);
-    glfwSetScrollCallback(app.window.handle.glfw, glfw_scroll_callback);
+    header.index_offset = align_u64(sizeof(MeshCacheHeader), MESH_CACHE_BLOB_ALIGNMENT);
+    header.vertex_offset = align_u64(header.index_offset + header.index_size, MESH_CACHE_BLOB_ALIGNMENT);
+    header.meshlet_offset = align_u64(header.vertex_offset + header.vertex_size, MESH_CACHE_BLOB_ALIGNMENT);
+    header.meshlet_size = (u64)mesh->meshlet_count * sizeof(Meshlet);
 
-    VkAllocationCallbacks* pAllocator = NULL;
+    static const u8 padding[MESH_CACHE_BLOB_ALIGNMENT] = ZERO_INIT;
+    FileChunk chunks[] =
+    {
+        { .data = &header, .size = sizeof(header) },
+        { .data = padding, .size = header.index_offset - sizeof(header) },
+        { .data = index_data, .size = header.index_size },
+        { .data = padding, .size = header.vertex_offset - (header.index_offset + header.index_size) },
+        { .data = vertex_data, .size = header.vertex_size },
+        { .data = padding, .size = header.meshlet_offset - (header.vertex_offset + header.vertex_size) },
+        { .data = mesh->meshlets, .size = header.meshlet_size },
+    };
 
-    // Layers
+    if (!os_file_write(cache_path, chunks, array_length(chunks)))
+    {
+        print("Could not write mesh cache %s\n", cache_path);
+    }
+
+    if (encoded_indices)
+    {
+        DELETE(encoded_indices);
+        DELETE(encoded_vertices);
+    }
+}
+
+// Reads one byte per page, so the file is in memory before anyone else touches the mapping
+static void prefault_pages(const void* address, usize size)
+{
+    const usize page_size = os_get_page_size();
+    const volatile u8* bytes = (const volatile u8*)address;
+    for (usize offset = 0; offset < size; offset += page_size)
+    {
+        (void)bytes[offset];
+    }
+}
+
+typedef enum MeshStreamState
+{
+    MESH_STREAM_LOADING, /* owned by the streaming threads, then partly uploaded */
+    MESH_STREAM_UPLOADING, /* copies submitted; resident once the upload timeline reaches upload_value */
+    MESH_STREAM_RESIDENT,
+} MeshStreamState;
+
+// Where the upload of a mesh resumes next frame
+typedef struct MeshUpload
+{
+    u64 offset; /* bytes of the vertex, index and meshlet buffers, in that order, already written */
+    u64 size;
+    void* mapped[3]; /* the memory of each buffer when it is host-visible */
+} MeshUpload;
+
+// A mesh travelling through the asset pipeline: read on the I/O thread, parsed on the parse thread, uploaded on the render thread
+typedef struct MeshStream
+{
+    const char* path;
+    u32 flags; /* MeshCacheFlags */
+    FileInfo source_info;
+    SB* cache_path;
+    bool cached; /* the read stage mapped an up-to-date cooked file into loaded */
+    // Built by the streaming threads. The render thread only ever looks at mesh, which it copies loaded into once it pops
+    // the stream off the upload queue, so everything the streaming threads wrote happens before it
+    Mesh loaded;
+    Mesh mesh;
+    MeshStreamState state;
+    MeshUpload upload;
+    u64 upload_value;
+} MeshStream;
+
+// Read stage: maps the cooked file if it is up to date and pulls it into memory. Otherwise it only warms the page cache for the OBJ parser
+static void MeshStream_read(MeshStream* stream)
+{
+    if (!os_file_get_info(stream->path, &stream->source_info))
+    {
+        RED_PANIC("Mesh file %s not found", stream->path);
+    }
+
+    stream->cache_path = sb_alloc();
+    sb_strcpy(stream->cache_path, stream->path);
+    sb_append_str(stream->cache_path, MESH_CACHE_EXTENSION);
+
+    stream->cached = mesh_cache_read(sb_ptr(stream->cache_path), &stream->source_info, stream->flags, &stream->loaded);
+    if (stream->cached)
+    {
+        prefault_pages(stream->loaded.mapping.ptr, stream->loaded.mapping.size);
+        return;
+    }
+
+    FileMapping source;
+    if (os_file_map(stream->path, FILE_ACCESS_HINT_SEQUENTIAL, &source))
+    {
+        prefault_pages(source.ptr, source.size);
+        os_file_unmap(&source);
+    }
+}
+
+// Parse stage: cooked meshes are used in place; anything else is parsed, processed and cooked for the next run
+static void MeshStream_parse(MeshStream* stream)
+{
+    if (stream->cached)
+    {
+        print("Loaded %s from the mesh cache (%.2f MB)\n", stream->path, (f64)stream->loaded.mapping.size / MEGABYTE(1));
+        return;
+    }
+
+    stream->loaded = mesh_load(stream->path);
+    if (stream->flags & MESH_CACHE_FLAG_OPTIMIZED)
+    {
+        mesh_optimize(&stream->loaded);
+    }
+    if (stream->flags & MESH_CACHE_FLAG_MESHLETS)
+    {
+        mesh_build_meshlets(&stream->loaded);
+    }
+    if (stream->flags & MESH_CACHE_FLAG_LODS)
+    {
+        mesh_build_lods(&stream->loaded);
+    }
+    mesh_finalize(&stream->loaded, MeshCacheFlags_vertex_format(stream->flags));
+    mesh_cache_write(sb_ptr(stream->cache_path), &stream->source_info, stream->flags, &stream->loaded);
+}
+
+#define PIPELINE_CACHE_PATH "redgfx.pipelinecache"
+#define PIPELINE_CACHE_MAGIC (0x43504452) // "RDPC"
+#define PIPELINE_CACHE_VERSION (1)
+
+// Precedes the driver's cache blob on disk, so a blob is only handed back to the device and driver that produced it
+typedef struct PipelineCacheHeader
+{
+    u32 magic;
+    u32 version;
+    u32 vendor_id;
+    u32 device_id;
+    u32 driver_version;
+    u8 uuid[VK_UUID_SIZE];
+    u32 reserved;
+    u64 data_size;
+} PipelineCacheHeader;
+
+typedef struct PipelineCacheStats
+{
+    u32 pipeline_count;
+    u32 hit_count;
+    u32 feedback_count; /* pipelines the driver reported creation feedback for */
+    f64 creation_ms;
+} PipelineCacheStats;
+
+static inline PipelineCacheHeader PipelineCacheHeader_for_device(const VkPhysicalDeviceProperties* properties, u64 data_size)
+{
+    PipelineCacheHeader header =
+    {
+        .magic = PIPELINE_CACHE_MAGIC,
+        .version = PIPELINE_CACHE_VERSION,
+        .vendor_id = properties->vendorID,
+        .device_id = properties->deviceID,
+        .driver_version = properties->driverVersion,
+        .data_size = data_size,
+    };
+    memcpy(header.uuid, properties->pipelineCacheUUID, VK_UUID_SIZE);
+    return header;
+}
+
+// Creates the pipeline cache, seeded from the file at path when it was written for this exact device and driver
+static VkPipelineCache pipeline_cache_load(VkDevice device, VkAllocationCallbacks* pAllocator, const VkPhysicalDeviceProperties* properties, const char* path)
+{
+    VkPipelineCacheCreateInfo pipeline_cache_ci =
+    {
+        .sType = VK_STRUCTURE_TYPE_PIPELINE_CACHE_CREATE_INFO,
+    };
+
+    FileInfo info;
+    FileMapping mapping = ZERO_INIT;
+    if (os_file_get_info(path, &info) && info.size >= sizeof(PipelineCacheHeader) && os_file_map(path, FILE_ACCESS_HINT_SEQUENTIAL, &mapping))
+    {
+        const PipelineCacheHeader* header = (const PipelineCacheHeader*)mapping.ptr;
+        PipelineCacheHeader expected = PipelineCacheHeader_for_device(properties, header->data_size);
+        if (memcmp(header, &expected, sizeof(expected)) == 0 && sizeof(PipelineCacheHeader) + header->data_size == mapping.size)
+        {
+            pipeline_cache_ci.initialDataSize = header->data_size;
+            pipeline_cache_ci.pInitialData = header + 1;
+            print("Loaded %" RED_PRI_u64 " bytes of pipeline cache from %s\n", header->data_size, path);
+        }
+        else
+        {
+            print("Pipeline cache %s was written by another device or driver; starting from an empty one\n", path);
+        }
+    }
+
+    VkPipelineCache pipeline_cache;
+    VKCHECK(vkCreatePipelineCache(device, &pipeline_cache_ci, pAllocator, &pipeline_cache));
+    if (mapping.ptr)
+    {
+        os_file_unmap(&mapping);
+    }
+
+    return pipeline_cache;
+}
+
+static void pipeline_cache_save(VkDevice device, VkPipelineCache pipeline_cache, const VkPhysicalDeviceProperties* properties, const char* path)
+{
+    usize data_size = 0;
+    VKCHECK(vkGetPipelineCacheData(device, pipeline_cache, &data_size, null));
+    u8* data = NEW(u8, data_size);
+    VKCHECK(vkGetPipelineCacheData(device, pipeline_cache, &data_size, data));
+
+    PipelineCacheHeader header = PipelineCacheHeader_for_device(properties, data_size);
+    FileChunk chunks[] =
+    {
+        { .data = &header, .size = sizeof(header) },
+        { .data = data, .size = data_size },
+    };
+
+    if (!os_file_write(path, chunks, array_length(chunks)))
+    {
+        print("Could not write pipeline cache %s\n", path);
+    }
+    free_chunk(data);
+}
+
+static inline void PipelineCacheStats_add(PipelineCacheStats* stats, const VkPipelineCreationFeedbackEXT* feedback)
+{
+    stats->pipeline_count++;
+    if (feedback->flags & VK_PIPELINE_CREATION_FEEDBACK_VALID_BIT_EXT)
+    {
+        stats->feedback_count++;
+        stats->hit_count += (feedback->flags & VK_PIPELINE_CREATION_FEEDBACK_APPLICATION_PIPELINE_CACHE_HIT_BIT_EXT) != 0;
+    }
+}
+
+static void PipelineCacheStats_print(PipelineCacheStats* stats)
+{
+    print("Created %u pipelines in %.3f ms", stats->pipeline_count, stats->creation_ms);
+    if (stats->feedback_count)
+    {
+        print(", pipeline cache hit rate %u/%u (%.0f%%)\n", stats->hit_count, stats->feedback_count, 100.0 * stats->hit_count / stats->feedback_count);
+    }
+    else
+    {
+        print(" (no creation feedback to report the pipeline cache hit rate)\n");
+    }
+}
+
+// Creates a compute pipeline from the SPIR-V file at path through the pipeline cache and adds it to the stats
+static VkPipeline create_compute_pipeline(VkDevice device, VkAllocationCallbacks* pAllocator, VkPipelineCache pipeline_cache, const char* path, VkPipelineLayout layout, bool creation_feedback, PipelineCacheStats* stats)
+{
+    FileMapping file;
+    bool mapped = os_file_map(path, FILE_ACCESS_HINT_SEQUENTIAL, &file);
+    redassert(mapped);
+    redassert(file.size % sizeof(u32) == 0);
+    VkShaderModuleCreateInfo shader_ci =
+    {
+        .sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO,
+        .pCode = (const u32*)file.ptr,
+        .codeSize = file.size,
+    };
+    VkShaderModule shader;
+    VKCHECK(vkCreateShaderModule(device, &shader_ci, pAllocator, &shader));
+    os_file_unmap(&file);
+
+    VkPipelineCreationFeedbackEXT feedback = ZERO_INIT;
+    VkPipelineCreationFeedbackEXT stage_feedback;
+    VkPipelineCreationFeedbackCreateInfoEXT feedback_ci =
+    {
+        .sType = VK_STRUCTURE_TYPE_PIPELINE_CREATION_FEEDBACK_CREATE_INFO_EXT,
+        .pPipelineCreationFeedback = &feedback,
+        .pipelineStageCreationFeedbackCount = 1,
+        .pPipelineStageCreationFeedbacks = &stage_feedback,
+    };
+    VkComputePipelineCreateInfo pipeline_ci =
+    {
+        .sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO,
+        .pNext = creation_feedback ? &feedback_ci : null,
+        .stage = pipeline_shader_stage_create_info(VK_SHADER_STAGE_COMPUTE_BIT, shader),
+        .layout = layout,
+    };
+    VkPipeline pipeline;
+    u64 pipeline_counter = os_performance_counter();
+    VKCHECK(vkCreateComputePipelines(device, pipeline_cache, 1, &pipeline_ci, pAllocator, &pipeline));
+    stats->creation_ms += os_compute_ms(pipeline_counter, os_performance_counter());
+    PipelineCacheStats_add(stats, &feedback);
+    vkDestroyShaderModule(device, shader, pAllocator);
+
+    return pipeline;
+}
+
+static void glfw_mouse_callback(GLFWwindow* window, double x, double y)
+{
+    Application* app = (Application*) glfwGetWindowUserPointer(window);
+    if (app->first_mouse)
+    {
+        app->camera.last_x = x;
+        app->camera.last_y = y;
+        app->first_mouse = false;
+    }
+
+    f32 x_offset = (x - app->camera.last_x) * app->camera.mouse_sensitivity;
+    f32 y_offset = (y - app->camera.last_y) * app->camera.mouse_sensitivity;
+
+    app->camera.last_x = x;
+    app->camera.last_y = y;
+
+    app->camera.yaw += x_offset;
+    app->camera.pitch -= y_offset;
+}
+
+static inline mat4f Camera_update_view(Camera* camera)
+{
+    camera->pitch = MIN(camera->pitch, 89.0f);
+    camera->pitch = MAX(camera->pitch, -89.0f);
+
+    camera->front.x = -sinf(rad(camera->yaw)) * cosf(rad(camera->pitch));
+    camera->front.y = sinf(rad(camera->pitch));
+    camera->front.z = cosf(rad(camera->yaw)) * cosf(rad(camera->pitch));
+
+    camera->front = vec3_normalize(camera->front);
+    camera->right = vec3_normalize(vec3_cross(VEC3(0, 1.f, 0), camera->front));
+    camera->up = vec3_normalize(vec3_cross(camera->front, camera->right));
+
+    mat4f view_mat = lookat(camera->position, vec3_add(camera->position, camera->front), camera->up);
+    return view_mat;
+}
+
+static inline void Camera_process_scroll(Camera* camera, f32 offset)
+{
+    camera->zoom -= offset;
+    if (camera->zoom < 1.0f)
+    {
+        camera->zoom = 1.0f;
+    }
+    if (camera->zoom > 45.0f)
+    {
+        camera->zoom = 45.0f;
+    }
+}
+
+static void glfw_scroll_callback(GLFWwindow* window, double x, double y)
+{
+    Application* app = (Application*) glfwGetWindowUserPointer(window);
+    Camera_process_scroll(&app->camera, y);
+}
+
+static void app_handle_input(Application* app)
+{
+    f32 camera_speed = app->camera.movement_speed * app->delta_time;
+
+    GLFWwindow* window = app->window.handle.glfw;
+
+    if (glfwGetKey(window, GLFW_KEY_ESCAPE) == GLFW_PRESS)
+    {
+        glfwSetWindowShouldClose(window, true);
+        return;
+    }
+    if (glfwGetKey(window, GLFW_KEY_W) == GLFW_PRESS)
+    {
+        app->camera.position = vec3_add(app->camera.position, vec3_scale(app->camera.front, camera_speed));
+    }
+    if (glfwGetKey(window, GLFW_KEY_S) == GLFW_PRESS)
+    {
+        app->camera.position = vec3_sub(app->camera.position, vec3_scale(app->camera.front, camera_speed));
+    }
+    if (glfwGetKey(window, GLFW_KEY_A) == GLFW_PRESS)
+    {
+        app->camera.position = vec3_add(app->camera.position, vec3_scale(app->camera.right, camera_speed));
+    }
+    if (glfwGetKey(window, GLFW_KEY_D) == GLFW_PRESS)
+    {
+        app->camera.position = vec3_sub(app->camera.position, vec3_scale(app->camera.right, camera_speed));
+    }
+}
+
+static inline Camera Camera_init(void)
+{
+    Camera camera =
+    {
+        .position = VEC3(0.0f, 0.0f, -20.0f),
+        .yaw = 0.0f,
+        .pitch = 0.0f,
+        .movement_speed = speed,
+        .mouse_sensitivity = sensitivity,
+        .zoom = zoom,
+    };
+    return camera;
+}
+
+GEN_BUFFER_STRUCT(VkCommandBuffer)
+GEN_BUFFER_FUNCTIONS(command_buffers, cbb, VkCommandBufferBuffer, VkCommandBuffer)
+
+// Command pools are externally synchronized, so every job thread records from a pool of its own
+typedef struct ThreadCommandPool
+{
+    VkCommandPool handle;
+    VkCommandBufferBuffer secondary_buffers;
+    u32 used_secondary_count;
+} ThreadCommandPool;
+
+static inline VkCommandBuffer ThreadCommandPool_next_secondary(ThreadCommandPool* pool, VkDevice device)
+{
+    if (pool->used_secondary_count == command_buffers_len(&pool->secondary_buffers))
+    {
+        VkCommandBufferAllocateInfo command_buffer_ai =
+        {
+            .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO,
+            .commandPool = pool->handle,
+            .commandBufferCount = 1,
+            .level = VK_COMMAND_BUFFER_LEVEL_SECONDARY,
+        };
+
+        VkCommandBuffer command_buffer;
+        VKCHECK(vkAllocateCommandBuffers(device, &command_buffer_ai, &command_buffer));
+        command_buffers_append(&pool->secondary_buffers, command_buffer);
+    }
+
+    return pool->secondary_buffers.ptr[pool->used_secondary_count++];
+}
+
+typedef struct Frame
+{
+    struct
+    {
+        VkSemaphore present_sem, render_sem;
+        VkFence render_fence;
+        VkCommandPool command_pool;
+        VkCommandBuffer command_buffer;
+    } sync;
+
+    AllocatedBuffer camera_buffer;
+    VkDescriptorSet global_descriptor;
+
+    VkQueryPool timestamp_query_pool;
+    bool timestamps_written;
+
+    // Transient data for this frame, reset once its fence says the GPU is done with it
+    Arena arena;
+
+    // Indexed by os_job_thread_index(). Reset together with the frame
+    ThreadCommandPool* thread_command_pools;
+    u32 thread_command_pool_count;
+
+    // One InstanceData per render object. Persistently mapped, unless the culling shader writes it
+    AllocatedBuffer instance_buffer;
+    InstanceData* instances;
+
+    // GPU-driven mode: an instanced draw per batch and LOD, and the visible instance counts behind them, written by the
+    // culling dispatches. Object slots pass each visible object's place among them from the first dispatch to the second
+    AllocatedBuffer draw_command_buffer;
+    AllocatedBuffer draw_count_buffer;
+    AllocatedBuffer object_slot_buffer;
+    VkDescriptorSet cull_descriptor_set;
+    // The objects and batches the culling dispatches read. Persistently mapped and per frame, so they are only rewritten
+    // once the frame's fence says the GPU is done with them: batches whose mesh became resident are marked dirty in every
+    // frame and written when that frame comes around
+    AllocatedBuffer gpu_object_buffer;
+    GpuObject* gpu_objects;
+    AllocatedBuffer gpu_batch_buffer;
+    GpuBatch* gpu_batches;
+    bool* gpu_batch_dirty;
+
+    // Meshlet culling: the triangles of the visible meshlets, compacted. The draw command buffer then also holds a draw per
+    // LOD 0 instance and per instance drawn whole. The count buffer adds the latter per batch and the compacted index count
+    AllocatedBuffer meshlet_index_buffer;
+} Frame;
+
+// Below this many draws per secondary command buffer, recording overhead outweighs the parallelism
+#define MIN_DRAWS_PER_SECONDARY_BUFFER (64)
+#define INSTANCES_PER_JOB (1024)
+
+typedef struct DrawRecordContext
+{
+    VkDevice device;
+    Frame* frame;
+    const VkCommandBufferInheritanceInfo* inheritance;
+    RenderObject* objects;
+    const u32* visible_objects; /* instance i draws object visible_objects[i] */
+    const TransformBatch* transforms;
+    TransformBatch* visible_transforms;
+    DrawBatch* batches;
+    mat4f proj_x_view;
+    f32 angle;
+    u32 batches_per_slice;
+    VkCommandBuffer* secondary_buffers;
+} DrawRecordContext;
+
+// Writes the instances [start, end) of the visible list into this frame's instance buffer
+static void write_instance_slice(void* data, u32 start, u32 end)
+{
+    DrawRecordContext* context = (DrawRecordContext*)data;
+    const TransformBatch* transforms = context->transforms;
+    TransformBatch* visible = context->visible_transforms;
+    // Objects have no rotation of their own; every one of them spins about Y by the same angle
+    f32 spin_y = sinf(0.5f * context->angle);
+    f32 spin_w = cosf(0.5f * context->angle);
+    for (u32 i = start; i < end; i++)
+    {
+        u32 object = context->visible_objects[i];
+        visible->position_x[i] = transforms->position_x[object];
+        visible->position_y[i] = transforms->position_y[object];
+        visible->position_z[i] = transforms->position_z[object];
+        visible->rotation_y[i] = spin_y;
+        visible->rotation_w[i] = spin_w;
+        visible->scale_x[i] = transforms->scale_x[object];
+        visible->scale_y[i] = transforms->scale_y[object];
+        visible->scale_z[i] = transforms->scale_z[object];
+        context->frame->instances[i].color = context->objects[object].color;
+    }
+
+    transforms_compose_batch(visible, start, end - start, &context->frame->instances[start].model, sizeof(InstanceData));
+}
+
+/*
+ * Turns the visible-index list into the batches to draw this frame. Batches cover consecutive objects and the list is
+ * ascending, so each batch keeps a contiguous run of instances; fully culled batches are dropped.
+ */
+static u32 compact_visible_batches(const DrawBatch* batches, u32 batch_count, const u32* visible_objects, const u8* visible_lods, u32 visible_count, DrawBatch* visible_batches)
+{
+    u32 visible_batch_count = 0;
+    u32 cursor = 0;
+    for (u32 i = 0; i < batch_count; i++)
+    {
+        u32 end = batches[i].first_instance + batches[i].instance_count;
+        // Runs of the batch's visible objects at the same LOD
+        while (cursor < visible_count && visible_objects[cursor] < end)
+        {
+            u32 first = cursor;
+            u8 lod = visible_lods[cursor];
+            while (cursor < visible_count && visible_objects[cursor] < end && visible_lods[cursor] == lod)
+            {
+                cursor++;
+            }
+
+            // Meshes still streaming in are skipped; their instances are written but never drawn
+            if (batches[i].mesh->resident)
+            {
+                visible_batches[visible_batch_count++] = (DrawBatch)
+                {
+                    .mesh = batches[i].mesh,
+                    .material = batches[i].material,
+                    .first_instance = first,
+                    .instance_count = cursor - first,
+                    .lod = lod,
+                };
+            }
+        }
+    }
+
+    return visible_batch_count;
+}
+
+// Multiplied by an object-space error, gives the distance from which that error projects to LOD_MAX_ERROR_PIXELS
+static inline f32 lod_error_scale(f32 fov_y, f32 viewport_height)
+{
+    return viewport_height / (2.0f * tanf(0.5f * fov_y) * LOD_MAX_ERROR_PIXELS);
+}
+
+// Picks the coarsest LOD of every visible object whose error projects to at most LOD_MAX_ERROR_PIXELS at the object's
+// distance from the camera. visible_lods is indexed like visible_objects
+static void select_lods(const RenderObject* objects, const BoundsBatch* bounds, const u32* visible_objects, u32 visible_count, vec3f camera_position, f32 error_scale, u8* visible_lods)
+{
+    for (u32 i = 0; i < visible_count; i++)
+    {
+        u32 object = visible_objects[i];
+        const Mesh* mesh = objects[object].mesh;
+        // The parse thread may still be writing the LODs of meshes that are not resident; those are not drawn anyway
+        if (!mesh->resident)
+        {
+            visible_lods[i] = 0;
+            continue;
+        }
+
+        f32 dx = bounds->center_x[object] - camera_position.x;
+        f32 dy = bounds->center_y[object] - camera_position.y;
+        f32 dz = bounds->center_z[object] - camera_position.z;
+        // Measured from the closest point of the bounds, so no part of the object is drawn coarser than allowed
+        f32 distance = MAX(sqrtf(dx * dx + dy * dy + dz * dz) - bounds->radius[object], 0.0f);
+        u32 lod = 0;
+        while (lod + 1 < mesh->lod_count && mesh->lods[lod + 1].error * error_scale <= distance)
+        {
+            lod++;
+        }
+        visible_lods[i] = (u8)lod;
+    }
+}
+
+// Records the batches [start, end) into a secondary command buffer. Runs on any job thread
+static void record_draw_slice(void* data, u32 start, u32 end)
+{
+    DrawRecordContext* context = (DrawRecordContext*)data;
+    u32 thread_index = os_job_thread_index();
+    redassert(thread_index < context->frame->thread_command_pool_count);
+    ThreadCommandPool* pool = &context->frame->thread_command_pools[thread_index];
+    VkCommandBuffer cmd = ThreadCommandPool_next_secondary(pool, context->device);
+
+    VkCommandBufferBeginInfo begin_info =
+    {
+        .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO,
+        .flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT | VK_COMMAND_BUFFER_USAGE_RENDER_PASS_CONTINUE_BIT,
+        .pInheritanceInfo = context->inheritance,
+    };
+
+    VKCHECK(vkBeginCommandBuffer(cmd, &begin_info));
+
+    // Batches index the instance buffer through firstInstance, so it is bound once per slice
+    const VkDeviceSize instance_offset = 0;
+    vkCmdBindVertexBuffers(cmd, INSTANCE_BINDING, 1, &context->frame->instance_buffer.handle, &instance_offset);
+
+    // Secondary buffers do not inherit bound state, so each slice binds what it needs once
+    Material* bound_material = null;
+    Mesh* bound_mesh = null;
+    for (u32 i = start; i < end; i++)
+    {
+        DrawBatch* batch = &context->batches[i];
+        if (batch->material != bound_material)
+        {
+            vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, batch->material->pipeline);
+            // Only the matrix: every material's layout has the same push constant range, so the mesh's part stays valid
+            vkCmdPushConstants(cmd, batch->material->layout, VK_SHADER_STAGE_VERTEX_BIT, offsetof(MeshPushConstants, render_matrix), sizeof(mat4f), &context->proj_x_view);
+            bound_material = batch->material;
+        }
+
+        if (batch->mesh != bound_mesh)
+        {
+            const VkDeviceSize offset = 0;
+            vkCmdBindVertexBuffers(cmd, 0, 1, &batch->mesh->buffer.handle, &offset);
+            vkCmdBindIndexBuffer(cmd, batch->mesh->index_buffer.handle, 0, batch->mesh->index_type);
+            Mesh_push_position_decode(batch->mesh, cmd, batch->material->layout);
+            bound_mesh = batch->mesh;
+        }
+
+        MeshLod* lod = &batch->mesh->lods[batch->lod];
+        vkCmdDrawIndexed(cmd, lod->index_count, batch->instance_count, lod->first_index, 0, batch->first_instance);
+    }
+
+    VKCHECK(vkEndCommandBuffer(cmd));
+    context->secondary_buffers[start / context->batches_per_slice] = cmd;
+}
+
+// Resets the draw counts and commands, then frustum-culls every object and counts the visible ones per batch and LOD.
+// A second dispatch compacts them into each batch's instance range and writes one instanced draw per batch and LOD
+static void record_gpu_culling(VkCommandBuffer cmd, Frame* frame, VkPipeline pipeline, VkPipelineLayout layout, CullPushConstants constants, u32 batch_count)
+{
+    vkCmdFillBuffer(cmd, frame->draw_count_buffer.handle, 0, VK_WHOLE_SIZE, 0);
+    // LODs no object picked keep a draw of zero instances
+    vkCmdFillBuffer(cmd, frame->draw_command_buffer.handle, 0, batch_count * MESH_MAX_LOD_COUNT * sizeof(VkDrawIndexedIndirectCommand), 0);
+
+    VkMemoryBarrier clear_barrier =
+    {
+        .sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER,
+        .srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT,
+        .dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT,
+    };
+    vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 1, &clear_barrier, 0, null, 0, null);
+
+    vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_COMPUTE, pipeline);
+    vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_COMPUTE, layout, 0, 1, &frame->cull_descriptor_set, 0, null);
+    const u32 group_count = (constants.object_count + CULL_WORKGROUP_SIZE - 1) / CULL_WORKGROUP_SIZE;
+    constants.pass = 0;
+    vkCmdPushConstants(cmd, layout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(CullPushConstants), &constants);
+    vkCmdDispatch(cmd, group_count, 1, 1);
+
+    // The second dispatch needs every count of the first
+    VkMemoryBarrier count_barrier =
+    {
+        .sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER,
+        .srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT,
+        .dstAccessMask = VK_ACCESS_SHADER_READ_BIT,
+    };
+    vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 1, &count_barrier, 0, null, 0, null);
+
+    constants.pass = 1;
+    vkCmdPushConstants(cmd, layout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(CullPushConstants), &constants);
+    vkCmdDispatch(cmd, group_count, 1, 1);
+
+    // Meshlet culling reads the counts and instances back and writes commands of its own
+    VkMemoryBarrier cull_barrier =
+    {
+        .sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER,
+        .srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT,
+        .dstAccessMask = VK_ACCESS_INDIRECT_COMMAND_READ_BIT | VK_ACCESS_VERTEX_ATTRIBUTE_READ_BIT | (frame->meshlet_index_buffer.handle ? VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT : 0),
+    };
+    VkPipelineStageFlags dst_stages = VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT | VK_PIPELINE_STAGE_VERTEX_INPUT_BIT | (frame->meshlet_index_buffer.handle ? VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT : 0);
+    vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, dst_stages, 0, 1, &cull_barrier, 0, null, 0, null);
+}
+
+// Culls the meshlets of every visible LOD 0 instance by frustum and normal cone. The surviving triangles are copied into
+// the frame's compacted index buffer and the instance gets a draw of its own pointing at them
+static void record_meshlet_culling(VkCommandBuffer cmd, Frame* frame, VkPipeline pipeline, VkPipelineLayout layout, MeshletCullPushConstants constants, const DrawBatch* batches)
+{
+    vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_COMPUTE, pipeline);
+    vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_COMPUTE, layout, 0, 1, &frame->cull_descriptor_set, 0, null);
+    for (u32 i = 0; i < constants.batch_count; i++)
+    {
+        const DrawBatch* batch = &batches[i];
+        if (!batch->mesh->resident || !batch->mesh->meshlet_count)
+        {
+            continue;
+        }
+
+        constants.batch_index = i;
+        constants.meshlet_count = batch->mesh->meshlet_count;
+        vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_COMPUTE, layout, 1, 1, &batch->mesh->meshlet_descriptor_set, 0, null);
+        vkCmdPushConstants(cmd, layout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(MeshletCullPushConstants), &constants);
+        // Workgroups past the batch's visible count return right away
+        u32 group_count_x = MIN(batch->instance_count, MAX_COMPUTE_WORKGROUP_COUNT);
+        vkCmdDispatch(cmd, group_count_x, (batch->instance_count + group_count_x - 1) / group_count_x, 1);
+    }
+
+    VkMemoryBarrier meshlet_barrier =
+    {
+        .sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER,
+        .srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT,
+        .dstAccessMask = VK_ACCESS_INDIRECT_COMMAND_READ_BIT | VK_ACCESS_INDEX_READ_BIT,
+    };
+    vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT | VK_PIPELINE_STAGE_VERTEX_INPUT_BIT, 0, 1, &meshlet_barrier, 0, null, 0, null);
+}
+
+// One multi-draw per batch, of an instanced draw per LOD. Batches culled by meshlet draw LOD 0 with two indirect count
+// calls instead: one draw per instance of its compacted triangles, then the instances drawn whole
+static void record_indirect_draws(VkCommandBuffer cmd, Frame* frame, DrawBatch* batches, u32 batch_count, u32 object_count, mat4f proj_x_view)
+{
+    const VkDeviceSize instance_offset = 0;
+    vkCmdBindVertexBuffers(cmd, INSTANCE_BINDING, 1, &frame->instance_buffer.handle, &instance_offset);
+
+    const u32 lod_command_count = batch_count * MESH_MAX_LOD_COUNT;
+    const VkDeviceSize command_size = sizeof(VkDrawIndexedIndirectCommand);
+    Material* bound_material = null;
+    Mesh* bound_mesh = null;
+    for (u32 i = 0; i < batch_count; i++)
+    {
+        DrawBatch* batch = &batches[i];
+        if (!batch->mesh->resident)
+        {
+            // The culling pass still wrote its commands, they are just never consumed
+            continue;
+        }
+
+        if (batch->material != bound_material)
+        {
+            vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, batch->material->pipeline);
+            // Only the matrix: every material's layout has the same push constant range, so the mesh's part stays valid
+            vkCmdPushConstants(cmd, batch->material->layout, VK_SHADER_STAGE_VERTEX_BIT, offsetof(MeshPushConstants, render_matrix), sizeof(mat4f), &proj_x_view);
+            bound_material = batch->material;
+        }
+
+        if (batch->mesh != bound_mesh)
+        {
+            const VkDeviceSize offset = 0;
+            vkCmdBindVertexBuffers(cmd, 0, 1, &batch->mesh->buffer.handle, &offset);
+            vkCmdBindIndexBuffer(cmd, batch->mesh->index_buffer.handle, 0, batch->mesh->index_type);
+            Mesh_push_position_decode(batch->mesh, cmd, batch->material->layout);
+            bound_mesh = batch->mesh;
+        }
+
+        const u32 first_lod_command = i * MESH_MAX_LOD_COUNT;
+        if (frame->meshlet_index_buffer.handle && batch->mesh->meshlet_count)
+        {
+            if (batch->mesh->lod_count > 1)
+            {
+                vkCmdDrawIndexedIndirect(cmd, frame->draw_command_buffer.handle, (first_lod_command + 1) * command_size, batch->mesh->lod_count - 1, command_size);
+            }
+            vkCmdBindIndexBuffer(cmd, frame->meshlet_index_buffer.handle, 0, VK_INDEX_TYPE_UINT32);
+            vkCmdDrawIndexedIndirectCount(cmd, frame->draw_command_buffer.handle, (lod_command_count + batch->first_instance) * command_size, frame->draw_count_buffer.handle, first_lod_command * sizeof(u32), batch->instance_count, command_size);
+            vkCmdBindIndexBuffer(cmd, batch->mesh->index_buffer.handle, 0, batch->mesh->index_type);
+            vkCmdDrawIndexedIndirectCount(cmd, frame->draw_command_buffer.handle, (lod_command_count + object_count + batch->first_instance) * command_size, frame->draw_count_buffer.handle, (lod_command_count + i) * sizeof(u32), batch->instance_count, command_size);
+            continue;
+        }
+
+        vkCmdDrawIndexedIndirect(cmd, frame->draw_command_buffer.handle, first_lod_command * command_size, batch->mesh->lod_count, command_size);
+    }
+}
+
+#define FRAME_ARENA_SIZE MEGABYTE(64)
+
+#define FRAME_OVERLAP (2)
+const u32 frame_overlap = FRAME_OVERLAP;
+
+static inline AllocatedBuffer create_buffer(VmaAllocator allocator, usize allocation_size, VkBufferUsageFlags usage, VmaMemoryUsage memory_usage)
+{
+    VkBufferCreateInfo ci = 
+    {
+        .sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO,
+        .size = allocation_size,
+        .usage = usage,
+    };
+
+    VmaAllocationCreateInfo ai =
+    {
+        .usage = memory_usage,
+    };
+
+    AllocatedBuffer buffer;
+
+    VKCHECK(vmaCreateBuffer(allocator, &ci, &ai, &buffer.handle, &buffer.allocation, null));
+
+    return buffer;
+}
+
+#define UPLOAD_RING_SIZE MEGABYTE(64)
+#define UPLOAD_SUBMISSION_COUNT (4)
+#define UPLOAD_ALIGNMENT (16)
+
+// A batch of copies recorded into one command buffer. The ring space it read from is reclaimed once its fence signals
+typedef struct UploadSubmission
+{
+    VkCommandBuffer command_buffer;
+    VkFence fence;
+    u64 ring_end; /* ring head when the batch was submitted */
+    bool pending;
+} UploadSubmission;
+
+// Persistently mapped staging ring feeding vkCmdCopyBuffer into device-local buffers.
+// head and tail only grow; the ring offset of a byte is its position modulo size
+typedef struct UploadRing
+{
+    VkDevice device;
+    VkQueue queue;
+    // Set when copies run on a dedicated transfer queue: every submission signals the next timeline value,
+    // which the graphics queue waits on before reading what was uploaded
+    VkSemaphore timeline;
+    u64 timeline_value;
+    u32 queue_family_indices[2]; /* transfer, graphics */
+    VmaAllocator allocator;
+    AllocatedBuffer staging;
+    u8* mapped;
+    u64 size;
+    u64 head; /* bytes handed out to uploads */
+    u64 tail; /* bytes the GPU is done copying from */
+    VkCommandPool command_pool;
+    UploadSubmission submissions[UPLOAD_SUBMISSION_COUNT];
+    u32 submission_index; /* the submission copies are being recorded into */
+    bool recording;
+
+    u64 staged_bytes;
+    u64 mapped_bytes;
+    u32 copy_count;
+    u32 submit_count;
+    u64 decoded_bytes;
+    f64 decode_ms;
+} UploadRing;
+
+// graphics_queue_family_index differs from queue_family_index when queue is a dedicated transfer queue
+static void UploadRing_init(UploadRing* ring, VkDevice device, VkQueue queue, u32 queue_family_index, u32 graphics_queue_family_index, VmaAllocator allocator, VkAllocationCallbacks* pAllocator, u64 size)
+{
+    *ring = (UploadRing)
+    {
+        .device = device,
+        .queue = queue,
+        .queue_family_indices = { queue_family_index, graphics_queue_family_index },
+        .allocator = allocator,
+        .size = size,
+    };
+
+    if (queue_family_index != graphics_queue_family_index)
+    {
+        VkSemaphoreTypeCreateInfo timeline_type_ci =
+        {
+            .sType = VK_STRUCTURE_TYPE_SEMAPHORE_TYPE_CREATE_INFO,
+            .semaphoreType = VK_SEMAPHORE_TYPE_TIMELINE,
+            .initialValue = 0,
+        };
+        VkSemaphoreCreateInfo timeline_ci =
+        {
+            .sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO,
+            .pNext = &timeline_type_ci,
+        };
+        VKCHECK(vkCreateSemaphore(device, &timeline_ci, pAllocator, &ring->timeline));
+    }
+
+    VkBufferCreateInfo staging_ci =
+    {
+        .sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO,
+        .size = size,
+        .usage = VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
+    };
+    VmaAllocationCreateInfo staging_ai =
+    {
+        .flags = VMA_ALLOCATION_CREATE_MAPPED_BIT,
+        .usage = VMA_MEMORY_USAGE_CPU_ONLY,
+    };
+    VmaAllocationInfo staging_info;
+    VKCHECK(vmaCreateBuffer(allocator, &staging_ci, &staging_ai, &ring->staging.handle, &ring->staging.allocation, &staging_info));
+    ring->mapped = staging_info.pMappedData;
+    redassert(ring->mapped);
+
+    VkCommandPoolCreateInfo command_pool_ci =
+    {
+        .sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO,
+        .queueFamilyIndex = queue_family_index,
+        .flags = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT | VK_COMMAND_POOL_CREATE_TRANSIENT_BIT,
+    };
+    VKCHECK(vkCreateCommandPool(device, &command_pool_ci, pAllocator, &ring->command_pool));
+
+    VkCommandBuffer command_buffers[UPLOAD_SUBMISSION_COUNT];
+    VkCommandBufferAllocateInfo command_buffer_ai =
+    {
+        .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO,
+        .commandPool = ring->command_pool,
+        .commandBufferCount = UPLOAD_SUBMISSION_COUNT,
+        .level = VK_COMMAND_BUFFER_LEVEL_PRIMARY,
+    };
+    VKCHECK(vkAllocateCommandBuffers(device, &command_buffer_ai, command_buffers));
+
+    VkFenceCreateInfo fence_ci =
+    {
+        .sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO,
+    };
+    for (u32 i = 0; i < UPLOAD_SUBMISSION_COUNT; i++)
+    {
+        ring->submissions[i].command_buffer = command_buffers[i];
+        VKCHECK(vkCreateFence(device, &fence_ci, pAllocator, &ring->submissions[i].fence));
+    }
+}
+
+static void UploadRing_retire(UploadRing* ring, UploadSubmission* submission)
+{
+    redassert(submission->pending);
+    // A fence only covers its own copies: retiring past an older pending submission would hand out bytes it still reads
+    for (u32 i = 0; i < UPLOAD_SUBMISSION_COUNT; i++)
+    {
+        redassert(!ring->submissions[i].pending || ring->submissions[i].ring_end >= submission->ring_end);
+    }
+    VKCHECK(vkWaitForFences(ring->device, 1, &submission->fence, true, UINT64_MAX));
+    VKCHECK(vkResetFences(ring->device, 1, &submission->fence));
+    ring->tail = MAX(ring->tail, submission->ring_end);
+    submission->pending = false;
+}
+
+// Submits the copies recorded so far. On a shared queue they are ordered before any later submission to it;
+// on a transfer queue the graphics queue has to wait for ring->timeline_value
+static void UploadRing_flush(UploadRing* ring)
+{
+    if (!ring->recording)
+    {
+        return;
+    }
+
+    UploadSubmission* submission = &ring->submissions[ring->submission_index];
+    if (!ring->timeline)
+    {
+        VkMemoryBarrier upload_barrier =
+        {
+            .sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER,
+            .srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT,
+            .dstAccessMask = VK_ACCESS_VERTEX_ATTRIBUTE_READ_BIT | VK_ACCESS_INDEX_READ_BIT | VK_ACCESS_SHADER_READ_BIT,
+        };
+        // The meshlet culling shader reads meshlets and indices as storage buffers
+        vkCmdPipelineBarrier(submission->command_buffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_VERTEX_INPUT_BIT | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 1, &upload_barrier, 0, null, 0, null);
+    }
+    VKCHECK(vkEndCommandBuffer(submission->command_buffer));
+
+    // The semaphore signal makes the copies available; the graphics queue's wait makes them visible to vertex input
+    u64 signal_value = ring->timeline_value + 1;
+    VkTimelineSemaphoreSubmitInfo timeline_submit_info =
+    {
+        .sType = VK_STRUCTURE_TYPE_TIMELINE_SEMAPHORE_SUBMIT_INFO,
+        .signalSemaphoreValueCount = 1,
+        .pSignalSemaphoreValues = &signal_value,
+    };
+    VkSubmitInfo submit_info =
+    {
+        .sType = VK_STRUCTURE_TYPE_SUBMIT_INFO,
+        .pNext = ring->timeline ? &timeline_submit_info : null,
+        .commandBufferCount = 1,
+        .pCommandBuffers = &submission->command_buffer,
+        .signalSemaphoreCount = ring->timeline ? 1 : 0,
+        .pSignalSemaphores = &ring->timeline,
+    };
+    VKCHECK(vkQueueSubmit(ring->queue, 1, &submit_info, submission->fence));
+    if (ring->timeline)
+    {
+        ring->timeline_value = signal_value;
+    }
+
+    submission->ring_end = ring->head;
+    submission->pending = true;
+    ring->recording = false;
+    ring->submission_index = (ring->submission_index + 1) % UPLOAD_SUBMISSION_COUNT;
+    ring->submit_count++;
+}
+
+// Reserves size contiguous bytes, waiting on the oldest submissions until the GPU has copied enough out of the ring
+static u64 UploadRing_allocate(UploadRing* ring, u64 size)
+{
+    redassert(size <= ring->size);
+    for (;;)
+    {
+        bool idle = !ring->recording;
+        for (u32 i = 0; i < UPLOAD_SUBMISSION_COUNT; i++)
+        {
+            idle = idle && !ring->submissions[i].pending;
+        }
+        if (idle)
+        {
+            ring->head = ring->tail = 0;
+        }
+
+        u64 offset = (ring->head + UPLOAD_ALIGNMENT - 1) & ~((u64)UPLOAD_ALIGNMENT - 1);
+        if (offset % ring->size + size > ring->size)
+        {
+            // Skip the end of the ring so the allocation does not wrap
+            offset = (offset / ring->size + 1) * ring->size;
+        }
+
+        if (offset + size - ring->tail <= ring->size)
+        {
+            ring->head = offset + size;
+            return offset % ring->size;
+        }
+
+        // Submissions were made in ring order, so the oldest pending one follows the one being recorded. With nothing
+        // being recorded, submission_index already points at the slot to reuse next, which is the oldest
+        UploadSubmission* oldest = null;
+        const u32 first = ring->recording ? 1 : 0;
+        for (u32 i = first; i < first + UPLOAD_SUBMISSION_COUNT && !oldest; i++)
+        {
+            UploadSubmission* submission = &ring->submissions[(ring->submission_index + i) % UPLOAD_SUBMISSION_COUNT];
+            oldest = submission->pending ? submission : null;
+        }
+
+        if (oldest)
+        {
+            UploadRing_retire(ring, oldest);
+        }
+        else
+        {
+            UploadRing_flush(ring);
+        }
+    }
+}
+
+static VkCommandBuffer UploadRing_command_buffer(UploadRing* ring)
+{
+    UploadSubmission* submission = &ring->submissions[ring->submission_index];
+    if (!ring->recording)
+    {
+        if (submission->pending)
+        {
+            UploadRing_retire(ring, submission);
+        }
+
+        VKCHECK(vkResetCommandBuffer(submission->command_buffer, 0));
+        VkCommandBufferBeginInfo begin_info =
+        {
+            .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO,
+            .flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT,
+        };
+        VKCHECK(vkBeginCommandBuffer(submission->command_buffer, &begin_info));
+        ring->recording = true;
+    }
+
+    return submission->command_buffer;
+}
+
+// Copies data into the ring and records its transfer into dst. Uploads larger than half the ring are split so they can overlap with the GPU copying the previous piece
+static void UploadRing_upload(UploadRing* ring, AllocatedBuffer dst, u64 dst_offset, const void* data, u64 size)
+{
+    const u64 max_chunk_size = ring->size / 2;
+    for (u64 uploaded = 0; uploaded < size;)
+    {
+        u64 chunk_size = MIN(size - uploaded, max_chunk_size);
+        u64 ring_offset = UploadRing_allocate(ring, chunk_size);
+        VkCommandBuffer cmd = UploadRing_command_buffer(ring);
+        memcpy(ring->mapped + ring_offset, (const u8*)data + uploaded, chunk_size);
+
+        VkBufferCopy region =
+        {
+            .srcOffset = ring_offset,
+            .dstOffset = dst_offset + uploaded,
+            .size = chunk_size,
+        };
+        vkCmdCopyBuffer(cmd, ring->staging.handle, dst.handle, 1, &region);
+
+        uploaded += chunk_size;
+        ring->staged_bytes += chunk_size;
+        ring->copy_count++;
+    }
+}
+
+// Creates a device-local buffer for uploads. mapped is set when its memory is also host-visible (integrated GPUs, lavapipe),
+// so it can be written in place rather than through the staging ring
+static AllocatedBuffer UploadRing_create_target(UploadRing* ring, usize size, VkBufferUsageFlags usage, void** mapped)
+{
+    // Shared between the transfer and graphics families, so no ownership transfer barriers are needed
+    VkBufferCreateInfo ci =
+    {
+        .sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO,
+        .size = size,
+        .usage = usage | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+        .sharingMode = ring->timeline ? VK_SHARING_MODE_CONCURRENT : VK_SHARING_MODE_EXCLUSIVE,
+        .queueFamilyIndexCount = ring->timeline ? array_length(ring->queue_family_indices) : 0,
+        .pQueueFamilyIndices = ring->queue_family_indices,
+    };
+    // MAPPED is ignored unless VMA ends up picking a host-visible memory type
+    VmaAllocationCreateInfo ai =
+    {
+        .flags = VMA_ALLOCATION_CREATE_MAPPED_BIT,
+        .usage = VMA_MEMORY_USAGE_GPU_ONLY,
+    };
+
+    AllocatedBuffer buffer;
+    VmaAllocationInfo info;
+    VKCHECK(vmaCreateBuffer(ring->allocator, &ci, &ai, &buffer.handle, &buffer.allocation, &info));
+
+    VkMemoryPropertyFlags memory_flags;
+    vmaGetMemoryTypeProperties(ring->allocator, info.memoryType, &memory_flags);
+    *mapped = (memory_flags & VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT) ? info.pMappedData : null;
+
+    return buffer;
+}
+
+// Writes data at dst_offset of a buffer from UploadRing_create_target, in place or through the staging ring
+static void UploadRing_write(UploadRing* ring, AllocatedBuffer buffer, void* mapped, u64 dst_offset, const void* data, u64 size)
+{
+    if (mapped)
+    {
+        memcpy((u8*)mapped + dst_offset, data, size);
+        VKCHECK(vmaFlushAllocation(ring->allocator, buffer.allocation, dst_offset, size));
+        ring->mapped_bytes += size;
+    }
+    else
+    {
+        UploadRing_upload(ring, buffer, dst_offset, data, size);
+    }
+}
+
+typedef struct DecodeContext
+{
+    const EncodedBuffer* buffer;
+    const u64* chunk_offsets;
+    u32 first_chunk;
+    u8* destination; /* where first_chunk decodes to; the chunks after it follow */
+} DecodeContext;
+
+// meshoptimizer's decoders pick their SSSE3/AVX-512 or NEON paths themselves
+static void decode_chunks(void* data, u32 start, u32 end)
+{
+    DecodeContext* context = (DecodeContext*)data;
+    const EncodedBuffer* buffer = context->buffer;
+    const u32* chunk_sizes = (const u32*)buffer->data;
+    for (u32 i = start; i < end; i++)
+    {
+        u32 chunk = context->first_chunk + i;
+        u32 first = chunk * buffer->chunk_element_count;
+        u32 count = MIN(buffer->chunk_element_count, buffer->element_count - first);
+        u8* destination = context->destination + (u64)i * buffer->chunk_element_count * buffer->element_size;
+        const u8* source = buffer->data + context->chunk_offsets[chunk];
+        s32 result = buffer->indices ?
+            meshopt_decodeIndexBuffer(destination, count, buffer->element_size, source, chunk_sizes[chunk]) :
+            meshopt_decodeVertexBuffer(destination, count, buffer->element_size, source, chunk_sizes[chunk]);
+        if (result != 0)
+        {
+            RED_PANIC("Could not decode chunk %u of a compressed mesh (error %d)", chunk, result);
+        }
+    }
+}
+
+/*
+ * Writes the decoded contents of encoded into a buffer from UploadRing_create_target, from dst_offset, a chunk boundary,
+ * on. Stops after at most max_size bytes but always writes a chunk, and returns the bytes written. The chunks are decoded
+ * on the job threads straight into host-visible device memory, or into the staging ring: there, groups of chunks up to
+ * half the ring each get one allocation, and the group's copy is only recorded once it is decoded, so a flush never
+ * submits bytes still being written.
+ */
+static u64 UploadRing_write_encoded(UploadRing* ring, AllocatedBuffer buffer, void* mapped, const EncodedBuffer* encoded, u64 dst_offset, u64 max_size)
+{
+    const u64 size = EncodedBuffer_decoded_size(encoded);
+    const u64 chunk_size = (u64)encoded->chunk_element_count * encoded->element_size;
+    redassert(dst_offset % chunk_size == 0 && dst_offset < size);
+    const u32 first_chunk = (u32)(dst_offset / chunk_size);
+    const u32 end_chunk = (u32)MIN(first_chunk + MAX(max_size / chunk_size, 1), EncodedBuffer_chunk_count(encoded));
+    const u64 written = MIN(end_chunk * chunk_size, size) - dst_offset;
+
+    ArenaTemp temp = arena_begin_temp(os_scratch_arena());
+    DecodeContext context =
+    {
+        .buffer = encoded,
+        .chunk_offsets = EncodedBuffer_chunk_offsets(encoded, temp.arena),
+    };
+
+    if (mapped)
+    {
+        context.first_chunk = first_chunk;
+        context.destination = (u8*)mapped + dst_offset;
+        u64 start_counter = os_performance_counter();
+        os_parallel_for(end_chunk - first_chunk, 1, decode_chunks, &context);
+        ring->decode_ms += os_compute_ms(start_counter, os_performance_counter());
+        VKCHECK(vmaFlushAllocation(ring->allocator, buffer.allocation, dst_offset, written));
+        ring->mapped_bytes += written;
+    }
+    else
+    {
+        const u32 chunks_per_group = (u32)MAX(ring->size / 2 / chunk_size, 1);
+        for (u32 group_first_chunk = first_chunk; group_first_chunk < end_chunk; group_first_chunk += chunks_per_group)
+        {
+            u32 group_chunk_count = MIN(chunks_per_group, end_chunk - group_first_chunk);
+            u64 group_offset = group_first_chunk * chunk_size;
+            u64 group_size = MIN(group_chunk_count * chunk_size, size - group_offset);
+            u64 ring_offset = UploadRing_allocate(ring, group_size);
+            VkCommandBuffer cmd = UploadRing_command_buffer(ring);
+
+            context.first_chunk = group_first_chunk;
+            context.destination = ring->mapped + ring_offset;
+            u64 start_counter = os_performance_counter();
+            os_parallel_for(group_chunk_count, 1, decode_chunks, &context);
+            ring->decode_ms += os_compute_ms(start_counter, os_performance_counter());
+
+            VkBufferCopy region =
+            {
+                .srcOffset = ring_offset,
+                .dstOffset = group_offset,
+                .size = group_size,
+            };
+            vkCmdCopyBuffer(cmd, ring->staging.handle, buffer.handle, 1, &region);
+
+            ring->staged_bytes += group_size;
+            ring->copy_count++;
+        }
+    }
+
+    arena_end_temp(temp);
+    ring->decoded_bytes += written;
+    return written;
+}
+
+// Waits for every submitted copy, leaving the whole ring free
+static void UploadRing_wait_idle(UploadRing* ring)
+{
+    UploadRing_flush(ring);
+    for (u32 i = 0; i < UPLOAD_SUBMISSION_COUNT; i++)
+    {
+        UploadSubmission* submission = &ring->submissions[(ring->submission_index + i) % UPLOAD_SUBMISSION_COUNT];
+        if (submission->pending)
+        {
+            UploadRing_retire(ring, submission);
+        }
+    }
+}
+
+static void UploadRing_print_stats(UploadRing* ring)
+{
+    print("Uploaded %.2f MB through the staging ring in %u copies and %u submissions on the %s queue, wrote %.2f MB directly into host-visible device memory\n", (f64)ring->staged_bytes / MEGABYTE(1), ring->copy_count, ring->submit_count, ring->timeline ? "transfer" : "graphics", (f64)ring->mapped_bytes / MEGABYTE(1));
+    if (ring->decoded_bytes)
+    {
+        print("Decoded %.2f MB of compressed mesh data on the job threads in %.3f ms (%.2f GB/s)\n", (f64)ring->decoded_bytes / MEGABYTE(1), ring->decode_ms, (f64)ring->decoded_bytes / GIGABYTE(1) / (ring->decode_ms / 1000.0));
+    }
+}
+
+static void UploadRing_deinit(UploadRing* ring, VkAllocationCallbacks* pAllocator)
+{
+    UploadRing_wait_idle(ring);
+    for (u32 i = 0; i < UPLOAD_SUBMISSION_COUNT; i++)
+    {
+        vkDestroyFence(ring->device, ring->submissions[i].fence, pAllocator);
+    }
+    if (ring->timeline)
+    {
+        vkDestroySemaphore(ring->device, ring->timeline, pAllocator);
+    }
+    vkDestroyCommandPool(ring->device, ring->command_pool, pAllocator);
+    vmaDestroyBuffer(ring->allocator, ring->staging.handle, ring->staging.allocation);
+}
+
+// Drops the CPU copy of the mesh: the cooked file it points into, or what the processing passes allocated
+static void Mesh_release_cpu_data(Mesh* mesh)
+{
+    if (mesh->mapping.ptr)
+    {
+        os_file_unmap(&mesh->mapping);
+    }
+    else
+    {
+        // vertex_data and index_data alias vertices and indices unless they were packed into copies of their own
+        if (mesh->vertex_data != mesh->vertices.ptr)
+        {
+            DELETE(mesh->vertex_data);
+        }
+        if (mesh->index_data != mesh->indices.ptr)
+        {
+            DELETE(mesh->index_data);
+        }
+        DELETE(mesh->meshlets);
+        vertices_deinit(&mesh->vertices);
+        indices_deinit(&mesh->indices);
+    }
+
+    mesh->vertex_data = null;
+    mesh->index_data = null;
+    mesh->meshlets = null;
+    mesh->encoded_vertices = (EncodedBuffer) ZERO_INIT;
+    mesh->encoded_indices = (EncodedBuffer) ZERO_INIT;
+}
+
+/*
+ * Uploads the next budget bytes of the mesh data through the ring, from where upload left off, so a large mesh is spread
+ * over several frames instead of making one wait on the ring. The first call creates the buffers; once the last byte is
+ * written the CPU copy is dropped. Compressed data goes in whole chunks, so it may exceed budget by one. Returns the bytes uploaded
+ */
+static u64 Mesh_upload(Mesh* mesh, UploadRing* ring, MeshUpload* upload, u64 budget)
+{
+    const u64 sizes[3] =
+    {
+        (u64)mesh->vertex_count * VertexFormat_stride(mesh->vertex_format),
+        (u64)mesh->index_count * Mesh_index_size(mesh),
+        (u64)mesh->meshlet_count * sizeof(Meshlet),
+    };
+    if (!mesh->buffer.handle)
+    {
+        // The meshlet culling shader copies the triangles of the visible meshlets out of the index buffer
+        VkBufferUsageFlags index_usage = VK_BUFFER_USAGE_INDEX_BUFFER_BIT | (mesh->meshlet_count ? VK_BUFFER_USAGE_STORAGE_BUFFER_BIT : 0);
+        mesh->buffer = UploadRing_create_target(ring, sizes[0], VK_BUFFER_USAGE_VERTEX_BUFFER_BIT, &upload->mapped[0]);
+        mesh->index_buffer = UploadRing_create_target(ring, sizes[1], index_usage, &upload->mapped[1]);
+        if (mesh->meshlet_count)
+        {
+            mesh->meshlet_buffer = UploadRing_create_target(ring, sizes[2], VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, &upload->mapped[2]);
+        }
+        upload->size = sizes[0] + sizes[1] + sizes[2];
+    }
+
+    const AllocatedBuffer buffers[3] = { mesh->buffer, mesh->index_buffer, mesh->meshlet_buffer };
+    const void* data[3] = { mesh->vertex_data, mesh->index_data, mesh->meshlets };
+    const EncodedBuffer* encoded[3] =
+    {
+        mesh->encoded_vertices.data ? &mesh->encoded_vertices : null,
+        mesh->encoded_indices.data ? &mesh->encoded_indices : null,
+        null,
+    };
+
+    u64 uploaded = 0;
+    u64 buffer_start = 0;
+    for (u32 i = 0; i < array_length(buffers) && uploaded < budget; buffer_start += sizes[i], i++)
+    {
+        if (upload->offset >= buffer_start + sizes[i])
+        {
+            continue;
+        }
+
+        u64 offset = upload->offset - buffer_start;
+        u64 size;
+        if (encoded[i])
+        {
+            size = UploadRing_write_encoded(ring, buffers[i], upload->mapped[i], encoded[i], offset, budget - uploaded);
+        }
+        else
+        {
+            size = MIN(sizes[i] - offset, budget - uploaded);
+            UploadRing_write(ring, buffers[i], upload->mapped[i], offset, (const u8*)data[i] + offset, size);
+        }
+        upload->offset += size;
+        uploaded += size;
+    }
+
+    if (upload->offset == upload->size)
+    {
+        // The staging ring holds its own copy of the data, so it can go before the GPU has copied it
+        Mesh_release_cpu_data(mesh);
+    }
+
+    return uploaded;
+}
+
+#define ASSET_QUEUE_CAPACITY (64)
+// Bytes the render thread uploads per frame. Larger meshes are uploaded over several frames
+#define STREAMING_UPLOAD_BUDGET MEGABYTE(32)
+
+typedef u32 MeshHandle;
+
+/*
+ * Asset pipeline: read -> parse -> upload. The read and parse stages run on their own threads, so a slow disk or a large
+ * OBJ never blocks a job thread; the upload stage runs on the render thread, which owns the upload ring. Meshes become
+ * resident some frames after they are requested and the renderer skips them until then.
+ */
+typedef struct AssetStreamer
+{
+    MeshStream* streams; /* fixed capacity, so handles and mesh pointers stay valid */
+    MeshStream* uploading; /* popped off the upload queue but not all uploaded yet */
+    u32 stream_count;
+    u32 stream_capacity;
+    u32 resident_count;
+    ThreadQueue* read_queue;
+    ThreadQueue* parse_queue;
+    ThreadQueue* upload_queue;
+    Thread* read_thread;
+    Thread* parse_thread;
+    // Newest upload timeline value a frame may read from. Already reached on the GPU, so waiting on it never stalls
+    u64 resident_upload_value;
+    u64 start_counter;
+} AssetStreamer;
+
+static void asset_read_thread(void* data)
+{
+    AssetStreamer* streamer = (AssetStreamer*)data;
+    for (MeshStream* stream; (stream = (MeshStream*)os_thread_queue_pop(streamer->read_queue));)
+    {
+        MeshStream_read(stream);
+        os_thread_queue_push(streamer->parse_queue, stream);
+    }
+    os_thread_queue_close(streamer->parse_queue);
+}
+
+static void asset_parse_thread(void* data)
+{
+    AssetStreamer* streamer = (AssetStreamer*)data;
+    // OBJ files are parsed in chunks on the job threads; without this they would all be parsed here, one after the other
+    os_job_register_thread();
+    for (MeshStream* stream; (stream = (MeshStream*)os_thread_queue_pop(streamer->parse_queue));)
+    {
+        MeshStream_parse(stream);
+        os_thread_queue_push(streamer->upload_queue, stream);
+    }
+    os_thread_queue_close(streamer->upload_queue);
+}
+
+static void AssetStreamer_init(AssetStreamer* streamer, u32 mesh_capacity)
+{
+    *streamer = (AssetStreamer)
+    {
+        .streams = NEW(MeshStream, mesh_capacity),
+        .stream_capacity = mesh_capacity,
+        .read_queue = os_thread_queue_create(ASSET_QUEUE_CAPACITY),
+        .parse_queue = os_thread_queue_create(ASSET_QUEUE_CAPACITY),
+        // Never fills up, so the parse thread can not block on a render thread that is waiting on it
+        .upload_queue = os_thread_queue_create(mesh_capacity),
+        .start_counter = os_performance_counter(),
+    };
+    streamer->read_thread = os_thread_create(asset_read_thread, streamer);
+    streamer->parse_thread = os_thread_create(asset_parse_thread, streamer);
+}
+
+// Queues the mesh for loading with the given MeshCacheFlags and returns right away. AssetStreamer_mesh gives its Mesh,
+// which is drawable once resident is set
+static MeshHandle AssetStreamer_load_mesh(AssetStreamer* streamer, const char* path, u32 flags)
+{
+    redassert(streamer->stream_count < streamer->stream_capacity);
+    MeshHandle handle = streamer->stream_count++;
+    MeshStream* stream = &streamer->streams[handle];
+    *stream = (MeshStream)
+    {
+        .path = path,
+        .flags = flags,
+        .state = MESH_STREAM_LOADING,
+    };
+    os_thread_queue_push(streamer->read_queue, stream);
+    return handle;
+}
+
+static inline Mesh* AssetStreamer_mesh(AssetStreamer* streamer, MeshHandle handle)
+{
+    redassert(handle < streamer->stream_count);
+    return &streamer->streams[handle].mesh;
+}
+
+static inline bool AssetStreamer_all_resident(AssetStreamer* streamer)
+{
+    return streamer->resident_count == streamer->stream_count;
+}
+
+/*
+ * Render thread side, once per frame: uploads what the parse stage finished within the byte budget and promotes the
+ * meshes whose copies the GPU completed. Writes the meshes that became resident to became_resident and returns their count.
+ */
+static u32 AssetStreamer_update(AssetStreamer* streamer, UploadRing* ring, Mesh** became_resident)
+{
+    u64 uploaded = 0;
+    MeshStream* stream;
+    while (uploaded < STREAMING_UPLOAD_BUDGET)
+    {
+        if (!streamer->uploading)
+        {
+            if (!(stream = (MeshStream*)os_thread_queue_try_pop(streamer->upload_queue)))
+            {
+                break;
+            }
+            // The streaming threads are done with it: publish the mesh they built where the renderer looks
+            stream->mesh = stream->loaded;
+            stream->loaded = (Mesh) ZERO_INIT;
+            streamer->uploading = stream;
+        }
+
+        stream = streamer->uploading;
+        uploaded += Mesh_upload(&stream->mesh, ring, &stream->upload, STREAMING_UPLOAD_BUDGET - uploaded);
+        if (stream->upload.offset == stream->upload.size)
+        {
+            stream->state = MESH_STREAM_UPLOADING;
+            stream->upload_value = UINT64_MAX;
+            streamer->uploading = null;
+        }
+    }
+
+    if (uploaded)
+    {
+        UploadRing_flush(ring);
+    }
+
+    // Without a transfer queue the copies precede every later frame on the same queue, so they count as done once submitted
+    u64 completed_value = UINT64_MAX;
+    if (ring->timeline)
+    {
+        VKCHECK(vkGetSemaphoreCounterValue(ring->device, ring->timeline, &completed_value));
+    }
+
+    u32 became_resident_count = 0;
+    for (u32 i = 0; i < streamer->stream_count; i++)
+    {
+        stream = &streamer->streams[i];
+        if (stream->state != MESH_STREAM_UPLOADING)
+        {
+            continue;
+        }
+
+        if (stream->upload_value == UINT64_MAX)
+        {
+            stream->upload_value = ring->timeline_value;
+        }
+
+        if (stream->upload_value <= completed_value)
+        {
+            stream->state = MESH_STREAM_RESIDENT;
+            stream->mesh.resident = true;
+            streamer->resident_upload_value = MAX(streamer->resident_upload_value, stream->upload_value);
+            streamer->resident_count++;
+            became_resident[became_resident_count++] = &stream->mesh;
+        }
+    }
+
+    if (became_resident_count && AssetStreamer_all_resident(streamer))
+    {
+        print("All %u meshes resident %.3f ms after they were requested\n", streamer->stream_count, os_compute_ms(streamer->start_counter, os_performance_counter()));
+    }
+
+    return became_resident_count;
+}
+
+static void AssetStreamer_deinit(AssetStreamer* streamer)
+{
+    // The stages drain what they were given, then close the queue after them
+    os_thread_queue_close(streamer->read_queue);
+    os_thread_join(streamer->read_thread);
+    os_thread_join(streamer->parse_thread);
+
+    for (u32 i = 0; i < streamer->stream_count; i++)
+    {
+        MeshStream* stream = &streamer->streams[i];
+        // Only meshes that never made it through the upload stage still hold a CPU copy
+        Mesh_release_cpu_data(&stream->loaded);
+        Mesh_release_cpu_data(&stream->mesh);
+        DELETE(stream->cache_path->ptr);
+        DELETE(stream->cache_path);
+    }
+
+    os_thread_queue_destroy(streamer->read_queue);
+    os_thread_queue_destroy(streamer->parse_queue);
+    os_thread_queue_destroy(streamer->upload_queue);
+    DELETE(streamer->streams);
+}
+
+// Lays the objects [first, first + count) out on the scene grid, spaced by their mesh's extents, and sets their culling bounds
+static void place_objects(RenderObject* objects, u32 first, u32 count, u32 grid_side, TransformBatch* transforms, BoundsBatch* bounds)
+{
+    f32 half_grid = 0.5f * (f32)(grid_side - 1);
+    for (u32 i = first; i < first + count; i++)
+    {
+        Mesh* mesh = objects[i].mesh;
+        f32 spacing = 1.5f * MAX(mesh->bounds_max[0] - mesh->bounds_min[0], mesh->bounds_max[2] - mesh->bounds_min[2]);
+        vec3f position = VEC3(((f32)(i % grid_side) - half_grid) * spacing, 0.0f, ((f32)(i / grid_side) - half_grid) * spacing);
+        objects[i].position = position;
+        transforms->position_x[i] = position.x;
+        transforms->position_y[i] = position.y;
+        transforms->position_z[i] = position.z;
+
+        vec4f sphere = Mesh_bounding_sphere(mesh);
+        f32 orbit = sqrtf(sphere.x * sphere.x + sphere.z * sphere.z);
+        f32 half_x = 0.5f * (mesh->bounds_max[0] - mesh->bounds_min[0]);
+        f32 half_z = 0.5f * (mesh->bounds_max[2] - mesh->bounds_min[2]);
+        bounds->center_x[i] = position.x;
+        bounds->center_y[i] = position.y + sphere.y;
+        bounds->center_z[i] = position.z;
+        bounds->radius[i] = orbit + sphere.w;
+        bounds->extent_x[i] = orbit + sqrtf(half_x * half_x + half_z * half_z);
+        bounds->extent_y[i] = 0.5f * (mesh->bounds_max[1] - mesh->bounds_min[1]);
+        bounds->extent_z[i] = bounds->extent_x[i];
+    }
+}
+
+// GPU-driven mode: mirrors the batch and its objects into a frame's persistently mapped buffers the culling shader reads
+static void write_gpu_batch(const DrawBatch* batch, u32 batch_index, u32 batch_count, const RenderObject* objects, u32 object_count, GpuBatch* gpu_batches, GpuObject* gpu_objects)
+{
+    // Until the mesh is resident the parse thread may still be writing its LODs and bounds, so the batch gets a single empty
+    // LOD and its objects a zero sphere. It is written again once the mesh is resident
+    const Mesh* mesh = batch->mesh;
+    const bool resident = mesh->resident;
+    const u32 lod_command_count = batch_count * MESH_MAX_LOD_COUNT;
+    gpu_batches[batch_index] = (GpuBatch)
+    {
+        .first_instance = batch->first_instance,
+        .meshlet_first_command = lod_command_count + batch->first_instance,
+        .overflow_first_command = lod_command_count + object_count + batch->first_instance,
+        .lod_count = resident ? mesh->lod_count : 1,
+    };
+    for (u32 i = 0; resident && i < mesh->lod_count; i++)
+    {
+        gpu_batches[batch_index].lods[i] = (GpuLod)
+        {
+            .first_index = mesh->lods[i].first_index,
+            .index_count = mesh->lods[i].index_count,
+            .error = mesh->lods[i].error,
+        };
+    }
+
+    vec4f bounding_sphere = resident ? Mesh_bounding_sphere(batch->mesh) : (vec4f) ZERO_INIT;
+    for (u32 i = batch->first_instance; i < batch->first_instance + batch->instance_count; i++)
+    {
+        gpu_objects[i] = (GpuObject)
+        {
+            .position = vec4f_cast(objects[i].position),
+            .color = objects[i].color,
+            .bounding_sphere = bounding_sphere,
+            .batch_index = batch_index,
+        };
+    }
+}
+
+typedef struct Options
+{
+    bool headless;
+    bool optimize_meshes;
+    VertexFormat vertex_format;
+    u32 frame_count;
+    u32 warmup_frame_count;
+    VkExtent2D extent;
+    HugePageMode huge_page_mode;
+    u32 thread_count; /* 0: one job thread per logical core */
+    u32 object_count;
+    bool instancing;
+    bool gpu_driven;
+    bool meshlets;
+    bool lods;
+    bool compress_meshes;
+    bool culling;
+    bool aabb_culling;
+    bool transfer_queue;
+    bool maths_benchmark;
+} Options;
+
+static inline u32 parse_u32_argument(s32 argc, char* argv[], s32* i)
+{
+    if (*i + 1 >= argc)
+    {
+        os_exit_with_message("Missing value for argument %s\n", argv[*i]);
+    }
+
+    *i = *i + 1;
+    char* end;
+    unsigned long value = strtoul(argv[*i], &end, 10);
+    if (*end != 0 || value > UINT32_MAX)
+    {
+        os_exit_with_message("Invalid value for argument %s: %s\n", argv[*i - 1], argv[*i]);
+    }
+
+    return (u32)value;
+}
+
+static inline Options Options_parse(s32 argc, char* argv[])
+{
+    Options options =
+    {
+        .headless = false,
+        .optimize_meshes = true,
+        .vertex_format = VERTEX_FORMAT_FLOAT,
+        .frame_count = 1000,
+        .warmup_frame_count = 16,
+        .extent = { .width = 1024, .height = 768 },
+        .huge_page_mode = HUGE_PAGE_MODE_OFF,
+        .thread_count = 0,
+        .object_count = 1,
+        .instancing = true,
+        .gpu_driven = false,
+        .meshlets = false,
+        .lods = false,
+        .culling = true,
+        .aabb_culling = false,
+        .transfer_queue = true,
+        .maths_benchmark = false,
+    };
+
+    for (s32 i = 1; i < argc; i++)
+    {
+        const char* arg = argv[i];
+        if (strequal(arg, "--headless"))
+        {
+            options.headless = true;
+        }
+        else if (strequal(arg, "--no-mesh-optimization"))
+        {
+            options.optimize_meshes = false;
+        }
+        else if (strequal(arg, "--packed-vertices"))
+        {
+            options.vertex_format = VERTEX_FORMAT_PACKED;
+        }
+        else if (strequal(arg, "--frames"))
+        {
+            options.frame_count = parse_u32_argument(argc, argv, &i);
+        }
+        else if (strequal(arg, "--warmup"))
+        {
+            options.warmup_frame_count = parse_u32_argument(argc, argv, &i);
+        }
+        else if (strequal(arg, "--width"))
+        {
+            options.extent.width = parse_u32_argument(argc, argv, &i);
+        }
+        else if (strequal(arg, "--height"))
+        {
+            options.extent.height = parse_u32_argument(argc, argv, &i);
+        }
+        else if (strequal(arg, "--maths-benchmark"))
+        {
+            options.maths_benchmark = true;
+        }
+        else if (strequal(arg, "--gpu-driven"))
+        {
+            options.gpu_driven = true;
+        }
+        else if (strequal(arg, "--meshlets"))
+        {
+            options.meshlets = true;
+        }
+        else if (strequal(arg, "--lods"))
+        {
+            options.lods = true;
+        }
+        else if (strequal(arg, "--compress-meshes"))
+        {
+            options.compress_meshes = true;
+        }
+        else if (strequal(arg, "--no-culling"))
+        {
+            options.culling = false;
+        }
+        else if (strequal(arg, "--aabb-culling"))
+        {
+            options.aabb_culling = true;
+        }
+        else if (strequal(arg, "--no-transfer-queue"))
+        {
+            options.transfer_queue = false;
+        }
+        else if (strequal(arg, "--no-instancing"))
+        {
+            options.instancing = false;
+        }
+        else if (strequal(arg, "--objects"))
+        {
+            options.object_count = parse_u32_argument(argc, argv, &i);
+        }
+        else if (strequal(arg, "--threads"))
+        {
+            options.thread_count = parse_u32_argument(argc, argv, &i);
+        }
+        else if (strequal(arg, "--huge-pages"))
+        {
+            if (i + 1 >= argc)
+            {
+                os_exit_with_message("Missing value for argument %s\n", arg);
+            }
+
+            const char* mode = argv[++i];
+            if (strequal(mode, "off"))
+            {
+                options.huge_page_mode = HUGE_PAGE_MODE_OFF;
+            }
+            else if (strequal(mode, "transparent"))
+            {
+                options.huge_page_mode = HUGE_PAGE_MODE_TRANSPARENT;
+            }
+            else if (strequal(mode, "explicit"))
+            {
+                options.huge_page_mode = HUGE_PAGE_MODE_EXPLICIT;
+            }
+            else
+            {
+                os_exit_with_message("Invalid value for argument %s: %s\n", arg, mode);
+            }
+        }
+        else
+        {
+            os_exit_with_message("Unknown argument: %s\nUsage: %s [--headless] [--no-mesh-optimization] [--packed-vertices] [--frames N] [--warmup N] [--width W] [--height H] [--huge-pages off|transparent|explicit] [--threads N] [--objects N] [--no-instancing] [--no-culling] [--aabb-culling] [--no-transfer-queue] [--gpu-driven] [--meshlets] [--lods] [--compress-meshes] [--maths-benchmark]\n", arg, argv[0]);
+        }
+    }
+
+    redassert(options.frame_count > 0);
+    redassert(options.object_count > 0);
+    redassert(options.extent.width > 0 && options.extent.height > 0);
+
+    return options;
+}
+
+#define MATHS_BENCHMARK_COUNT (4096)
+#define MATHS_BENCHMARK_ITERATIONS (256)
+
+// Times scalar_expression against simd_expression over every input and checks the results are bit-identical
+#define MATHS_BENCHMARK(name, T, scalar_expression, simd_expression)\
+    do\
+    {\
+        T* scalar_results = (T*)scalar_output;\
+        T* simd_results = (T*)simd_output;\
+        u64 scalar_start = os_performance_counter();\
+        for (u32 iteration = 0; iteration < MATHS_BENCHMARK_ITERATIONS; iteration++)\
+        {\
+            for (u32 i = 0; i < MATHS_BENCHMARK_COUNT; i++)\
+            {\
+                scalar_results[i] = scalar_expression;\
+            }\
+        }\
+        f64 scalar_ms = os_compute_ms(scalar_start, os_performance_counter());\
+        u64 simd_start = os_performance_counter();\
+        for (u32 iteration = 0; iteration < MATHS_BENCHMARK_ITERATIONS; iteration++)\
+        {\
+            for (u32 i = 0; i < MATHS_BENCHMARK_COUNT; i++)\
+            {\
+                simd_results[i] = simd_expression;\
+            }\
+        }\
+        f64 simd_ms = os_compute_ms(simd_start, os_performance_counter());\
+        bool match = memcmp(scalar_results, simd_results, MATHS_BENCHMARK_COUNT * sizeof(T)) == 0;\
+        all_match = all_match && match;\
+        f64 call_count = (f64)MATHS_BENCHMARK_COUNT * MATHS_BENCHMARK_ITERATIONS;\
+        print("%-16s scalar %7.2f ns  simd %7.2f ns  speedup %5.2fx  %s\n", name, scalar_ms * 1000000.0 / call_count,\
+              simd_ms * 1000000.0 / call_count, scalar_ms / simd_ms, match ? "bit-exact" : "MISMATCH");\
+    } while (false)
+
+#define MATHS_BATCH_BENCHMARK_COUNT (100000)
+#define MATHS_BATCH_BENCHMARK_ITERATIONS (16)
+
+static void print_batch_benchmark(const char* name, f64 reference_ms, f64 batch_ms, bool match)
+{
+    print("%-24s reference %6.3f ms  batch %6.3f ms  speedup %5.2fx  %s\n", name, reference_ms / MATHS_BATCH_BENCHMARK_ITERATIONS,
+          batch_ms / MATHS_BATCH_BENCHMARK_ITERATIONS, reference_ms / batch_ms, match ? "bit-exact" : "MISMATCH");
+}
+
+// Times the SoA batch kernels on MATHS_BATCH_BENCHMARK_COUNT objects against one by-value call per object
+static void maths_batch_benchmark(bool* all_match)
+{
+    const u32 count = MATHS_BATCH_BENCHMARK_COUNT;
+    TransformBatch transforms;
+    TransformBatch_init(&transforms, count);
+    for (u32 i = 0; i < count; i++)
+    {
+        transforms.position_x[i] = unitRand() * 200.0f - 100.0f;
+        transforms.position_y[i] = unitRand() * 200.0f - 100.0f;
+        transforms.position_z[i] = unitRand() * 200.0f - 100.0f;
+        vec3f axis = vec3_normalize(VEC3(unitRand() - 0.5f, unitRand() - 0.5f, unitRand() - 0.5f));
+        f32 half_angle = unitRand() * PI_F32;
+        transforms.rotation_x[i] = axis.x * sinf(half_angle);
+        transforms.rotation_y[i] = axis.y * sinf(half_angle);
+        transforms.rotation_z[i] = axis.z * sinf(half_angle);
+        transforms.rotation_w[i] = cosf(half_angle);
+        transforms.scale_x[i] = 0.5f + unitRand();
+        transforms.scale_y[i] = 0.5f + unitRand();
+        transforms.scale_z[i] = 0.5f + unitRand();
+    }
+
+    // Touch the outputs up front so neither side pays for the page faults
+    mat4f* reference = NEW(mat4f, count);
+    mat4f* batch = NEW(mat4f, count);
+    memset(reference, 0, count * sizeof(mat4f));
+    memset(batch, 0, count * sizeof(mat4f));
+
+    u64 start = os_performance_counter();
+    for (u32 iteration = 0; iteration < MATHS_BATCH_BENCHMARK_ITERATIONS; iteration++)
+    {
+        for (u32 i = 0; i < count; i++)
+        {
+            vec3f position = { transforms.position_x[i], transforms.position_y[i], transforms.position_z[i] };
+            vec4f rotation = { transforms.rotation_x[i], transforms.rotation_y[i], transforms.rotation_z[i], transforms.rotation_w[i] };
+            vec3f scale = { transforms.scale_x[i], transforms.scale_y[i], transforms.scale_z[i] };
+            reference[i] = transform_compose(position, rotation, scale);
+        }
+    }
+    f64 reference_ms = os_compute_ms(start, os_performance_counter());
+    start = os_performance_counter();
+    for (u32 iteration = 0; iteration < MATHS_BATCH_BENCHMARK_ITERATIONS; iteration++)
+    {
+        transforms_compose_batch(&transforms, 0, count, batch, sizeof(mat4f));
+    }
+    f64 batch_ms = os_compute_ms(start, os_performance_counter());
+    bool match = memcmp(reference, batch, count * sizeof(mat4f)) == 0;
+    *all_match = *all_match && match;
+    print("Batch kernels: %s backend, %u objects, time per batch\n", MATHS_BATCH_BACKEND_NAME, count);
+    print_batch_benchmark("transforms_compose_batch", reference_ms, batch_ms, match);
+
+    // The composed matrices become the models of a view-projection product
+    mat4f proj_x_view = mat4f_mul(perspective(rad(60.0f), 16.0f / 9.0f, 0.1f, 100.0f), lookat(VEC3(0, 10.0f, -20.0f), VEC3(0, 0, 0), VEC3(0, 1.0f, 0)));
+    mat4f* models = batch;
+    batch = NEW(mat4f, count);
+    memset(batch, 0, count * sizeof(mat4f));
+    start = os_performance_counter();
+    for (u32 iteration = 0; iteration < MATHS_BATCH_BENCHMARK_ITERATIONS; iteration++)
+    {
+        for (u32 i = 0; i < count; i++)
+        {
+            reference[i] = mat4f_mul_scalar(proj_x_view, models[i]);
+        }
+    }
+    reference_ms = os_compute_ms(start, os_performance_counter());
+    start = os_performance_counter();
+    for (u32 iteration = 0; iteration < MATHS_BATCH_BENCHMARK_ITERATIONS; iteration++)
+    {
+        mat4_mul_batch(proj_x_view, models, count, batch);
+    }
+    batch_ms = os_compute_ms(start, os_performance_counter());
+    match = memcmp(reference, batch, count * sizeof(mat4f)) == 0;
+    *all_match = *all_match && match;
+    print_batch_benchmark("mat4_mul_batch", reference_ms, batch_ms, match);
+
+    free_chunk(batch);
+    free_chunk(models);
+    free_chunk(reference);
+    TransformBatch_deinit(&transforms);
+}
+
+static void maths_benchmark(void)
+{
+    mat4f* a = NEW(mat4f, MATHS_BENCHMARK_COUNT);
+    mat4f* b = NEW(mat4f, MATHS_BENCHMARK_COUNT);
+    vec3f* u = NEW(vec3f, MATHS_BENCHMARK_COUNT);
+    vec3f* v = NEW(vec3f, MATHS_BENCHMARK_COUNT);
+    vec4f* w = NEW(vec4f, MATHS_BENCHMARK_COUNT);
+    f32* angles = NEW(f32, MATHS_BENCHMARK_COUNT);
+    mat4f* scalar_output = NEW(mat4f, MATHS_BENCHMARK_COUNT);
+    mat4f* simd_output = NEW(mat4f, MATHS_BENCHMARK_COUNT);
+
+    srand(1);
+    for (u32 i = 0; i < MATHS_BENCHMARK_COUNT; i++)
+    {
+        for (u32 column = 0; column < 4; column++)
+        {
+            for (u32 row = 0; row < 4; row++)
+            {
+                a[i].row[column].v[row] = unitRand() * 2.0f - 1.0f;
+                b[i].row[column].v[row] = unitRand() * 2.0f - 1.0f;
+            }
+        }
+        u[i] = VEC3(unitRand() * 20.0f - 10.0f, unitRand() * 20.0f - 10.0f, unitRand() * 20.0f - 10.0f);
+        v[i] = VEC3(unitRand() * 2.0f - 1.0f, unitRand() * 2.0f - 1.0f, unitRand() * 2.0f - 1.0f);
+        w[i] = (vec4f) { unitRand(), unitRand(), unitRand(), unitRand() };
+        angles[i] = unitRand() * 2.0f * PI_F32;
+    }
+
+    print("Maths benchmark: %s backend, %u inputs x %u iterations, time per call\n", MATHS_BACKEND_NAME, MATHS_BENCHMARK_COUNT, MATHS_BENCHMARK_ITERATIONS);
+    bool all_match = true;
+    MATHS_BENCHMARK("mat4f_mul", mat4f, mat4f_mul_scalar(a[i], b[i]), mat4f_mul(a[i], b[i]));
+    MATHS_BENCHMARK("mul_rot", mat4f, mul_rot_scalar(a[i], b[i]), mul_rot(a[i], b[i]));
+    MATHS_BENCHMARK("rotate", mat4f, rotate_scalar(a[i], angles[i], v[i]), rotate(a[i], angles[i], v[i]));
+    MATHS_BENCHMARK("translate", mat4f, translate_scalar(a[i], u[i]), translate(a[i], u[i]));
+    MATHS_BENCHMARK("lookat", mat4f, lookat_scalar(u[i], v[i], VEC3(0, 1.0f, 0)), lookat(u[i], v[i], VEC3(0, 1.0f, 0)));
+    MATHS_BENCHMARK("vec3_cross", vec3f, vec3_cross_scalar(u[i], v[i]), vec3_cross(u[i], v[i]));
+    MATHS_BENCHMARK("vec3_dot", f32, vec3_dot_scalar(u[i], v[i]), vec3_dot(u[i], v[i]));
+    MATHS_BENCHMARK("vec3_normalize", vec3f, vec3_normalize_scalar(u[i]), vec3_normalize(u[i]));
+    MATHS_BENCHMARK("vec3_muladds", vec3f, vec3_muladds_scalar(u[i], angles[i], v[i]), vec3_muladds(u[i], angles[i], v[i]));
+    MATHS_BENCHMARK("vec4_add", vec4f, vec4_add_scalar(w[i], a[i].r0), vec4_add(w[i], a[i].r0));
+    MATHS_BENCHMARK("vec4_scale", vec4f, vec4_scale_scalar(w[i], angles[i]), vec4_scale(w[i], angles[i]));
+
+    maths_batch_benchmark(&all_match);
+
+    free_chunk(simd_output);
+    free_chunk(scalar_output);
+    free_chunk(angles);
+    free_chunk(w);
+    free_chunk(v);
+    free_chunk(u);
+    free_chunk(b);
+    free_chunk(a);
+
+    if (!all_match)
+    {
+        os_exit_with_message("SIMD maths results differ from the scalar reference\n");
+    }
+}
+
+GEN_BUFFER_STRUCT(f64)
+GEN_BUFFER_FUNCTIONS(samples, sb, f64Buffer, f64)
+
+typedef struct FrameTimes
+{
+    f64Buffer frame;
+    f64Buffer cpu;
+    f64Buffer gpu;
+} FrameTimes;
+
+static s32 compare_f64(const void* a, const void* b)
+{
+    f64 left = *(const f64*)a;
+    f64 right = *(const f64*)b;
+    return (left > right) - (left < right);
+}
+
+static void print_frame_time_stats(const char* name, f64Buffer* samples)
+{
+    if (samples->len == 0)
+    {
+        print("[%s]\tno samples\n", name);
+        return;
+    }
+
+    qsort(samples->ptr, samples->len, sizeof(f64), compare_f64);
+
+    f64 total = 0;
+    for (u32 i = 0; i < samples->len; i++)
+    {
+        total += samples->ptr[i];
+    }
+
+    u32 last = samples->len - 1;
+    print("[%s]\tavg: %.04f ms.\tmin: %.04f ms.\tp50: %.04f ms.\tp95: %.04f ms.\tp99: %.04f ms.\tmax: %.04f ms.\n", name,
+            total / samples->len, samples->ptr[0], samples->ptr[last / 2], samples->ptr[last * 95 / 100], samples->ptr[last * 99 / 100], samples->ptr[last]);
+}
+
+// Orbit the origin at a fixed distance so every benchmark run sees the same sequence of views
+static inline void Camera_script_orbit(Camera* camera, u32 frame_number, u32 frame_count)
+{
+    f32 t = (f32)frame_number / (f32)frame_count;
+    camera->yaw = t * 360.0f;
+    camera->pitch = 20.0f * sinf(t * 2.0f * PI_F32);
+
+    vec3f front =
+    {
+        .x = -sinf(rad(camera->yaw)) * cosf(rad(camera->pitch)),
+        .y = sinf(rad(camera->pitch)),
+        .z = cosf(rad(camera->yaw)) * cosf(rad(camera->pitch)),
+    };
+    camera->position = vec3_scale(vec3_normalize(front), -20.0f);
+}
+
+#define TIMESTAMP_QUERY_COUNT (2)
+
+static inline void Frame_collect_gpu_time(VkDevice device, Frame* frame, f64 timestamp_period, u64 timestamp_mask, f64Buffer* samples)
+{
+    if (!frame->timestamps_written)
+    {
+        return;
+    }
+
+    u64 timestamps[TIMESTAMP_QUERY_COUNT];
+    VKCHECK(vkGetQueryPoolResults(device, frame->timestamp_query_pool, 0, TIMESTAMP_QUERY_COUNT, sizeof(timestamps), timestamps, sizeof(u64), VK_QUERY_RESULT_64_BIT | VK_QUERY_RESULT_WAIT_BIT));
+    u64 ticks = ((timestamps[1] & timestamp_mask) - (timestamps[0] & timestamp_mask)) & timestamp_mask;
+    samples_append(samples, (f64)ticks * timestamp_period / (1000.0 * 1000.0));
+    frame->timestamps_written = false;
+}
+
+s32 main(s32 argc, char* argv[])
+{
+    os_init();
+
+    Options options = Options_parse(argc, argv);
+    // Has to happen before the first allocation so the whole page allocator reserve is committed the same way
+    os_set_huge_page_mode(options.huge_page_mode);
+    os_job_system_init(options.thread_count);
+    if (options.maths_benchmark)
+    {
+        maths_benchmark();
+        os_job_system_shutdown();
+        return 0;
+    }
+
+    const bool headless = options.headless;
+
+    Application app =
+    {
+        .title = "Hello world",
+        .window.width = options.extent.width,
+        .window.height = options.extent.height,
+        .version = 1,
+        .delta_time = 0,
+        .camera = Camera_init(),
+        .first_mouse = true,
+    };
+
+    Frame frame[FRAME_OVERLAP] = ZERO_INIT;
+
+    VKCHECK(volkInitialize());
+
+    // In headless mode GLFW is never initialized, so we can run on machines without a display
+    if (!headless)
+    {
+        s32 result = glfwInit();
+        redassert(result == GLFW_TRUE);
+        glfwWindowHint(GLFW_CLIENT_API, GLFW_NO_API);
+        app.window.handle.glfw = glfwCreateWindow(app.window.width, app.window.height, app.title, NULL, NULL);
+        redassert(app.window.handle.glfw);
+        glfwSetWindowUserPointer(app.window.handle.glfw, &app);
+        glfwSetCursorPosCallback(app.window.handle.glfw, glfw_mouse_callback);
+        glfwSetScrollCallback(app.window.handle.glfw, glfw_scroll_callback);
+    }
+
+    VkAllocationCallbacks* pAllocator = NULL;
+
+    // Layers
     VkLayerProperties instance_layers[200];
     const char* used_instance_layers[200];
     u32 instance_layer_count;
@@ -777,20 +3508,34 @@ s32 main(s32 argc, char* argv[])
 
     VkExtensionProperties instance_extensions[200] = ZERO_INIT;
     const char* used_instance_extensions[200] = ZERO_INIT;
-    u32 instance_extension_count;
-    u32 used_instance_extension_count;
+    u32 instance_extension_count = array_length(instance_extensions);
+    u32 used_instance_extension_count = 0;
+    VKCHECK(vkEnumerateInstanceExtensionProperties(null, &instance_extension_count, instance_extensions));
 
-    u32 glfw_extension_count;
-    const char** extensions = glfwGetRequiredInstanceExtensions(&glfw_extension_count);
-    if (extensions)
+    if (!headless)
     {
-        for (u32 i = 0; i < glfw_extension_count; i++)
+        u32 glfw_extension_count;
+        const char** extensions = glfwGetRequiredInstanceExtensions(&glfw_extension_count);
+        if (extensions)
         {
-            used_instance_extensions[used_instance_extension_count++] = extensions[i];
+            for (u32 i = 0; i < glfw_extension_count; i++)
+            {
+                used_instance_extensions[used_instance_extension_count++] = extensions[i];
+            }
         }
     }
 
-    used_instance_extensions[used_instance_extension_count++] = VK_EXT_DEBUG_UTILS_EXTENSION_NAME;
+    // Software ICDs without the validation layers installed do not always expose debug utils
+    bool debug_utils_found = false;
+    for (u32 i = 0; i < instance_extension_count; i++)
+    {
+        if (strcmp(VK_EXT_DEBUG_UTILS_EXTENSION_NAME, instance_extensions[i].extensionName) == 0)
+        {
+            used_instance_extensions[used_instance_extension_count++] = VK_EXT_DEBUG_UTILS_EXTENSION_NAME;
+            debug_utils_found = true;
+            break;
+        }
+    }
 
     VkDebugUtilsMessengerCreateInfoEXT debug_ci =
     {
@@ -800,11 +3545,14 @@ s32 main(s32 argc, char* argv[])
         .messageType = VK_DEBUG_UTILS_MESSAGE_TYPE_GENERAL_BIT_EXT | VK_DEBUG_UTILS_MESSAGE_TYPE_PERFORMANCE_BIT_EXT | VK_DEBUG_UTILS_MESSAGE_TYPE_VALIDATION_BIT_EXT,
     };
 
-    VkInstance instance = create_instance(pAllocator, app.title, app.title, VK_API_VERSION_1_2, app.version, app.version, used_instance_extensions, used_instance_extension_count, used_instance_layers, used_instance_layer_count, &debug_ci);
+    VkInstance instance = create_instance(pAllocator, app.title, app.title, VK_API_VERSION_1_2, app.version, app.version, used_instance_extensions, used_instance_extension_count, used_instance_layers, used_instance_layer_count, debug_utils_found ? &debug_ci : null);
     volkLoadInstanceOnly(instance);
 
-    VkDebugUtilsMessengerEXT messenger;
-    VKCHECK(vkCreateDebugUtilsMessengerEXT(instance, &debug_ci, pAllocator, &messenger));
+    VkDebugUtilsMessengerEXT messenger = null;
+    if (debug_utils_found)
+    {
+        VKCHECK(vkCreateDebugUtilsMessengerEXT(instance, &debug_ci, pAllocator, &messenger));
+    }
 
     VkPhysicalDevice physical_devices[16] = ZERO_INIT;
     u32 physical_device_count = array_length(physical_devices);
@@ -819,24 +3567,34 @@ s32 main(s32 argc, char* argv[])
     VKCHECK(vkEnumerateDeviceExtensionProperties(pd, null, &device_extension_count, null));
     VKCHECK(vkEnumerateDeviceExtensionProperties(pd, null, &device_extension_count, device_extensions));
     bool swapchain_extension_found = false;
+    bool pipeline_creation_feedback = false;
     //print("Device extension count: %u\n", device_extension_count);
     for (u32 i = 0; i < device_extension_count; i++)
     {
         //print("%s\n", device_extensions[i].extensionName);
-        if (strcmp(VK_KHR_SWAPCHAIN_EXTENSION_NAME, device_extensions[i].extensionName) == 0)
+        if (!headless && strcmp(VK_KHR_SWAPCHAIN_EXTENSION_NAME, device_extensions[i].extensionName) == 0)
         {
             print("Found swapchain device extension\n");
             used_device_extensions[used_device_extension_count++] = device_extensions[i].extensionName;
             swapchain_extension_found = true;
             continue;
         }
+        // Only used to tell pipeline cache hits apart
+        if (strcmp(VK_EXT_PIPELINE_CREATION_FEEDBACK_EXTENSION_NAME, device_extensions[i].extensionName) == 0)
+        {
+            used_device_extensions[used_device_extension_count++] = device_extensions[i].extensionName;
+            pipeline_creation_feedback = true;
+            continue;
+        }
     }
 
-    redassert(swapchain_extension_found);
-
-    VkSurfaceKHR surface;
-    VKCHECK(glfwCreateWindowSurface(instance, app.window.handle.glfw, pAllocator, &surface));
-    redassert(surface);
+    VkSurfaceKHR surface = null;
+    if (!headless)
+    {
+        redassert(swapchain_extension_found);
+        VKCHECK(glfwCreateWindowSurface(instance, app.window.handle.glfw, pAllocator, &surface));
+        redassert(surface);
+    }
 
     VkPhysicalDeviceFeatures device_features;
     vkGetPhysicalDeviceFeatures(pd, &device_features);
@@ -852,8 +3610,11 @@ s32 main(s32 argc, char* argv[])
     {
         VkQueueFamilyProperties queue_family = device_queue_families[i];
 
-        VkBool32 present_support;
-        vkGetPhysicalDeviceSurfaceSupportKHR(pd, i, surface, &present_support);
+        VkBool32 present_support = VK_TRUE;
+        if (!headless)
+        {
+            vkGetPhysicalDeviceSurfaceSupportKHR(pd, i, surface, &present_support);
+        }
         if (queue_family.queueFlags & VK_QUEUE_GRAPHICS_BIT && present_support)
         {
             queue_family_index = i;
@@ -863,7 +3624,72 @@ s32 main(s32 argc, char* argv[])
 
     redassert(queue_family_index != UINT32_MAX);
 
-    VkDevice device = create_device(pAllocator, pd, used_device_extensions, used_device_extension_count, &queue_family_index, 1);
+    // Uploads go to a family that can transfer but not draw, preferring one without compute either: that is the one backed by the copy engines
+    u32 transfer_queue_family_index = UINT32_MAX;
+    for (u32 i = 0; i < device_queue_family_count; i++)
+    {
+        VkQueueFlags queue_flags = device_queue_families[i].queueFlags;
+        if ((queue_flags & VK_QUEUE_TRANSFER_BIT) && !(queue_flags & VK_QUEUE_GRAPHICS_BIT) &&
+            (transfer_queue_family_index == UINT32_MAX || !(queue_flags & VK_QUEUE_COMPUTE_BIT)))
+        {
+            transfer_queue_family_index = i;
+        }
+    }
+
+    // GPU-driven drawing compacts draws on the GPU and needs the count and first instance read from the indirect buffers
+    VkPhysicalDeviceVulkan12Features supported_features12 =
+    {
+        .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_2_FEATURES,
+    };
+    VkPhysicalDeviceFeatures2 supported_features =
+    {
+        .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2,
+        .pNext = &supported_features12,
+    };
+    vkGetPhysicalDeviceFeatures2(pd, &supported_features);
+
+    bool gpu_driven = options.gpu_driven;
+    if (gpu_driven && !(supported_features12.drawIndirectCount && device_features.multiDrawIndirect && device_features.drawIndirectFirstInstance && (the_queue_family.queueFlags & VK_QUEUE_COMPUTE_BIT)))
+    {
+        print("GPU-driven drawing needs drawIndirectCount, multiDrawIndirect and drawIndirectFirstInstance. Falling back to CPU-recorded draws\n");
+        gpu_driven = false;
+    }
+
+    const bool meshlet_culling = options.meshlets && gpu_driven;
+    if (options.meshlets && !gpu_driven)
+    {
+        print("Meshlet culling runs as part of GPU-driven drawing. Meshes are drawn whole\n");
+    }
+    if (options.aabb_culling && gpu_driven)
+    {
+        print("AABB culling only applies to CPU culling. The culling shader tests bounding spheres\n");
+    }
+
+    // The transfer queue is synchronized with the graphics one through timeline semaphore values
+    bool transfer_queue = options.transfer_queue && transfer_queue_family_index != UINT32_MAX;
+    if (transfer_queue && !supported_features12.timelineSemaphore)
+    {
+        print("Timeline semaphores are not supported. Uploading on the graphics queue\n");
+        transfer_queue = false;
+    }
+    u32 upload_queue_family_index = transfer_queue ? transfer_queue_family_index : queue_family_index;
+
+    VkPhysicalDeviceVulkan12Features enabled_features12 =
+    {
+        .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_2_FEATURES,
+        .drawIndirectCount = gpu_driven,
+        .timelineSemaphore = transfer_queue,
+    };
+    VkPhysicalDeviceFeatures2 enabled_features =
+    {
+        .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2,
+        .pNext = &enabled_features12,
+        .features.multiDrawIndirect = gpu_driven,
+        .features.drawIndirectFirstInstance = gpu_driven,
+    };
+
+    u32 device_queue_family_indices[] = { queue_family_index, upload_queue_family_index };
+    VkDevice device = create_device(pAllocator, pd, used_device_extensions, used_device_extension_count, device_queue_family_indices, transfer_queue ? 2 : 1, &enabled_features);
     volkLoadDevice(device);
     VmaVulkanFunctions vma_f =
     {
@@ -902,28 +3728,40 @@ s32 main(s32 argc, char* argv[])
     VmaAllocator allocator;
     VKCHECK(vmaCreateAllocator(&allocator_ci, &allocator));
 
-    VkSurfaceFormatKHR surface_formats[100];
-    u32 surface_format_count;
-    VKCHECK(vkGetPhysicalDeviceSurfaceFormatsKHR(pd, surface, &surface_format_count, null));
-    VKCHECK(vkGetPhysicalDeviceSurfaceFormatsKHR(pd, surface, &surface_format_count, surface_formats));
-    VkSurfaceFormatKHR surface_format = get_swapchain_format(surface_formats, surface_format_count);
-
-    VkSurfaceCapabilitiesKHR surface_capabilities;
-    VKCHECK(vkGetPhysicalDeviceSurfaceCapabilitiesKHR(pd, surface, &surface_capabilities));
-    VkExtent2D extent = surface_capabilities.currentExtent;
+    VkSurfaceFormatKHR surface_format =
+    {
+        .format = VK_FORMAT_R8G8B8A8_UNORM,
+        .colorSpace = VK_COLOR_SPACE_SRGB_NONLINEAR_KHR,
+    };
+    VkExtent2D extent = options.extent;
+    VkSwapchainKHR swapchain = null;
 
-    VkPresentModeKHR present_modes[64];
-    u32 present_mode_count;
-    VKCHECK(vkGetPhysicalDeviceSurfacePresentModesKHR(pd, surface, &present_mode_count, null));
-    VKCHECK(vkGetPhysicalDeviceSurfacePresentModesKHR(pd, surface, &present_mode_count, present_modes));
-    for (u32 i = 0; i < present_mode_count; i++)
+    if (!headless)
     {
-        VkPresentModeKHR present_mode = present_modes[i];
-        print("Present mode: %s\n", present_mode_string(present_mode));
+        VkSurfaceFormatKHR surface_formats[100];
+        u32 surface_format_count;
+        VKCHECK(vkGetPhysicalDeviceSurfaceFormatsKHR(pd, surface, &surface_format_count, null));
+        VKCHECK(vkGetPhysicalDeviceSurfaceFormatsKHR(pd, surface, &surface_format_count, surface_formats));
+        surface_format = get_swapchain_format(surface_formats, surface_format_count);
+
+        VkSurfaceCapabilitiesKHR surface_capabilities;
+        VKCHECK(vkGetPhysicalDeviceSurfaceCapabilitiesKHR(pd, surface, &surface_capabilities));
+        extent = surface_capabilities.currentExtent;
+
+        VkPresentModeKHR present_modes[64];
+        u32 present_mode_count;
+        VKCHECK(vkGetPhysicalDeviceSurfacePresentModesKHR(pd, surface, &present_mode_count, null));
+        VKCHECK(vkGetPhysicalDeviceSurfacePresentModesKHR(pd, surface, &present_mode_count, present_modes));
+        for (u32 i = 0; i < present_mode_count; i++)
+        {
+            VkPresentModeKHR present_mode = present_modes[i];
+            print("Present mode: %s\n", present_mode_string(present_mode));
+        }
+
+        swapchain = create_swapchain(pAllocator, device, surface, surface_capabilities, surface_format, extent, queue_family_index);
+        redassert(swapchain);
     }
 
-    VkSwapchainKHR swapchain = create_swapchain(pAllocator, device, surface, surface_capabilities, surface_format, extent, queue_family_index);
-    redassert(swapchain);
     VkFormat depth_format = VK_FORMAT_D32_SFLOAT;
 
     VkAttachmentDescription color_attachment =
@@ -935,7 +3773,7 @@ s32 main(s32 argc, char* argv[])
         .stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE,
         .stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE,
         .initialLayout = VK_IMAGE_LAYOUT_UNDEFINED,
-        .finalLayout = VK_IMAGE_LAYOUT_PRESENT_SRC_KHR,
+        .finalLayout = headless ? VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL : VK_IMAGE_LAYOUT_PRESENT_SRC_KHR,
     };
 
     VkAttachmentReference color_attachment_ref =
@@ -1007,16 +3845,37 @@ s32 main(s32 argc, char* argv[])
     VkImageView depth_image_view;
     VKCHECK(vkCreateImageView(device, &depth_image_view_ci, pAllocator, &depth_image_view));
 
-    VkImage swapchain_images[4];
-    u32 swapchain_image_count;
-    VKCHECK(vkGetSwapchainImagesKHR(device, swapchain, &swapchain_image_count, null));
-    redassert(swapchain_image_count <= array_length(swapchain_images));
-    VKCHECK(vkGetSwapchainImagesKHR(device, swapchain, &swapchain_image_count, swapchain_images));
+    VkImage color_images[4];
+    u32 color_image_count;
+    AllocatedImage offscreen_images[FRAME_OVERLAP] = ZERO_INIT;
+
+    if (headless)
+    {
+        // One offscreen color target per frame in flight, standing in for the swapchain images
+        VkImageCreateInfo color_image_ci = image_create_info(surface_format.format, VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT, depth_extent);
+        VmaAllocationCreateInfo color_image_ai =
+        {
+            .usage = VMA_MEMORY_USAGE_GPU_ONLY,
+        };
+
+        color_image_count = frame_overlap;
+        for (u32 i = 0; i < color_image_count; i++)
+        {
+            VKCHECK(vmaCreateImage(allocator, &color_image_ci, &color_image_ai, &offscreen_images[i].handle, &offscreen_images[i].allocation, null));
+            color_images[i] = offscreen_images[i].handle;
+        }
+    }
+    else
+    {
+        VKCHECK(vkGetSwapchainImagesKHR(device, swapchain, &color_image_count, null));
+        redassert(color_image_count <= array_length(color_images));
+        VKCHECK(vkGetSwapchainImagesKHR(device, swapchain, &color_image_count, color_images));
+    }
 
-    VkImageView swapchain_image_views[array_length(swapchain_images)];
-    VkFramebuffer framebuffers[array_length(swapchain_images)];
+    VkImageView color_image_views[array_length(color_images)];
+    VkFramebuffer framebuffers[array_length(color_images)];
 
-    VkImageViewCreateInfo swapchain_image_view_ci =
+    VkImageViewCreateInfo color_image_view_ci =
     {
         .sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO,
         .viewType = VK_IMAGE_VIEW_TYPE_2D,
@@ -1042,19 +3901,21 @@ s32 main(s32 argc, char* argv[])
         .layers = 1,
     };
 
-    for (u32 i = 0; i < swapchain_image_count; i++)
+    for (u32 i = 0; i < color_image_count; i++)
     {
-        swapchain_image_view_ci.image = swapchain_images[i];
-        VKCHECK(vkCreateImageView(device, &swapchain_image_view_ci, pAllocator, &swapchain_image_views[i]));
-        redassert(swapchain_image_views[i]);
-        VkImageView attachments[] = { swapchain_image_views[i], depth_image_view };
+        color_image_view_ci.image = color_images[i];
+        VKCHECK(vkCreateImageView(device, &color_image_view_ci, pAllocator, &color_image_views[i]));
+        redassert(color_image_views[i]);
+        VkImageView attachments[] = { color_image_views[i], depth_image_view };
         fb_create_info.pAttachments = attachments;
         fb_create_info.attachmentCount = array_length(attachments);
         VKCHECK(vkCreateFramebuffer(device, &fb_create_info, pAllocator, &framebuffers[i]));
     }
 
 #define MESH_PIPELINE_INDEX 0
-    const u32 mesh_pipeline_index = MESH_PIPELINE_INDEX;
+#define MESH_PACKED_PIPELINE_INDEX 1
+    // Indexed by the VertexFormat of the mesh drawn
+    const u32 mesh_pipeline_indices[] = { [VERTEX_FORMAT_FLOAT] = MESH_PIPELINE_INDEX, [VERTEX_FORMAT_PACKED] = MESH_PACKED_PIPELINE_INDEX };
     ShaderProgram shader_programs[] =
     {
         [MESH_PIPELINE_INDEX] =
@@ -1062,6 +3923,16 @@ s32 main(s32 argc, char* argv[])
             .shaders[0] = "triangle_meshv.spv",
             .shaders[1] = "triangle_meshf.spv",
             .vertex_buffer = true,
+            .vertex_format = VERTEX_FORMAT_FLOAT,
+            .instanced = true,
+        },
+        [MESH_PACKED_PIPELINE_INDEX] =
+        {
+            .shaders[0] = "triangle_mesh_packedv.spv",
+            .shaders[1] = "triangle_meshf.spv",
+            .vertex_buffer = true,
+            .vertex_format = VERTEX_FORMAT_PACKED,
+            .instanced = true,
         },
     };
 
@@ -1077,19 +3948,23 @@ s32 main(s32 argc, char* argv[])
     ShaderProgramVK pipeline_shaders_create_info[array_length(shader_programs)];
     VkGraphicsPipelineCreateInfo graphics_pipelines_create_info[array_length(shader_programs)] = ZERO_INIT;
 
+    // Pipeline create infos point at vertex input descriptions which must outlive the loop below
+    ArenaTemp pipeline_temp = arena_begin_temp(os_scratch_arena());
+
     for (u32 i = 0; i < pipeline_count; i++)
     {
         ShaderProgram* shader_program = &shader_programs[i];
 
         for (u32 shader_stage_index = 0; shader_stage_index < shader_program_stage_count; shader_stage_index++)
         {
-            SB* file = os_file_load(shader_program->shaders[shader_stage_index]);
-            redassert(file);
-            u32 spirv_byte_count = file->len - 1;
+            FileMapping file;
+            bool mapped = os_file_map(shader_program->shaders[shader_stage_index], FILE_ACCESS_HINT_SEQUENTIAL, &file);
+            redassert(mapped);
+            usize spirv_byte_count = file.size;
             redassert(spirv_byte_count % sizeof(u32) == 0);
 
-            const u32* spirv_code_ptr = (const u32*)file->ptr;
-            u32 spirv_code_size = spirv_byte_count;
+            const u32* spirv_code_ptr = (const u32*)file.ptr;
+            usize spirv_code_size = spirv_byte_count;
 
             VkShaderStageFlagBits shader_stage = hardcoded_shader_stages[shader_stage_index];
             redassert(shader_stage);
@@ -1103,6 +3978,8 @@ s32 main(s32 argc, char* argv[])
 
             VkShaderModule shader_module;
             VKCHECK(vkCreateShaderModule(device, &ci, pAllocator, &shader_module));
+            // The driver keeps its own copy of the code
+            os_file_unmap(&file);
 
             pipeline_shaders_create_info[i].shader_stages[shader_stage_index] = pipeline_shader_stage_create_info(shader_stage, shader_module);
         }
@@ -1114,7 +3991,11 @@ s32 main(s32 argc, char* argv[])
 
         if (shader_program->vertex_buffer)
         {
-            VertexInputDescription desc = Vertex_get_description();
+            VertexInputDescription desc = Vertex_get_description(pipeline_temp.arena, shader_program->vertex_format);
+            if (shader_program->instanced)
+            {
+                InstanceData_add_description(&desc, pipeline_temp.arena);
+            }
             vertex_input_state_ci.pVertexAttributeDescriptions = desc.attributes.ptr;
             vertex_input_state_ci.vertexAttributeDescriptionCount = desc.attributes.len;
             vertex_input_state_ci.pVertexBindingDescriptions = desc.bindings.ptr;
@@ -1206,8 +4087,33 @@ s32 main(s32 argc, char* argv[])
         };
     }
 
+    // Creation feedback reports which pipelines the driver found in the cache
+    VkPipelineCreationFeedbackEXT pipeline_feedbacks[array_length(shader_programs)] = ZERO_INIT;
+    VkPipelineCreationFeedbackEXT stage_feedbacks[array_length(shader_programs)][array_length(hardcoded_shader_stages)];
+    VkPipelineCreationFeedbackCreateInfoEXT pipeline_feedback_cis[array_length(shader_programs)];
+    for (u32 i = 0; pipeline_creation_feedback && i < pipeline_count; i++)
+    {
+        pipeline_feedback_cis[i] = (VkPipelineCreationFeedbackCreateInfoEXT)
+        {
+            .sType = VK_STRUCTURE_TYPE_PIPELINE_CREATION_FEEDBACK_CREATE_INFO_EXT,
+            .pPipelineCreationFeedback = &pipeline_feedbacks[i],
+            .pipelineStageCreationFeedbackCount = shader_program_stage_count,
+            .pPipelineStageCreationFeedbacks = stage_feedbacks[i],
+        };
+        graphics_pipelines_create_info[i].pNext = &pipeline_feedback_cis[i];
+    }
+
+    VkPipelineCache pipeline_cache = pipeline_cache_load(device, pAllocator, &device_properties, PIPELINE_CACHE_PATH);
+    PipelineCacheStats pipeline_cache_stats = ZERO_INIT;
+    u64 pipeline_counter = os_performance_counter();
     VkPipeline graphics_pipelines[array_length(shader_programs)];
-    VKCHECK(vkCreateGraphicsPipelines(device, null, pipeline_count, graphics_pipelines_create_info, pAllocator, graphics_pipelines));
+    VKCHECK(vkCreateGraphicsPipelines(device, pipeline_cache, pipeline_count, graphics_pipelines_create_info, pAllocator, graphics_pipelines));
+    pipeline_cache_stats.creation_ms += os_compute_ms(pipeline_counter, os_performance_counter());
+    for (u32 i = 0; i < pipeline_count; i++)
+    {
+        PipelineCacheStats_add(&pipeline_cache_stats, &pipeline_feedbacks[i]);
+    }
+    arena_end_temp(pipeline_temp);
 
     Material materials[array_length(graphics_pipelines)];
     u32 material_count = array_length(materials);
@@ -1222,6 +4128,21 @@ s32 main(s32 argc, char* argv[])
     u32 queue_index = 0;
     vkGetDeviceQueue(device, queue_family_index, queue_index, &queue);
     redassert(queue);
+    VkQueue upload_queue = queue;
+    if (transfer_queue)
+    {
+        vkGetDeviceQueue(device, upload_queue_family_index, queue_index, &upload_queue);
+        redassert(upload_queue);
+    }
+
+    // GPU frame times come from timestamp queries, which only exist when the queue family reports valid bits
+    const bool gpu_timing = headless && the_queue_family.timestampValidBits > 0 && device_properties.limits.timestampPeriod > 0;
+    const f64 timestamp_period = device_properties.limits.timestampPeriod;
+    const u64 timestamp_mask = the_queue_family.timestampValidBits >= 64 ? UINT64_MAX : ((1ULL << the_queue_family.timestampValidBits) - 1);
+    if (headless && !gpu_timing)
+    {
+        print("Timestamp queries are not supported by the selected queue family. GPU frame times will not be reported\n");
+    }
 
     VkCommandPoolCreateInfo command_pool_ci =
     {
@@ -1258,54 +4179,409 @@ s32 main(s32 argc, char* argv[])
 
         VKCHECK(vkCreateSemaphore(device, &sem_create_info, pAllocator, &frame[i].sync.render_sem));
         VKCHECK(vkCreateSemaphore(device, &sem_create_info, pAllocator, &frame[i].sync.present_sem));
+
+        arena_init(&frame[i].arena, FRAME_ARENA_SIZE);
+
+        VkCommandPoolCreateInfo thread_command_pool_ci =
+        {
+            .sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO,
+            .queueFamilyIndex = queue_family_index,
+            .flags = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT,
+        };
+
+        frame[i].thread_command_pool_count = os_job_thread_count();
+        frame[i].thread_command_pools = NEW(ThreadCommandPool, frame[i].thread_command_pool_count);
+        for (u32 thread_index = 0; thread_index < frame[i].thread_command_pool_count; thread_index++)
+        {
+            VKCHECK(vkCreateCommandPool(device, &thread_command_pool_ci, pAllocator, &frame[i].thread_command_pools[thread_index].handle));
+        }
+
+        if (gpu_timing)
+        {
+            VkQueryPoolCreateInfo query_pool_ci =
+            {
+                .sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO,
+                .queryType = VK_QUERY_TYPE_TIMESTAMP,
+                .queryCount = TIMESTAMP_QUERY_COUNT,
+            };
+
+            VKCHECK(vkCreateQueryPool(device, &query_pool_ci, pAllocator, &frame[i].timestamp_query_pool));
+        }
     }
 
     for (u32 i = 0; i < frame_overlap; i++)
     {
     }
 
-    Mesh monkey_mesh = mesh_load("../assets/monkey_flat.obj");
-    Mesh mario_mesh = mesh_load("../assets/mario.obj");
-    Mesh meshes[] = { mario_mesh };
-    u32 mesh_count = array_length(meshes);
+    // Mesh data lives in device-local memory, filled through a persistently mapped staging ring
+    UploadRing upload_ring;
+    UploadRing_init(&upload_ring, device, upload_queue, upload_queue_family_index, queue_family_index, allocator, pAllocator, UPLOAD_RING_SIZE);
 
+    // Meshes stream in on the asset threads while the first frames render; objects are drawn once their mesh is resident
+    const char* mesh_paths[] = { "../assets/mario.obj" };
+    Mesh* meshes[array_length(mesh_paths)];
+    u32 mesh_count = array_length(meshes);
+    AssetStreamer streamer;
+    AssetStreamer_init(&streamer, mesh_count);
+    u32 mesh_flags = (options.optimize_meshes ? MESH_CACHE_FLAG_OPTIMIZED : 0) | (options.vertex_format == VERTEX_FORMAT_PACKED ? MESH_CACHE_FLAG_PACKED_VERTICES : 0) |
+        (meshlet_culling ? MESH_CACHE_FLAG_MESHLETS : 0) | (options.lods ? MESH_CACHE_FLAG_LODS : 0) |
+        (options.compress_meshes ? MESH_CACHE_FLAG_COMPRESSED : 0);
     for (u32 i = 0; i < mesh_count; i++)
     {
-        Mesh* mesh = &meshes[i];
-        mesh->buffer = create_buffer(allocator, mesh->vertices.len * sizeof(Vertex), VK_BUFFER_USAGE_VERTEX_BUFFER_BIT, VMA_MEMORY_USAGE_CPU_TO_GPU);
+        meshes[i] = AssetStreamer_mesh(&streamer, AssetStreamer_load_mesh(&streamer, mesh_paths[i], mesh_flags));
+    }
+    Mesh* became_resident[array_length(meshes)];
+
+    // Lay the objects out on a grid, grouped by material and mesh so each slice rebinds as little as possible.
+    // Positions and bounds depend on the mesh extents and are filled in by place_objects once it is resident
+    RenderObjectBuffer render_objects = ZERO_INIT;
+    render_objects_resize(&render_objects, options.object_count);
+    // The per-frame model matrices are composed from these in SIMD batches
+    TransformBatch transforms;
+    TransformBatch_init(&transforms, options.object_count);
+    // Objects spin about Y through their origin, so bounds that contain every orientation never need updating
+    BoundsBatch object_bounds;
+    BoundsBatch_init(&object_bounds, options.object_count);
+    u32 grid_side = (u32)ceilf(sqrtf((f32)options.object_count));
+    for (u32 i = 0; i < options.object_count; i++)
+    {
+        RenderObject object =
+        {
+            .mesh = meshes[(u64)i * mesh_count / options.object_count],
+            .material = &materials[mesh_pipeline_indices[options.vertex_format]],
+            // A slight per-instance tint so neighbouring copies can be told apart
+            .color = { .x = 0.8f + 0.2f * (f32)(i % 3) / 2.0f, .y = 0.8f + 0.2f * (f32)(i % 5) / 4.0f, .z = 0.8f + 0.2f * (f32)(i % 7) / 6.0f, .w = 1.0f },
+        };
+        render_objects_append_assuming_capacity(&render_objects, object);
+    }
+
+    // Per-frame output of the CPU culling: the visible-index list and the compacted transforms it selects
+    u32* visible_objects = NEW(u32, options.object_count);
+    for (u32 i = 0; i < options.object_count; i++)
+    {
+        // Stays the identity list when culling is off
+        visible_objects[i] = i;
+    }
+    TransformBatch visible_transforms;
+    TransformBatch_init(&visible_transforms, options.object_count);
+    // The LOD every visible object is drawn at, indexed like visible_objects
+    u8* visible_lods = NEW(u8, options.object_count);
+
+    // Objects are grouped by material and mesh, so every run of identical pairs becomes one instanced draw
+    DrawBatchBuffer draw_batches = ZERO_INIT;
+    for (u32 i = 0; i < render_objects_len(&render_objects); i++)
+    {
+        RenderObject* object = &render_objects.ptr[i];
+        DrawBatch* last_batch = draw_batches.len ? draw_batches_last(&draw_batches) : null;
+        if ((options.instancing || gpu_driven) && last_batch && last_batch->mesh == object->mesh && last_batch->material == object->material)
+        {
+            last_batch->instance_count++;
+            continue;
+        }
+
+        DrawBatch batch =
+        {
+            .mesh = object->mesh,
+            .material = object->material,
+            .first_instance = i,
+            .instance_count = 1,
+        };
+        draw_batches_append(&draw_batches, batch);
+    }
+    print("%u render objects in %u %s\n", render_objects_len(&render_objects), draw_batches_len(&draw_batches), gpu_driven ? "indirect batches culled on the GPU" : "draws");
+
+    u32 object_count = render_objects_len(&render_objects);
+    u32 batch_count = draw_batches_len(&draw_batches);
+    for (u32 i = 0; i < frame_overlap; i++)
+    {
+        if (gpu_driven)
+        {
+            frame[i].instance_buffer = create_buffer(allocator, object_count * sizeof(InstanceData), VK_BUFFER_USAGE_VERTEX_BUFFER_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, VMA_MEMORY_USAGE_GPU_ONLY);
+            // Meshlet culling adds the per-instance draws and those of the instances drawn whole, the latter's counts and the
+            // compacted index count
+            u32 command_count = batch_count * MESH_MAX_LOD_COUNT + (meshlet_culling ? 2 * object_count : 0);
+            u32 count_count = batch_count * MESH_MAX_LOD_COUNT + (meshlet_culling ? batch_count + 1 : 0);
+            frame[i].draw_command_buffer = create_buffer(allocator, command_count * sizeof(VkDrawIndexedIndirectCommand), VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT, VMA_MEMORY_USAGE_GPU_ONLY);
+            frame[i].draw_count_buffer = create_buffer(allocator, count_count * sizeof(u32), VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT, VMA_MEMORY_USAGE_GPU_ONLY);
+            frame[i].object_slot_buffer = create_buffer(allocator, object_count * sizeof(u32), VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, VMA_MEMORY_USAGE_GPU_ONLY);
+            frame[i].gpu_object_buffer = create_buffer(allocator, object_count * sizeof(GpuObject), VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, VMA_MEMORY_USAGE_CPU_TO_GPU);
+            VKCHECK(vmaMapMemory(allocator, frame[i].gpu_object_buffer.allocation, (void**)&frame[i].gpu_objects));
+            frame[i].gpu_batch_buffer = create_buffer(allocator, batch_count * sizeof(GpuBatch), VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, VMA_MEMORY_USAGE_CPU_TO_GPU);
+            VKCHECK(vmaMapMemory(allocator, frame[i].gpu_batch_buffer.allocation, (void**)&frame[i].gpu_batches));
+            // Every batch is written before the frame first culls. Those of meshes still streaming in are written again
+            // with their real extents once the mesh is resident
+            frame[i].gpu_batch_dirty = NEW(bool, batch_count);
+            memset(frame[i].gpu_batch_dirty, true, batch_count * sizeof(bool));
+            if (meshlet_culling)
+            {
+                frame[i].meshlet_index_buffer = create_buffer(allocator, MESHLET_INDEX_BUFFER_SIZE, VK_BUFFER_USAGE_INDEX_BUFFER_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, VMA_MEMORY_USAGE_GPU_ONLY);
+            }
+        }
+        else
+        {
+            frame[i].instance_buffer = create_buffer(allocator, object_count * sizeof(InstanceData), VK_BUFFER_USAGE_VERTEX_BUFFER_BIT, VMA_MEMORY_USAGE_CPU_TO_GPU);
+            VKCHECK(vmaMapMemory(allocator, frame[i].instance_buffer.allocation, (void**)&frame[i].instances));
+        }
+    }
+
+    // GPU-driven mode: objects and batches are written once per mesh and frame, when it becomes resident; otherwise the CPU
+    // does no per-object work
+    VkDescriptorSetLayout cull_descriptor_set_layout = VK_NULL_HANDLE;
+    VkDescriptorPool cull_descriptor_pool = VK_NULL_HANDLE;
+    VkPipelineLayout cull_pipeline_layout = VK_NULL_HANDLE;
+    VkPipeline cull_pipeline = VK_NULL_HANDLE;
+    VkDescriptorSetLayout meshlet_descriptor_set_layout = VK_NULL_HANDLE;
+    VkDescriptorPool meshlet_descriptor_pool = VK_NULL_HANDLE;
+    VkPipelineLayout meshlet_cull_pipeline_layout = VK_NULL_HANDLE;
+    VkPipeline meshlet_cull_pipeline = VK_NULL_HANDLE;
+    if (gpu_driven)
+    {
+        // Both culling passes share the per-frame set; the meshlet pass also reads and writes the compacted index buffer
+        const u32 cull_descriptor_count = meshlet_culling ? MESHLET_CULL_DESCRIPTOR_COUNT : CULL_DESCRIPTOR_COUNT;
+        VkDescriptorSetLayoutBinding cull_bindings[MESHLET_CULL_DESCRIPTOR_COUNT];
+        for (u32 i = 0; i < cull_descriptor_count; i++)
+        {
+            cull_bindings[i] = (VkDescriptorSetLayoutBinding)
+            {
+                .binding = i,
+                .descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+                .descriptorCount = 1,
+                .stageFlags = VK_SHADER_STAGE_COMPUTE_BIT,
+            };
+        }
+
+        VkDescriptorSetLayoutCreateInfo cull_descriptor_set_layout_ci =
+        {
+            .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO,
+            .bindingCount = cull_descriptor_count,
+            .pBindings = cull_bindings,
+        };
+        VKCHECK(vkCreateDescriptorSetLayout(device, &cull_descriptor_set_layout_ci, pAllocator, &cull_descriptor_set_layout));
+
+        VkDescriptorPoolSize cull_pool_size =
+        {
+            .type = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+            .descriptorCount = cull_descriptor_count * FRAME_OVERLAP,
+        };
+        VkDescriptorPoolCreateInfo cull_descriptor_pool_ci =
+        {
+            .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO,
+            .maxSets = FRAME_OVERLAP,
+            .poolSizeCount = 1,
+            .pPoolSizes = &cull_pool_size,
+        };
+        VKCHECK(vkCreateDescriptorPool(device, &cull_descriptor_pool_ci, pAllocator, &cull_descriptor_pool));
+
+        for (u32 i = 0; i < frame_overlap; i++)
+        {
+            VkDescriptorSetAllocateInfo descriptor_set_ai =
+            {
+                .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO,
+                .descriptorPool = cull_descriptor_pool,
+                .descriptorSetCount = 1,
+                .pSetLayouts = &cull_descriptor_set_layout,
+            };
+            VKCHECK(vkAllocateDescriptorSets(device, &descriptor_set_ai, &frame[i].cull_descriptor_set));
+
+            VkDescriptorBufferInfo buffer_infos[MESHLET_CULL_DESCRIPTOR_COUNT] =
+            {
+                { .buffer = frame[i].gpu_object_buffer.handle, .range = VK_WHOLE_SIZE },
+                { .buffer = frame[i].gpu_batch_buffer.handle, .range = VK_WHOLE_SIZE },
+                { .buffer = frame[i].instance_buffer.handle, .range = VK_WHOLE_SIZE },
+                { .buffer = frame[i].draw_command_buffer.handle, .range = VK_WHOLE_SIZE },
+                { .buffer = frame[i].draw_count_buffer.handle, .range = VK_WHOLE_SIZE },
+                { .buffer = frame[i].object_slot_buffer.handle, .range = VK_WHOLE_SIZE },
+                { .buffer = frame[i].meshlet_index_buffer.handle, .range = VK_WHOLE_SIZE },
+            };
+            VkWriteDescriptorSet writes[MESHLET_CULL_DESCRIPTOR_COUNT];
+            for (u32 binding = 0; binding < cull_descriptor_count; binding++)
+            {
+                writes[binding] = (VkWriteDescriptorSet)
+                {
+                    .sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
+                    .dstSet = frame[i].cull_descriptor_set,
+                    .dstBinding = binding,
+                    .descriptorCount = 1,
+                    .descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+                    .pBufferInfo = &buffer_infos[binding],
+                };
+            }
+            vkUpdateDescriptorSets(device, cull_descriptor_count, writes, 0, null);
+        }
+
+        VkPushConstantRange cull_push_constant =
+        {
+            .offset = 0,
+            .size = sizeof(CullPushConstants),
+            .stageFlags = VK_SHADER_STAGE_COMPUTE_BIT,
+        };
+        VkPipelineLayoutCreateInfo cull_pipeline_layout_ci =
+        {
+            .sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO,
+            .setLayoutCount = 1,
+            .pSetLayouts = &cull_descriptor_set_layout,
+            .pushConstantRangeCount = 1,
+            .pPushConstantRanges = &cull_push_constant,
+        };
+        VKCHECK(vkCreatePipelineLayout(device, &cull_pipeline_layout_ci, pAllocator, &cull_pipeline_layout));
+        cull_pipeline = create_compute_pipeline(device, pAllocator, pipeline_cache, "cull.spv", cull_pipeline_layout, pipeline_creation_feedback, &pipeline_cache_stats);
+    }
+
+    if (meshlet_culling)
+    {
+        // One set per mesh, written when the mesh becomes resident
+        VkDescriptorSetLayoutBinding meshlet_bindings[MESHLET_DESCRIPTOR_COUNT];
+        for (u32 i = 0; i < MESHLET_DESCRIPTOR_COUNT; i++)
+        {
+            meshlet_bindings[i] = (VkDescriptorSetLayoutBinding)
+            {
+                .binding = i,
+                .descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+                .descriptorCount = 1,
+                .stageFlags = VK_SHADER_STAGE_COMPUTE_BIT,
+            };
+        }
 
-        void* data;
-        VKCHECK(vmaMapMemory(allocator, mesh->buffer.allocation, &data));
+        VkDescriptorSetLayoutCreateInfo meshlet_descriptor_set_layout_ci =
+        {
+            .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO,
+            .bindingCount = MESHLET_DESCRIPTOR_COUNT,
+            .pBindings = meshlet_bindings,
+        };
+        VKCHECK(vkCreateDescriptorSetLayout(device, &meshlet_descriptor_set_layout_ci, pAllocator, &meshlet_descriptor_set_layout));
 
-        memcpy(data, vertices_ptr(&mesh->vertices), vertices_len(&mesh->vertices) * sizeof(Vertex));
+        VkDescriptorPoolSize meshlet_pool_size =
+        {
+            .type = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+            .descriptorCount = MESHLET_DESCRIPTOR_COUNT * mesh_count,
+        };
+        VkDescriptorPoolCreateInfo meshlet_descriptor_pool_ci =
+        {
+            .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO,
+            .maxSets = mesh_count,
+            .poolSizeCount = 1,
+            .pPoolSizes = &meshlet_pool_size,
+        };
+        VKCHECK(vkCreateDescriptorPool(device, &meshlet_descriptor_pool_ci, pAllocator, &meshlet_descriptor_pool));
 
-        vmaUnmapMemory(allocator, mesh->buffer.allocation);
+        VkDescriptorSetLayout meshlet_set_layouts[] = { cull_descriptor_set_layout, meshlet_descriptor_set_layout };
+        VkPushConstantRange meshlet_cull_push_constant =
+        {
+            .offset = 0,
+            .size = sizeof(MeshletCullPushConstants),
+            .stageFlags = VK_SHADER_STAGE_COMPUTE_BIT,
+        };
+        VkPipelineLayoutCreateInfo meshlet_cull_pipeline_layout_ci =
+        {
+            .sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO,
+            .setLayoutCount = array_length(meshlet_set_layouts),
+            .pSetLayouts = meshlet_set_layouts,
+            .pushConstantRangeCount = 1,
+            .pPushConstantRanges = &meshlet_cull_push_constant,
+        };
+        VKCHECK(vkCreatePipelineLayout(device, &meshlet_cull_pipeline_layout_ci, pAllocator, &meshlet_cull_pipeline_layout));
+        meshlet_cull_pipeline = create_compute_pipeline(device, pAllocator, pipeline_cache, "meshlet_cull.spv", meshlet_cull_pipeline_layout, pipeline_creation_feedback, &pipeline_cache_stats);
     }
+    PipelineCacheStats_print(&pipeline_cache_stats);
 
-    mat4f model_matrices[array_length(graphics_pipelines) * array_length(meshes)];
     u32 frame_number = 0;
 
+    const u32 headless_frame_count = options.warmup_frame_count + options.frame_count;
+    FrameTimes frame_times = ZERO_INIT;
+    u64 measured_visible_objects = 0;
+    u64 measured_triangles = 0;
+    if (headless)
+    {
+        samples_resize(&frame_times.frame, options.frame_count);
+        samples_resize(&frame_times.cpu, options.frame_count);
+        samples_resize(&frame_times.gpu, options.frame_count);
+    }
+
+    // Headless frames rendered while meshes are still streaming in are extra warm-up, outside of the benchmark
+    u32 streaming_frame_count = 0;
     u64 frame_counter = os_performance_counter();
-    while (!glfwWindowShouldClose(app.window.handle.glfw))
+    while (headless ? frame_number - streaming_frame_count < headless_frame_count : !glfwWindowShouldClose(app.window.handle.glfw))
     {
+        // Uploads what the streaming threads finished and places the objects of the meshes that became resident
+        u32 became_resident_count = AssetStreamer_update(&streamer, &upload_ring, became_resident);
+        for (u32 i = 0; meshlet_culling && i < became_resident_count; i++)
+        {
+            Mesh* mesh = became_resident[i];
+            if (!mesh->meshlet_count)
+            {
+                continue;
+            }
+
+            VkDescriptorSetAllocateInfo descriptor_set_ai =
+            {
+                .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO,
+                .descriptorPool = meshlet_descriptor_pool,
+                .descriptorSetCount = 1,
+                .pSetLayouts = &meshlet_descriptor_set_layout,
+            };
+            VKCHECK(vkAllocateDescriptorSets(device, &descriptor_set_ai, &mesh->meshlet_descriptor_set));
+
+            VkDescriptorBufferInfo buffer_infos[MESHLET_DESCRIPTOR_COUNT] =
+            {
+                { .buffer = mesh->meshlet_buffer.handle, .range = VK_WHOLE_SIZE },
+                { .buffer = mesh->index_buffer.handle, .range = VK_WHOLE_SIZE },
+            };
+            VkWriteDescriptorSet writes[MESHLET_DESCRIPTOR_COUNT];
+            for (u32 binding = 0; binding < MESHLET_DESCRIPTOR_COUNT; binding++)
+            {
+                writes[binding] = (VkWriteDescriptorSet)
+                {
+                    .sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
+                    .dstSet = mesh->meshlet_descriptor_set,
+                    .dstBinding = binding,
+                    .descriptorCount = 1,
+                    .descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+                    .pBufferInfo = &buffer_infos[binding],
+                };
+            }
+            vkUpdateDescriptorSets(device, MESHLET_DESCRIPTOR_COUNT, writes, 0, null);
+        }
+        for (u32 batch_index = 0; became_resident_count && batch_index < batch_count; batch_index++)
+        {
+            DrawBatch* batch = &draw_batches.ptr[batch_index];
+            for (u32 i = 0; i < became_resident_count; i++)
+            {
+                if (batch->mesh != became_resident[i])
+                {
+                    continue;
+                }
+
+                place_objects(render_objects.ptr, batch->first_instance, batch->instance_count, grid_side, &transforms, &object_bounds);
+                for (u32 f = 0; gpu_driven && f < frame_overlap; f++)
+                {
+                    frame[f].gpu_batch_dirty[batch_index] = true;
+                }
+            }
+        }
+        const bool streaming = !AssetStreamer_all_resident(&streamer);
+        const u32 benchmark_frame = frame_number - streaming_frame_count;
+        streaming_frame_count += streaming;
+
         u64 internal_frame_counter = os_performance_counter();
         app.delta_time = os_compute_ms(frame_counter, internal_frame_counter);
         //print("PREVIOUS: %u, CURRENT: %u, DELTA: %.02f ms.\n", frame_counter, internal_frame_counter, app.delta_time);
+        if (headless && !streaming && benchmark_frame > options.warmup_frame_count)
+        {
+            samples_append(&frame_times.frame, app.delta_time);
+        }
         frame_counter = internal_frame_counter;
         const u32 frame_index = frame_number % frame_overlap;
-        
-        glfwPollEvents();
+        const bool measured_frame = headless && !streaming && benchmark_frame >= options.warmup_frame_count;
 
-        app_handle_input(&app);
-
-        for (u32 material_index = 0; material_index < material_count; material_index++)
+        if (headless)
         {
-            for (u32 mesh_index = 0; mesh_index < mesh_count; mesh_index++)
-            {
-                mat4f model = rotate(MAT4_IDENTITY_INIT, rad(frame_number * 0.4f), (vec3f) {0,1,0});
-                u32 index = (material_index * mesh_count) + mesh_index;
-                model_matrices[index] = model;
-            }
+            Camera_script_orbit(&app.camera, benchmark_frame, headless_frame_count);
+        }
+        else
+        {
+            glfwPollEvents();
+
+            app_handle_input(&app);
         }
 
         mat4f proj = perspective(rad(app.camera.zoom), (f32)app.window.width / (f32)app.window.height, 0.1, 100.0f);
@@ -1315,9 +4591,30 @@ s32 main(s32 argc, char* argv[])
 
         VKCHECK(vkWaitForFences(device, 1, &frame[frame_index].sync.render_fence, true, 1000 * 1000 * 1000));
         VKCHECK(vkResetFences(device, 1, &frame[frame_index].sync.render_fence));
+        arena_reset(&frame[frame_index].arena);
+        for (u32 i = 0; i < frame[frame_index].thread_command_pool_count; i++)
+        {
+            ThreadCommandPool* pool = &frame[frame_index].thread_command_pools[i];
+            VKCHECK(vkResetCommandPool(device, pool->handle, 0));
+            pool->used_secondary_count = 0;
+        }
+        for (u32 batch_index = 0; gpu_driven && batch_index < batch_count; batch_index++)
+        {
+            if (frame[frame_index].gpu_batch_dirty[batch_index])
+            {
+                write_gpu_batch(&draw_batches.ptr[batch_index], batch_index, batch_count, render_objects.ptr, object_count, frame[frame_index].gpu_batches, frame[frame_index].gpu_objects);
+                frame[frame_index].gpu_batch_dirty[batch_index] = false;
+            }
+        }
+        u64 cpu_frame_counter = os_performance_counter();
 
-        u32 swapchain_image_index;
-        VKCHECK(vkAcquireNextImageKHR(device, swapchain, 0, frame[frame_index].sync.present_sem, null, &swapchain_image_index));
+        Frame_collect_gpu_time(device, &frame[frame_index], timestamp_period, timestamp_mask, &frame_times.gpu);
+
+        u32 swapchain_image_index = frame_index;
+        if (!headless)
+        {
+            VKCHECK(vkAcquireNextImageKHR(device, swapchain, 0, frame[frame_index].sync.present_sem, null, &swapchain_image_index));
+        }
 
         VKCHECK(vkResetCommandBuffer(frame[frame_index].sync.command_buffer, 0));
 
@@ -1329,6 +4626,13 @@ s32 main(s32 argc, char* argv[])
 
         VKCHECK(vkBeginCommandBuffer(frame[frame_index].sync.command_buffer, &begin_info));
 
+        const bool write_timestamps = gpu_timing && measured_frame;
+        if (write_timestamps)
+        {
+            vkCmdResetQueryPool(frame[frame_index].sync.command_buffer, frame[frame_index].timestamp_query_pool, 0, TIMESTAMP_QUERY_COUNT);
+            vkCmdWriteTimestamp(frame[frame_index].sync.command_buffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, frame[frame_index].timestamp_query_pool, 0);
+        }
+
         VkClearValue color_clear = ZERO_INIT;
         f32 flash = (f32)fabs(sin(frame_number / 120.f));
         color_clear.color = (VkClearColorValue) { { 0.0f, 0.0f, 0.0f, 1.0f} };
@@ -1350,58 +4654,175 @@ s32 main(s32 argc, char* argv[])
             .clearValueCount = array_length(clear_values),
         };
 
-        vkCmdBeginRenderPass(frame[frame_index].sync.command_buffer, &rp_begin_info, VK_SUBPASS_CONTENTS_INLINE);
-
-        /***** BEGIN RENDER ******/
-
-        for (u32 material_index = 0; material_index < material_count; material_index++)
+        const f32 angle = rad(benchmark_frame * 0.4f);
+        if (gpu_driven)
         {
-            vkCmdBindPipeline(frame[frame_index].sync.command_buffer, VK_PIPELINE_BIND_POINT_GRAPHICS, materials[material_index].pipeline);
-            for (u32 mesh_index = 0; mesh_index < mesh_count; mesh_index++)
+            CullPushConstants cull_constants =
             {
-                const VkDeviceSize offset = 0;
-                vkCmdBindVertexBuffers(frame[frame_index].sync.command_buffer, 0, 1, &meshes[mesh_index].buffer.handle, &offset);
-                u32 model_matrix_index = (material_index * mesh_count) + mesh_index;
-                MeshPushConstants constants =
+                .camera_position = vec4f_cast(app.camera.position),
+                .angle = angle,
+                .object_count = object_count,
+                .lod_error_scale = lod_error_scale(rad(app.camera.zoom), (f32)app.window.height),
+            };
+            frustum_planes_from_matrix(proj_x_view, cull_constants.frustum_planes);
+            record_gpu_culling(frame[frame_index].sync.command_buffer, &frame[frame_index], cull_pipeline, cull_pipeline_layout, cull_constants, batch_count);
+            if (meshlet_culling)
+            {
+                MeshletCullPushConstants meshlet_constants =
                 {
-                    .render_matrix = mat4f_mul(proj_x_view, model_matrices[model_matrix_index]),
+                    .camera_position = vec4f_cast(app.camera.position),
+                    .batch_count = batch_count,
+                    .index_capacity = MESHLET_INDEX_BUFFER_SIZE / sizeof(u32),
                 };
-                vkCmdPushConstants(frame[frame_index].sync.command_buffer, materials[material_index].layout, VK_SHADER_STAGE_VERTEX_BIT, 0, sizeof(MeshPushConstants), &constants);
-                vkCmdDraw(frame[frame_index].sync.command_buffer, meshes[mesh_index].vertices.len, 1, 0, 0);
+                memcpy(meshlet_constants.frustum_planes, cull_constants.frustum_planes, sizeof(meshlet_constants.frustum_planes));
+                record_meshlet_culling(frame[frame_index].sync.command_buffer, &frame[frame_index], meshlet_cull_pipeline, meshlet_cull_pipeline_layout, meshlet_constants, draw_batches.ptr);
+            }
+
+            vkCmdBeginRenderPass(frame[frame_index].sync.command_buffer, &rp_begin_info, VK_SUBPASS_CONTENTS_INLINE);
+
+            /***** BEGIN RENDER ******/
+
+            record_indirect_draws(frame[frame_index].sync.command_buffer, &frame[frame_index], draw_batches.ptr, batch_count, object_count, proj_x_view);
+        }
+        else
+        {
+            vkCmdBeginRenderPass(frame[frame_index].sync.command_buffer, &rp_begin_info, VK_SUBPASS_CONTENTS_SECONDARY_COMMAND_BUFFERS);
+
+            /***** BEGIN RENDER ******/
+
+            VkCommandBufferInheritanceInfo inheritance_info =
+            {
+                .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_INHERITANCE_INFO,
+                .renderPass = render_pass,
+                .subpass = 0,
+                .framebuffer = framebuffers[swapchain_image_index],
+            };
+
+            u32 visible_count = object_count;
+            if (options.culling)
+            {
+                vec4f frustum_planes[6];
+                frustum_planes_from_matrix(proj_x_view, frustum_planes);
+                visible_count = options.aabb_culling ?
+                    frustum_cull_aabbs(frustum_planes, &object_bounds, visible_objects) :
+                    frustum_cull_spheres(frustum_planes, &object_bounds, visible_objects);
+            }
+            if (measured_frame)
+            {
+                measured_visible_objects += visible_count;
+            }
+
+            select_lods(render_objects.ptr, &object_bounds, visible_objects, visible_count, app.camera.position, lod_error_scale(rad(app.camera.zoom), (f32)app.window.height), visible_lods);
+
+            // Every run of visible objects at the same LOD is a batch of its own, so there are at most visible_count of them
+            DrawBatch* visible_batches = ARENA_NEW(&frame[frame_index].arena, DrawBatch, visible_count);
+            u32 visible_batch_count = compact_visible_batches(draw_batches.ptr, batch_count, visible_objects, visible_lods, visible_count, visible_batches);
+            for (u32 i = 0; measured_frame && i < visible_batch_count; i++)
+            {
+                measured_triangles += (u64)visible_batches[i].mesh->lods[visible_batches[i].lod].index_count / 3 * visible_batches[i].instance_count;
+            }
+
+            u32 batches_per_slice = MAX(MIN_DRAWS_PER_SECONDARY_BUFFER, (visible_batch_count + os_job_thread_count() - 1) / os_job_thread_count());
+            u32 slice_count = (visible_batch_count + batches_per_slice - 1) / batches_per_slice;
+            DrawRecordContext draw_record_context =
+            {
+                .device = device,
+                .frame = &frame[frame_index],
+                .inheritance = &inheritance_info,
+                .objects = render_objects.ptr,
+                .visible_objects = visible_objects,
+                .transforms = &transforms,
+                .visible_transforms = &visible_transforms,
+                .batches = visible_batches,
+                .proj_x_view = proj_x_view,
+                .angle = angle,
+                .batches_per_slice = batches_per_slice,
+                .secondary_buffers = ARENA_NEW(&frame[frame_index].arena, VkCommandBuffer, slice_count),
+            };
+
+            os_parallel_for(visible_count, INSTANCES_PER_JOB, write_instance_slice, &draw_record_context);
+            os_parallel_for(visible_batch_count, batches_per_slice, record_draw_slice, &draw_record_context);
+            if (slice_count)
+            {
+                vkCmdExecuteCommands(frame[frame_index].sync.command_buffer, slice_count, draw_record_context.secondary_buffers);
             }
         }
 
         /***** END RENDER ******/
 
         vkCmdEndRenderPass(frame[frame_index].sync.command_buffer);
+
+        if (write_timestamps)
+        {
+            vkCmdWriteTimestamp(frame[frame_index].sync.command_buffer, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, frame[frame_index].timestamp_query_pool, 1);
+            frame[frame_index].timestamps_written = true;
+        }
+
         VKCHECK(vkEndCommandBuffer(frame[frame_index].sync.command_buffer));
 
-        VkPipelineStageFlags wait_stage = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
+        // Headless frames have no swapchain image to wait on nor a presentation engine to signal
+        VkSemaphore wait_semaphores[2];
+        VkPipelineStageFlags wait_stages[2];
+        u64 wait_values[2] = ZERO_INIT; /* ignored for binary semaphores */
+        u32 wait_count = 0;
+        if (!headless)
+        {
+            wait_semaphores[wait_count] = frame[frame_index].sync.present_sem;
+            wait_stages[wait_count++] = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
+        }
+        if (upload_ring.timeline)
+        {
+            // Frames only draw meshes whose upload value the timeline already reached, so this wait never blocks.
+            // It is still needed to make the transfer queue's writes visible to vertex input, and to meshlet culling
+            wait_semaphores[wait_count] = upload_ring.timeline;
+            wait_values[wait_count] = streamer.resident_upload_value;
+            wait_stages[wait_count++] = VK_PIPELINE_STAGE_VERTEX_INPUT_BIT | (meshlet_culling ? VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT : 0);
+        }
+
+        VkTimelineSemaphoreSubmitInfo timeline_submit_info =
+        {
+            .sType = VK_STRUCTURE_TYPE_TIMELINE_SEMAPHORE_SUBMIT_INFO,
+            .waitSemaphoreValueCount = wait_count,
+            .pWaitSemaphoreValues = wait_values,
+        };
         VkSubmitInfo submit_info =
         {
             .sType = VK_STRUCTURE_TYPE_SUBMIT_INFO,
-            .pWaitDstStageMask = &wait_stage,
-            .waitSemaphoreCount = 1,
-            .pWaitSemaphores = &frame[frame_index].sync.present_sem,
-            .signalSemaphoreCount = 1,
+            .pNext = upload_ring.timeline ? &timeline_submit_info : null,
+            .pWaitDstStageMask = wait_stages,
+            .waitSemaphoreCount = wait_count,
+            .pWaitSemaphores = wait_semaphores,
+            .signalSemaphoreCount = headless ? 0 : 1,
             .pSignalSemaphores = &frame[frame_index].sync.render_sem,
             .commandBufferCount = 1,
             .pCommandBuffers = &frame[frame_index].sync.command_buffer,
         };
 
         VKCHECK(vkQueueSubmit(queue, 1, &submit_info, frame[frame_index].sync.render_fence));
+        if (frame_number == 0)
+        {
+            print("First frame submitted %.3f ms after the meshes were requested\n", os_compute_ms(streamer.start_counter, os_performance_counter()));
+        }
 
-        VkPresentInfoKHR present_info =
+        if (measured_frame)
         {
-            .sType = VK_STRUCTURE_TYPE_PRESENT_INFO_KHR,
-            .pSwapchains = &swapchain,
-            .swapchainCount = 1,
-            .pWaitSemaphores = &frame[frame_index].sync.render_sem,
-            .waitSemaphoreCount = 1,
-            .pImageIndices = &swapchain_image_index,
-        };
+            samples_append(&frame_times.cpu, os_compute_ms(cpu_frame_counter, os_performance_counter()));
+        }
+
+        if (!headless)
+        {
+            VkPresentInfoKHR present_info =
+            {
+                .sType = VK_STRUCTURE_TYPE_PRESENT_INFO_KHR,
+                .pSwapchains = &swapchain,
+                .swapchainCount = 1,
+                .pWaitSemaphores = &frame[frame_index].sync.render_sem,
+                .waitSemaphoreCount = 1,
+                .pImageIndices = &swapchain_image_index,
+            };
 
-        VKCHECK(vkQueuePresentKHR(queue, &present_info));
+            VKCHECK(vkQueuePresentKHR(queue, &present_info));
+        }
 
         frame_number++;
 
@@ -1411,13 +4832,71 @@ s32 main(s32 argc, char* argv[])
     for (u32 i = 0; i < frame_overlap; i++)
     {
         VKCHECK(vkWaitForFences(device, 1, &frame[i].sync.render_fence, true, 1000 * 1000 * 1000));
+        if (gpu_timing)
+        {
+            Frame_collect_gpu_time(device, &frame[i], timestamp_period, timestamp_mask, &frame_times.gpu);
+            vkDestroyQueryPool(device, frame[i].timestamp_query_pool, pAllocator);
+        }
         vkDestroyFence(device, frame[i].sync.render_fence, pAllocator);
         vkDestroySemaphore(device, frame[i].sync.render_sem, pAllocator);
         vkDestroySemaphore(device, frame[i].sync.present_sem, pAllocator);
         vkFreeCommandBuffers(device, frame[i].sync.command_pool, 1, &frame[i].sync.command_buffer);
         vkDestroyCommandPool(device, frame[i].sync.command_pool, pAllocator);
+        for (u32 thread_index = 0; thread_index < frame[i].thread_command_pool_count; thread_index++)
+        {
+            // Destroying the pool frees its secondary buffers
+            vkDestroyCommandPool(device, frame[i].thread_command_pools[thread_index].handle, pAllocator);
+            command_buffers_deinit(&frame[i].thread_command_pools[thread_index].secondary_buffers);
+        }
+        DELETE(frame[i].thread_command_pools);
+        if (gpu_driven)
+        {
+            vmaDestroyBuffer(allocator, frame[i].draw_command_buffer.handle, frame[i].draw_command_buffer.allocation);
+            vmaDestroyBuffer(allocator, frame[i].draw_count_buffer.handle, frame[i].draw_count_buffer.allocation);
+            vmaDestroyBuffer(allocator, frame[i].object_slot_buffer.handle, frame[i].object_slot_buffer.allocation);
+            vmaUnmapMemory(allocator, frame[i].gpu_object_buffer.allocation);
+            vmaUnmapMemory(allocator, frame[i].gpu_batch_buffer.allocation);
+            vmaDestroyBuffer(allocator, frame[i].gpu_object_buffer.handle, frame[i].gpu_object_buffer.allocation);
+            vmaDestroyBuffer(allocator, frame[i].gpu_batch_buffer.handle, frame[i].gpu_batch_buffer.allocation);
+            DELETE(frame[i].gpu_batch_dirty);
+            if (meshlet_culling)
+            {
+                vmaDestroyBuffer(allocator, frame[i].meshlet_index_buffer.handle, frame[i].meshlet_index_buffer.allocation);
+            }
+        }
+        else
+        {
+            vmaUnmapMemory(allocator, frame[i].instance_buffer.allocation);
+        }
+        vmaDestroyBuffer(allocator, frame[i].instance_buffer.handle, frame[i].instance_buffer.allocation);
+    }
+
+    if (gpu_driven)
+    {
+        vkDestroyPipeline(device, cull_pipeline, pAllocator);
+        vkDestroyPipelineLayout(device, cull_pipeline_layout, pAllocator);
+        vkDestroyDescriptorPool(device, cull_descriptor_pool, pAllocator);
+        vkDestroyDescriptorSetLayout(device, cull_descriptor_set_layout, pAllocator);
+        if (meshlet_culling)
+        {
+            vkDestroyPipeline(device, meshlet_cull_pipeline, pAllocator);
+            vkDestroyPipelineLayout(device, meshlet_cull_pipeline_layout, pAllocator);
+            vkDestroyDescriptorPool(device, meshlet_descriptor_pool, pAllocator);
+            vkDestroyDescriptorSetLayout(device, meshlet_descriptor_set_layout, pAllocator);
+        }
     }
 
+    AssetStreamer_deinit(&streamer);
+    UploadRing_print_stats(&upload_ring);
+    UploadRing_deinit(&upload_ring, pAllocator);
+    render_objects_deinit(&render_objects);
+    TransformBatch_deinit(&transforms);
+    TransformBatch_deinit(&visible_transforms);
+    BoundsBatch_deinit(&object_bounds);
+    free_chunk(visible_objects);
+    free_chunk(visible_lods);
+    draw_batches_deinit(&draw_batches);
+
     for (u32 i = 0; i < pipeline_count; i++)
     {
         u32 stage_count = graphics_pipelines_create_info[i].stageCount;
@@ -1431,17 +4910,54 @@ s32 main(s32 argc, char* argv[])
 
     vkDestroyRenderPass(device, render_pass, pAllocator);
 
-    for (u32 i = 0; i < swapchain_image_count; i++)
+    for (u32 i = 0; i < color_image_count; i++)
     {
         vkDestroyFramebuffer(device, framebuffers[i], pAllocator);
-        vkDestroyImageView(device, swapchain_image_views[i], pAllocator);
+        vkDestroyImageView(device, color_image_views[i], pAllocator);
+    }
+
+    if (headless)
+    {
+        for (u32 i = 0; i < color_image_count; i++)
+        {
+            vmaDestroyImage(allocator, offscreen_images[i].handle, offscreen_images[i].allocation);
+        }
+
+        print("\nHeadless benchmark: %u frames (%u warm-up) at %ux%u on %s, %u objects recorded on %u threads\n", options.frame_count, options.warmup_frame_count, extent.width, extent.height, device_properties.deviceName, options.object_count, os_job_thread_count());
+        print_frame_time_stats("Frame", &frame_times.frame);
+        print_frame_time_stats("CPU", &frame_times.cpu);
+        if (gpu_timing)
+        {
+            print_frame_time_stats("GPU", &frame_times.gpu);
+        }
+        if (!gpu_driven && options.culling)
+        {
+            print("CPU frustum culling against %s kept %.1f of %u objects per frame\n", options.aabb_culling ? "boxes" : "spheres", (f64)measured_visible_objects / (f64)options.frame_count, object_count);
+        }
+        if (!gpu_driven)
+        {
+            print("Drew %.0f triangles per frame\n", (f64)measured_triangles / (f64)options.frame_count);
+        }
+    }
+    else
+    {
+        vkDestroySwapchainKHR(device, swapchain, pAllocator);
+        vkDestroySurfaceKHR(instance, surface, pAllocator);
     }
 
-    vkDestroySwapchainKHR(device, swapchain, pAllocator);
-    vkDestroySurfaceKHR(instance, surface, pAllocator);
+    pipeline_cache_save(device, pipeline_cache, &device_properties, PIPELINE_CACHE_PATH);
+    vkDestroyPipelineCache(device, pipeline_cache, pAllocator);
     vkDestroyDevice(device, pAllocator);
-    vkDestroyDebugUtilsMessengerEXT(instance, messenger, pAllocator);
+    if (debug_utils_found)
+    {
+        vkDestroyDebugUtilsMessengerEXT(instance, messenger, pAllocator);
+    }
     vkDestroyInstance(instance, pAllocator);
 
-    glfwDestroyWindow(app.window.handle.glfw);
+    if (!headless)
+    {
+        glfwDestroyWindow(app.window.handle.glfw);
+    }
+
+    os_job_system_shutdown();
 }
@@ -1,14 +1,44 @@
+#pragma once
+// SSE2 is part of the x86-64 baseline, so the SIMD path is on by default there. Build with -DSIMD=0 to force scalar code.
+// Every SIMD function keeps the operation order of its *_scalar twin and never fuses multiply-adds, so both paths
+// produce bit-identical results
+#ifndef SIMD
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define SIMD 1
+#else
 #define SIMD 0
+#endif
+#endif
 #include "types.h"
 #include "os.h"
 #include <math.h>
 #include <stdlib.h>
 #include <assert.h>
+#if SIMD
 #ifdef RED_OS_WINDOWS
 #include <intrin.h>
 #else
 #include <x86intrin.h>
 #endif
+#endif
+
+#if SIMD
+#define MATHS_BACKEND_NAME "SSE2"
+#else
+#define MATHS_BACKEND_NAME "scalar"
+#endif
+
+// The batch kernels pick the widest lane layout the compiler targets: 16 objects per AVX-512 register, 8 per AVX2 one
+#if SIMD && defined(__AVX512F__)
+#define BATCH_LANE_COUNT 16
+#define MATHS_BATCH_BACKEND_NAME "AVX-512"
+#elif SIMD && defined(__AVX2__)
+#define BATCH_LANE_COUNT 8
+#define MATHS_BATCH_BACKEND_NAME "AVX2"
+#else
+#define BATCH_LANE_COUNT 1
+#define MATHS_BATCH_BACKEND_NAME "scalar"
+#endif
 #define abs_T(x) (((x) > 0) ? (x) : -(x))
 
 #define PI_F32 3.14159265358979323846264338327950288
@@ -58,6 +88,9 @@ typedef union vec4f
     {
         f32 v[4];
     };
+#if SIMD
+    __m128 m;
+#endif
 } vec4f;
 
 typedef union mat4f
@@ -80,168 +113,233 @@ static inline vec4f vec4f_cast(vec3f v)
     return vec4;
 }
 
+#if SIMD
+// vec3f stays 12 bytes so it can keep living in vertex-like data; it goes through a register with w = 0
+static inline __m128 vec3_load(vec3f v)
+{
+    __m128 xy = _mm_castsi128_ps(_mm_loadl_epi64((const __m128i*)v.v));
+    return _mm_movelh_ps(xy, _mm_load_ss(&v.z));
+}
+
+static inline vec3f vec3_store(__m128 m)
+{
+    vec4f result = { .m = m };
+    return (vec3f) { result.x, result.y, result.z };
+}
+
+#define M128_SPLAT(m, lane) _mm_shuffle_ps((m), (m), _MM_SHUFFLE((lane), (lane), (lane), (lane)))
+
+// (x * x' + y * y') + z * z', broadcast to every lane; same summation order as the scalar dot product
+static inline __m128 vec3_dot_m128(__m128 a, __m128 b)
+{
+    __m128 product = _mm_mul_ps(a, b);
+    __m128 sum = _mm_add_ss(product, _mm_shuffle_ps(product, product, _MM_SHUFFLE(1, 1, 1, 1)));
+    sum = _mm_add_ss(sum, _mm_movehl_ps(product, product));
+    return _mm_shuffle_ps(sum, sum, _MM_SHUFFLE(0, 0, 0, 0));
+}
+
+static inline __m128 vec3_cross_m128(__m128 a, __m128 b)
+{
+    /* (a.y * b.z - a.z * b.y, a.z * b.x - a.x * b.z, a.x * b.y - a.y * b.x) */
+    __m128 a_yzx = _mm_shuffle_ps(a, a, _MM_SHUFFLE(3, 0, 2, 1));
+    __m128 a_zxy = _mm_shuffle_ps(a, a, _MM_SHUFFLE(3, 1, 0, 2));
+    __m128 b_yzx = _mm_shuffle_ps(b, b, _MM_SHUFFLE(3, 0, 2, 1));
+    __m128 b_zxy = _mm_shuffle_ps(b, b, _MM_SHUFFLE(3, 1, 0, 2));
+    return _mm_sub_ps(_mm_mul_ps(a_yzx, b_zxy), _mm_mul_ps(a_zxy, b_yzx));
+}
+
+// ((a0 * w.x + a1 * w.y) + a2 * w.z) + a3 * w.w, the column order of the scalar matrix products
+static inline __m128 mat4_combine_m128(__m128 a0, __m128 a1, __m128 a2, __m128 a3, __m128 weights)
+{
+    __m128 sum = _mm_add_ps(_mm_mul_ps(a0, M128_SPLAT(weights, 0)), _mm_mul_ps(a1, M128_SPLAT(weights, 1)));
+    sum = _mm_add_ps(sum, _mm_mul_ps(a2, M128_SPLAT(weights, 2)));
+    return _mm_add_ps(sum, _mm_mul_ps(a3, M128_SPLAT(weights, 3)));
+}
+
+static inline __m128 mat3_combine_m128(__m128 a0, __m128 a1, __m128 a2, __m128 weights)
+{
+    __m128 sum = _mm_add_ps(_mm_mul_ps(a0, M128_SPLAT(weights, 0)), _mm_mul_ps(a1, M128_SPLAT(weights, 1)));
+    return _mm_add_ps(sum, _mm_mul_ps(a2, M128_SPLAT(weights, 2)));
+}
+
+static inline __m128 vec3_normalize_m128(__m128 v)
+{
+    __m128 inverse_magnitude = _mm_div_ps(_mm_set1_ps(1.0f), _mm_sqrt_ps(vec3_dot_m128(v, v)));
+    return _mm_mul_ps(v, inverse_magnitude);
+}
+#endif
+
 static inline f32 unitRand(void)
 {
 	f32 result = (f32)rand() / (f32)RAND_MAX;
 	return result;
 }
 
-static inline vec3f vec3_closer(vec3f a, vec3f b)
+
+static inline f32 vec3_dot_scalar(vec3f a, vec3f b)
+{
+    return a.v[0] * b.v[0] + a.v[1] * b.v[1] + a.v[2] * b.v[2];
+}
+
+static inline f32 vec3_dot(vec3f a, vec3f b)
 {
 #if SIMD
-//#pragma error
-    return (vec3f){ 0, 0, 0, 0 };
+    return _mm_cvtss_f32(vec3_dot_m128(vec3_load(a), vec3_load(b)));
 #else
-    f32 a_length_squared = (a.x * a.x) + (a.y * a.y) + (a.z * a.z);
-    f32 b_length_squared = (b.x * b.x) + (b.y * b.y) + (b.z * b.z);
-    return a_length_squared < b_length_squared ? b : a;
+    return vec3_dot_scalar(a, b);
 #endif
 }
 
-static inline vec3f vec3_muladds(vec3f a, f32 s, vec3f dest)
+static inline vec3f vec3_dot_vec(vec3f a, vec3f b)
 {
 #if SIMD
-    vec3f scalar_vector = _mm_set1_ps(s);
-    vec3f mult = _mm_mul_ps(a, scalar_vector);
-    dest = _mm_add_ps(mult, dest);
+    return vec3_store(vec3_dot_m128(vec3_load(a), vec3_load(b)));
 #else
+    float dp = vec3_dot_scalar(a, b);
+    return (vec3f) { dp, dp, dp };
+#endif
+}
+
+static inline vec3f vec3_closer(vec3f a, vec3f b)
+{
+    f32 a_length_squared = vec3_dot(a, a);
+    f32 b_length_squared = vec3_dot(b, b);
+    return a_length_squared < b_length_squared ? b : a;
+}
+
+static inline vec3f vec3_muladds_scalar(vec3f a, f32 s, vec3f dest)
+{
 	dest.v[0] += a.v[0] * s;
 	dest.v[1] += a.v[1] * s;
 	dest.v[2] += a.v[2] * s;
-#endif
     return dest;
 }
 
-static inline bool vec3_equal(vec3f a, vec3f b)
+static inline vec3f vec3_muladds(vec3f a, f32 s, vec3f dest)
 {
 #if SIMD
-	return (_mm_movemask_ps(_mm_cmpeq_ps(a, b)) & 7) == 7;
+    return vec3_store(_mm_add_ps(vec3_load(dest), _mm_mul_ps(vec3_load(a), _mm_set1_ps(s))));
 #else
-    return a.v[0] == b.v[0] && a.v[1] == b.v[1] && a.v[2] == b.v[2];
+    return vec3_muladds_scalar(a, s, dest);
 #endif
 }
 
-static inline vec3f vec3_cross(vec3f a, vec3f b)
+static inline bool vec3_equal(vec3f a, vec3f b)
 {
 #if SIMD
-    /* (u2.v3 - u3.v2, u3.v1 - u1.v3, u1.v2 - u2.v1) */
-    vec3f first_mult_first_operand = _mm_shuffle_ps(a, a, _MM_SHUFFLE(0, 0, 2, 1));
-    vec3f first_mult_second_operand = _mm_shuffle_ps(b, b, _MM_SHUFFLE(0, 1, 0, 2));
-    vec3f second_mult_first_operand = _mm_shuffle_ps(a, a, _MM_SHUFFLE(0, 1, 0, 2));
-    vec3f second_mult_second_operand = _mm_shuffle_ps(b, b, _MM_SHUFFLE(0, 0, 2, 1));
-    vec3f first_mult = _mm_mul_ps(first_mult_first_operand, first_mult_second_operand);
-    vec3f second_mult = _mm_mul_ps(second_mult_first_operand, second_mult_second_operand);
-    vec3f dest = _mm_sub_ps(first_mult, second_mult);
-    
-    return dest;
+	return (_mm_movemask_ps(_mm_cmpeq_ps(vec3_load(a), vec3_load(b))) & 7) == 7;
 #else
+    return a.v[0] == b.v[0] && a.v[1] == b.v[1] && a.v[2] == b.v[2];
+#endif
+}
+
+static inline vec3f vec3_cross_scalar(vec3f a, vec3f b)
+{
     vec3f dest;
     dest.v[0] = a.v[1] * b.v[2] - a.v[2] * b.v[1];
     dest.v[1] = a.v[2] * b.v[0] - a.v[0] * b.v[2];
     dest.v[2] = a.v[0] * b.v[1] - a.v[1] * b.v[0];
     return dest;
-#endif
 }
 
-typedef enum
-{
-    COMPUTE_1_ELEM = 0x11,
-    COMPUTE_2_ELEMS = 0x33,
-    COMPUTE_3_ELEMS = 0x77,
-    COMPUTE_4_ELEMS = 0xFF,
-} VEC4F_INDEX_FLAG;
-
-static inline f32 vec3_dot(vec3f a, vec3f b)
+static inline vec3f vec3_cross(vec3f a, vec3f b)
 {
 #if SIMD
-    //int mask = (PICK_VEC4F_ELEM(false, true, true, true) << 4) | PICK_VEC4F_ELEM(false, true, true, true);
-    vec3f result = (vec3f)_mm_dp_ps(a, b, COMPUTE_3_ELEMS);
-    return result[0];
+    return vec3_store(vec3_cross_m128(vec3_load(a), vec3_load(b)));
 #else
-    return a.v[0] * b.v[0] + a.v[1] * b.v[1] + a.v[2] * b.v[2];
+    return vec3_cross_scalar(a, b);
 #endif
 }
 
-static inline vec3f vec3_dot_vec(vec3f a, vec3f b)
+static inline f32 rad(f32 deg)
 {
-#if SIMD
-    //int mask = (PICK_VEC4F_ELEM(false, true, true, true) << 4) | PICK_VEC4F_ELEM(false, true, true, true);
-    vec3f result = _mm_dp_ps(a, b, COMPUTE_3_ELEMS);
-    return result;
-#else
-    float dp = a.v[0] * b.v[0] + a.v[1] * b.v[1] + a.v[2] * b.v[2];
-    return (vec3f) { dp, dp, dp };
-#endif
+    return deg * PI_F32 / 180.0f;
 }
 
-static inline f32 rad(f32 deg)
+static inline f32 vec3_norm_scalar(vec3f v)
 {
-    return deg * PI_F32 / 180.0f;
+    return sqrtf(vec3_dot_scalar(v, v));
 }
- 
+
 static inline f32 vec3_norm(vec3f v)
 {
 #if SIMD
-    return _mm_sqrt_ps(_mm_dp_ps(v, v, COMPUTE_3_ELEMS))[0];
+    __m128 m = vec3_load(v);
+    return _mm_cvtss_f32(_mm_sqrt_ss(vec3_dot_m128(m, m)));
 #else
-    return sqrtf(vec3_dot(v, v));
+    return vec3_norm_scalar(v);
 #endif
 }
 
 static inline vec3f vec3_norm_vec(vec3f v)
 {
 #if SIMD
-    return _mm_sqrt_ps(_mm_dp_ps(v, v, COMPUTE_3_ELEMS));
+    __m128 m = vec3_load(v);
+    return vec3_store(_mm_sqrt_ps(vec3_dot_m128(m, m)));
 #else
-    f32 dot_product = vec3_dot(v, v);
-    f32 root = sqrtf(dot_product);
+    f32 root = vec3_norm_scalar(v);
     return (vec3f) { root, root, root };
 #endif
 }
- 
-static inline vec3f vec3_scale(vec3f v, f32 s)
+
+static inline vec3f vec3_scale_scalar(vec3f v, f32 s)
 {
-#if SIMD
-    vec3f s_vector = { s, s, s };
-    return _mm_mul_ps(v, s_vector);
-#else
     vec3f vector = { v.v[0] * s, v.v[1] * s, v.v[2] * s };
     return vector;
-#endif
 }
 
-static inline vec3f vec3_normalize(vec3f v)
+static inline vec3f vec3_scale(vec3f v, f32 s)
 {
 #if SIMD
-    vec3f norm = vec3_norm_vec(v);
-    vec3f inv = { 1.0f, 1.0f, 1.0f };
-    vec3f inverse = _mm_div_ps(inv, norm);
-    vec3f result = _mm_mul_ps(v, inverse);
-    return result;
+    return vec3_store(_mm_mul_ps(vec3_load(v), _mm_set1_ps(s)));
 #else
+    return vec3_scale_scalar(v, s);
+#endif
+}
+
+static inline vec3f vec3_normalize_scalar(vec3f v)
+{
 	f32 invmag = 1.0f / sqrtf(v.v[0] * v.v[0] + v.v[1] * v.v[1] + v.v[2] * v.v[2]);
 	v.v[0] *= invmag;
 	v.v[1] *= invmag;
 	v.v[2] *= invmag;
     return v;
+}
+
+static inline vec3f vec3_normalize(vec3f v)
+{
+#if SIMD
+    return vec3_store(vec3_normalize_m128(vec3_load(v)));
+#else
+    return vec3_normalize_scalar(v);
 #endif
 }
 
+static inline vec3f vec3_add_scalar(vec3f a, vec3f b)
+{
+    return (vec3f) { a.x + b.x, a.y + b.y, a.z + b.z };
+}
+
 static inline vec3f vec3_add(vec3f a, vec3f b)
 {
 #if SIMD
-    return _mm_add_ps(a, b);
+    return vec3_store(_mm_add_ps(vec3_load(a), vec3_load(b)));
 #else
-    return (vec3f) { a.x + b.x, a.y + b.y, a.z + b.z };
+    return vec3_add_scalar(a, b);
 #endif
 }
 
+static inline vec3f vec3_sub_scalar(vec3f a, vec3f b)
+{
+    return (vec3f) { a.x - b.x, a.y - b.y, a.z - b.z };
+}
+
 static inline vec3f vec3_sub(vec3f a, vec3f b)
 {
 #if SIMD
-    return _mm_sub_ps(a, b);
+    return vec3_store(_mm_sub_ps(vec3_load(a), vec3_load(b)));
 #else
-    return (vec3f) { a.x - b.x, a.y - b.y, a.z - b.z };
+    return vec3_sub_scalar(a, b);
 #endif
 }
 
@@ -263,20 +361,25 @@ static inline mat4f perspective(f32 fovy, f32 aspect, f32 nearVal, f32 farVal)
     return result;
 }
 
+static inline vec3f vec3_crossn_scalar(vec3f a, vec3f b)
+{
+	return vec3_normalize_scalar(vec3_cross_scalar(a, b));
+}
+
 static inline vec3f vec3_crossn(vec3f a, vec3f b)
 {
     vec3f result = vec3_cross(a, b);
 	return vec3_normalize(result);
 }
 
-static inline mat4f lookat(vec3f eye, vec3f center, vec3f up)
+static inline mat4f lookat_scalar(vec3f eye, vec3f center, vec3f up)
 {
     mat4f result;
-	vec3f f = vec3_sub(center, eye);
-	f = vec3_normalize(f);
+	vec3f f = vec3_sub_scalar(center, eye);
+	f = vec3_normalize_scalar(f);
 
-	vec3f s = vec3_crossn(f, up);
-    vec3f u = vec3_cross(s, f);
+	vec3f s = vec3_crossn_scalar(f, up);
+    vec3f u = vec3_cross_scalar(s, f);
 	result.row[0].v[0] = s.v[0];
 	result.row[0].v[1] = u.v[0];
 	result.row[0].v[2] = -f.v[0];
@@ -286,75 +389,127 @@ static inline mat4f lookat(vec3f eye, vec3f center, vec3f up)
 	result.row[2].v[0] = s.v[2];
 	result.row[2].v[1] = u.v[2];
 	result.row[2].v[2] = -f.v[2];
-	result.row[3].v[0] = -vec3_dot(s, eye);
-	result.row[3].v[1] = -vec3_dot(u, eye);
-	result.row[3].v[2] = vec3_dot(f, eye);
+	result.row[3].v[0] = -vec3_dot_scalar(s, eye);
+	result.row[3].v[1] = -vec3_dot_scalar(u, eye);
+	result.row[3].v[2] = vec3_dot_scalar(f, eye);
 	result.row[0].v[3] = result.row[1].v[3] = result.row[2].v[3] = 0.0f;
 	result.row[3].v[3] = 1.0f;
 
     return result;
 }
 
-static inline vec4f vec4_scale(vec4f a, f32 s)
+static inline mat4f lookat(vec3f eye, vec3f center, vec3f up)
 {
 #if SIMD
-    vec4f scalar_vector = { s, s, s, s };
-    return _mm_mul_ps(a, scalar_vector);
+    __m128 e = vec3_load(eye);
+    __m128 f = vec3_normalize_m128(_mm_sub_ps(vec3_load(center), e));
+    __m128 s = vec3_normalize_m128(vec3_cross_m128(f, vec3_load(up)));
+    __m128 u = vec3_cross_m128(s, f);
+
+    f32 s_dot_eye = _mm_cvtss_f32(vec3_dot_m128(s, e));
+    f32 u_dot_eye = _mm_cvtss_f32(vec3_dot_m128(u, e));
+    f32 f_dot_eye = _mm_cvtss_f32(vec3_dot_m128(f, e));
+
+    // Negate by flipping the sign bit, like the scalar unary minus does (0 - x would turn -0 into +0)
+    __m128 negative_f = _mm_xor_ps(f, _mm_set1_ps(-0.0f));
+    __m128 w = _mm_setzero_ps();
+    // The rows s, u, -f become the first three columns; their w lanes are zero
+    _MM_TRANSPOSE4_PS(s, u, negative_f, w);
+
+    mat4f result;
+    result.row[0].m = s;
+    result.row[1].m = u;
+    result.row[2].m = negative_f;
+    result.row[3].m = _mm_set_ps(1.0f, f_dot_eye, -u_dot_eye, -s_dot_eye);
+
+    return result;
 #else
+    return lookat_scalar(eye, center, up);
+#endif
+}
+
+static inline vec4f vec4_scale_scalar(vec4f a, f32 s)
+{
     vec4f dest;
 	dest.v[0] = a.v[0] * s;
 	dest.v[1] = a.v[1] * s;
 	dest.v[2] = a.v[2] * s;
 	dest.v[3] = a.v[3] * s;
     return dest;
-#endif
 }
 
-static inline vec4f vec4_add(vec4f a, vec4f b)
+static inline vec4f vec4_scale(vec4f a, f32 s)
 {
 #if SIMD
-    return _mm_add_ps(a, b);
+    return (vec4f) { .m = _mm_mul_ps(a.m, _mm_set1_ps(s)) };
 #else
+    return vec4_scale_scalar(a, s);
+#endif
+}
+
+static inline vec4f vec4_add_scalar(vec4f a, vec4f b)
+{
     vec4f result;
 	result.v[0] = a.v[0] + b.v[0];
 	result.v[1] = a.v[1] + b.v[1];
 	result.v[2] = a.v[2] + b.v[2];
 	result.v[3] = a.v[3] + b.v[3];
     return result;
-#endif
 }
 
-static inline mat4f translate(mat4f m, vec3f v)
+static inline vec4f vec4_add(vec4f a, vec4f b)
 {
-#if 0
-	glmm_store(m[3],
-		_mm_add_ps(_mm_add_ps(_mm_mul_ps(glmm_load(m[0]),
-			_mm_set1_ps(v[0])),
-			_mm_mul_ps(glmm_load(m[1]),
-				_mm_set1_ps(v[1]))),
-			_mm_add_ps(_mm_mul_ps(glmm_load(m[2]),
-				_mm_set1_ps(v[2])),
-				glmm_load(m[3]))))
-		;
+#if SIMD
+    return (vec4f) { .m = _mm_add_ps(a.m, b.m) };
 #else
-	vec4f v1 = vec4_scale(m.row[0], v.x);
-	vec4f v2 = vec4_scale(m.row[1], v.y);
-	vec4f v3 = vec4_scale(m.row[2], v.z);
+    return vec4_add_scalar(a, b);
+#endif
+}
+
+static inline mat4f translate_scalar(mat4f m, vec3f v)
+{
+	vec4f v1 = vec4_scale_scalar(m.row[0], v.x);
+	vec4f v2 = vec4_scale_scalar(m.row[1], v.y);
+	vec4f v3 = vec4_scale_scalar(m.row[2], v.z);
+
+    m.row[3] = vec4_add_scalar(v1, m.row[3]);
+    m.row[3] = vec4_add_scalar(v2, m.row[3]);
+    m.row[3] = vec4_add_scalar(v3, m.row[3]);
 
-    m.row[3] = vec4_add(v1, m.row[3]);
-    m.row[3] = vec4_add(v2, m.row[3]);
-    m.row[3] = vec4_add(v3, m.row[3]);
+    return m;
+}
+
+static inline mat4f translate(mat4f m, vec3f v)
+{
+#if SIMD
+    __m128 column = m.row[3].m;
+    column = _mm_add_ps(_mm_mul_ps(m.row[0].m, _mm_set1_ps(v.x)), column);
+    column = _mm_add_ps(_mm_mul_ps(m.row[1].m, _mm_set1_ps(v.y)), column);
+    column = _mm_add_ps(_mm_mul_ps(m.row[2].m, _mm_set1_ps(v.z)), column);
+    m.row[3].m = column;
 
     return m;
+#else
+    return translate_scalar(m, v);
 #endif
 }
 
+static inline vec3f vec3_normalize_to_scalar(vec3f v)
+{
+	f32 norm = vec3_norm_scalar(v);
+	if (norm == 0.0f)
+	{
+        return (vec3f) { 0.0f, 0.0f, 0.0f };
+	}
+
+    return vec3_scale_scalar(v, 1.0f / norm);
+}
+
 static inline vec3f vec3_normalize_to(vec3f v)
 {
 	f32 norm = vec3_norm(v);
 	if (norm == 0.0f)
 	{
-		
         return (vec3f) { 0.0f, 0.0f, 0.0f };
 	}
 
@@ -362,18 +517,18 @@ static inline vec3f vec3_normalize_to(vec3f v)
     return result;
 }
 
-static inline mat4f rotate_make(f32 angle, vec3f axis)
+static inline mat4f rotate_make_scalar(f32 angle, vec3f axis)
 {
 	f32 c = cosf(angle);
 
-    vec3f axisn = vec3_normalize_to(axis);
-    vec3f v = vec3_scale(axisn, 1.0f - c);
-    vec3f vs = vec3_scale(axisn, sinf(angle));
+    vec3f axisn = vec3_normalize_to_scalar(axis);
+    vec3f v = vec3_scale_scalar(axisn, 1.0f - c);
+    vec3f vs = vec3_scale_scalar(axisn, sinf(angle));
 
     mat4f m;
-	m.row[0] = vec4f_cast(vec3_scale(axisn, v.x));
-	m.row[1] = vec4f_cast(vec3_scale(axisn, v.y));
-	m.row[2] = vec4f_cast(vec3_scale(axisn, v.z));
+	m.row[0] = vec4f_cast(vec3_scale_scalar(axisn, v.x));
+	m.row[1] = vec4f_cast(vec3_scale_scalar(axisn, v.y));
+	m.row[2] = vec4f_cast(vec3_scale_scalar(axisn, v.z));
 
 	m.row[0].v[0] += c;       m.row[1].v[0] -= vs.v[2];   m.row[2].v[0] += vs.v[1];
 	m.row[0].v[1] += vs.v[2];   m.row[1].v[1] += c;       m.row[2].v[1] -= vs.v[0];
@@ -385,51 +540,31 @@ static inline mat4f rotate_make(f32 angle, vec3f axis)
     return m;
 }
 
-static inline mat4f mul_rot(mat4f m1, mat4f m2)
+static inline mat4f rotate_make(f32 angle, vec3f axis)
 {
 #if SIMD
-    mat4f result;
-   
-    f32 m2_00 = m2.row[0][0];
-    f32 m2_01 = m2.row[0][1];
-    f32 m2_02 = m2.row[0][2];
-    vec4f m2_00_v = { m2_00, m2_00, m2_00, m2_00 };
-    vec4f m2_01_v = { m2_01, m2_01, m2_01, m2_01 };
-    vec4f m2_02_v = { m2_02, m2_02, m2_02, m2_02 };
-    vec4f first_row_first_mul = _mm_mul_ps(m1.row[0], m2_00_v);
-    vec4f first_row_second_mul = _mm_mul_ps(m1.row[1], m2_01_v);
-    vec4f first_row_third_mul = _mm_mul_ps(m1.row[2], m2_02_v);
-
-    result.row[0] = _mm_add_ps(_mm_add_ps(first_row_first_mul, first_row_second_mul), first_row_third_mul);
-
-    f32 m2_10 = m2.row[1][0];
-    f32 m2_11 = m2.row[1][1];
-    f32 m2_12 = m2.row[1][2];
-    vec4f m2_10_v = { m2_10, m2_10, m2_10, m2_10 };
-    vec4f m2_11_v = { m2_11, m2_11, m2_11, m2_11 };
-    vec4f m2_12_v = { m2_12, m2_12, m2_12, m2_12 };
-    vec4f second_row_first_mul = _mm_mul_ps(m1.row[0], m2_10_v);
-    vec4f second_row_second_mul = _mm_mul_ps(m1.row[1], m2_11_v);
-    vec4f second_row_third_mul = _mm_mul_ps(m1.row[2], m2_12_v);
-
-    result.row[1] = _mm_add_ps(_mm_add_ps(second_row_first_mul, second_row_second_mul), second_row_third_mul);
-
-    f32 m2_20 = m2.row[2][0];
-    f32 m2_21 = m2.row[2][1];
-    f32 m2_22 = m2.row[2][2];
-    vec4f m2_20_v = { m2_20, m2_20, m2_20, m2_20 };
-    vec4f m2_21_v = { m2_21, m2_21, m2_21, m2_21 };
-    vec4f m2_22_v = { m2_22, m2_22, m2_22, m2_22 };
-    vec4f third_row_first_mul = _mm_mul_ps(m1.row[0], m2_20_v);
-    vec4f third_row_second_mul = _mm_mul_ps(m1.row[1], m2_21_v);
-    vec4f third_row_third_mul = _mm_mul_ps(m1.row[2], m2_22_v);
-
-    result.row[2] = _mm_add_ps(_mm_add_ps(third_row_first_mul, third_row_second_mul), third_row_third_mul);
+	f32 c = cosf(angle);
 
-    result.row[3] = m1.row[3];
+    vec3f axisn = vec3_normalize_to(axis);
+    vec3f vs = vec3_scale(axisn, sinf(angle));
+    __m128 a = vec3_load(axisn);
+    __m128 v = _mm_mul_ps(a, _mm_set1_ps(1.0f - c));
 
-    return result;
+    // Column i is axisn * v[i] plus the i-th column of c * I + skew(vs); x - y is exactly x + (-y)
+    mat4f m;
+    m.row[0].m = _mm_add_ps(_mm_mul_ps(a, M128_SPLAT(v, 0)), _mm_set_ps(0.0f, -vs.y, vs.z, c));
+    m.row[1].m = _mm_add_ps(_mm_mul_ps(a, M128_SPLAT(v, 1)), _mm_set_ps(0.0f, vs.x, c, -vs.z));
+    m.row[2].m = _mm_add_ps(_mm_mul_ps(a, M128_SPLAT(v, 2)), _mm_set_ps(0.0f, c, -vs.x, vs.y));
+    m.row[3].m = _mm_set_ps(1.0f, 0.0f, 0.0f, 0.0f);
+
+    return m;
 #else
+    return rotate_make_scalar(angle, axis);
+#endif
+}
+
+static inline mat4f mul_rot_scalar(mat4f m1, mat4f m2)
+{
 	f32 a00 = m1.row[0].v[0], a01 = m1.row[0].v[1], a02 = m1.row[0].v[2], a03 = m1.row[0].v[3],
 		a10 = m1.row[1].v[0], a11 = m1.row[1].v[1], a12 = m1.row[1].v[2], a13 = m1.row[1].v[3],
 		a20 = m1.row[2].v[0], a21 = m1.row[2].v[1], a22 = m1.row[2].v[2], a23 = m1.row[2].v[3],
@@ -461,8 +596,25 @@ static inline mat4f mul_rot(mat4f m1, mat4f m2)
 	dest.row[3].v[3] = a33;
 
 	return dest;
+}
+
+static inline mat4f mul_rot(mat4f m1, mat4f m2)
+{
+#if SIMD
+    __m128 a0 = m1.row[0].m, a1 = m1.row[1].m, a2 = m1.row[2].m;
+
+    mat4f result;
+    result.row[0].m = mat3_combine_m128(a0, a1, a2, m2.row[0].m);
+    result.row[1].m = mat3_combine_m128(a0, a1, a2, m2.row[1].m);
+    result.row[2].m = mat3_combine_m128(a0, a1, a2, m2.row[2].m);
+    result.row[3] = m1.row[3];
+
+    return result;
+#else
+    return mul_rot_scalar(m1, m2);
 #endif
 }
+
 static inline mat4f scale_to(mat4f m, vec3f v)
 {
     mat4f result;
@@ -479,6 +631,12 @@ static inline mat4f scale(mat4f m, vec3f v)
     return scale_to(m, v);
 }
 
+static inline mat4f rotate_scalar(mat4f m, f32 angle, vec3f axis)
+{
+	mat4f rot = rotate_make_scalar(angle, axis);
+    return mul_rot_scalar(m, rot);
+}
+
 static inline mat4f rotate(mat4f m, f32 angle, vec3f axis)
 {
 	mat4f rot = rotate_make(angle, axis);
@@ -489,38 +647,24 @@ static inline mat4f rotate(mat4f m, f32 angle, vec3f axis)
 static inline vec4f dot_4wide(vec4f ax, vec4f ay, vec4f az, vec4f aw, vec4f bx, vec4f by, vec4f bz, vec4f bw)
 {
 #if SIMD
-    vec4f dx = _mm_mul_ps(ax, bx);
-    vec4f dy = _mm_mul_ps(ay, by);
-    vec4f dz = _mm_mul_ps(az, bz);
-    vec4f dw = _mm_mul_ps(aw, bw);
+    __m128 dx = _mm_mul_ps(ax.m, bx.m);
+    __m128 dy = _mm_mul_ps(ay.m, by.m);
+    __m128 dz = _mm_mul_ps(az.m, bz.m);
+    __m128 dw = _mm_mul_ps(aw.m, bw.m);
 
-    return _mm_add_ps(_mm_add_ps(dx, dy), _mm_add_ps(dz, dw));
+    return (vec4f) { .m = _mm_add_ps(_mm_add_ps(dx, dy), _mm_add_ps(dz, dw)) };
 #else
-#endif
-}
-
-// Refactor data
-static inline mat4f mat4f_mul(mat4f a, mat4f b)
-{
-#if SIMD
-    mat4f result;
+    vec4f result;
     for (s32 i = 0; i < 4; i++)
     {
-		vec4f bx = _mm_set_ps(b.row[0][0], b.row[1][0], b.row[2][0], b.row[3][0]);
-		vec4f by = _mm_set_ps(b.row[0][1], b.row[1][1], b.row[2][1], b.row[3][1]);
-		vec4f bz = _mm_set_ps(b.row[0][2], b.row[1][2], b.row[2][2], b.row[3][2]);
-		vec4f bw = _mm_set_ps(b.row[0][3], b.row[1][3], b.row[2][3], b.row[3][3]);
-
-		vec4f dx = _mm_mul_ps(a.row[i], bx);
-		vec4f dy = _mm_mul_ps(a.row[i], by);
-		vec4f dz = _mm_mul_ps(a.row[i], bz);
-		vec4f dw = _mm_mul_ps(a.row[i], bw);
-
-		result.row[i] = _mm_add_ps(_mm_add_ps(dx, dy), _mm_add_ps(dz, dw));
+        result.v[i] = (ax.v[i] * bx.v[i] + ay.v[i] * by.v[i]) + (az.v[i] * bz.v[i] + aw.v[i] * bw.v[i]);
     }
-
     return result;
-#else
+#endif
+}
+
+static inline mat4f mat4f_mul_scalar(mat4f a, mat4f b)
+{
     mat4f dest;
 	f32 a00 = a.row[0].v[0], a01 = a.row[0].v[1], a02 = a.row[0].v[2], a03 = a.row[0].v[3],
 		a10 = a.row[1].v[0], a11 = a.row[1].v[1], a12 = a.row[1].v[2], a13 = a.row[1].v[3],
@@ -550,19 +694,367 @@ static inline mat4f mat4f_mul(mat4f a, mat4f b)
     dest.row[3].v[3] = a03 * b30 + a13 * b31 + a23 * b32 + a33 * b33;
 
     return dest;
-#endif
 }
 
-void mat4f_print(mat4f m)
+// Column i of a * b is a's columns weighted by column i of b, summed left to right like the scalar version
+static inline mat4f mat4f_mul(mat4f a, mat4f b)
 {
 #if SIMD
-    RED_NOT_IMPLEMENTED;
+    __m128 a0 = a.row[0].m, a1 = a.row[1].m, a2 = a.row[2].m, a3 = a.row[3].m;
+
+    mat4f result;
+    result.row[0].m = mat4_combine_m128(a0, a1, a2, a3, b.row[0].m);
+    result.row[1].m = mat4_combine_m128(a0, a1, a2, a3, b.row[1].m);
+    result.row[2].m = mat4_combine_m128(a0, a1, a2, a3, b.row[2].m);
+    result.row[3].m = mat4_combine_m128(a0, a1, a2, a3, b.row[3].m);
+
+    return result;
 #else
+    return mat4f_mul_scalar(a, b);
+#endif
+}
+
+static inline void mat4f_print(mat4f m)
+{
     print("Printing matrix:\n");
     print("Row 0: [ %f, %f, %f, %f ]\n", m.r0.x, m.r0.y, m.r0.z, m.r0.w);
     print("Row 1: [ %f, %f, %f, %f ]\n", m.r1.x, m.r1.y, m.r1.z, m.r1.w);
     print("Row 2: [ %f, %f, %f, %f ]\n", m.r2.x, m.r2.y, m.r2.z, m.r2.w);
     print("Row 3: [ %f, %f, %f, %f ]\n", m.r3.x, m.r3.y, m.r3.z, m.r3.w);
     print("\n");
+}
+
+// [0, 1] to the nearest of the 2^bits UNORM steps, as the vertex fetch reads them back
+static inline u32 quantize_unorm(f32 v, u32 bits)
+{
+    const f32 scale = (f32)((1u << bits) - 1);
+    v = v < 0.0f ? 0.0f : (v > 1.0f ? 1.0f : v);
+    return (u32)(v * scale + 0.5f);
+}
+
+// [-1, 1] to the nearest SNORM step; -1 gets the step that decodes to -1, not the one below it
+static inline s32 quantize_snorm(f32 v, u32 bits)
+{
+    const f32 scale = (f32)((1u << (bits - 1)) - 1);
+    v = v < -1.0f ? -1.0f : (v > 1.0f ? 1.0f : v);
+    return (s32)(v * scale + (v >= 0.0f ? 0.5f : -0.5f));
+}
+
+// Folds the unit sphere onto the octahedron, then the lower half over the upper one: two components in [-1, 1]
+static inline void octahedral_encode(vec3f n, f32 encoded[2])
+{
+    f32 length = abs_T(n.x) + abs_T(n.y) + abs_T(n.z);
+    if (length == 0.0f)
+    {
+        // Decodes to +Z
+        encoded[0] = 0.0f;
+        encoded[1] = 0.0f;
+        return;
+    }
+
+    f32 x = n.x / length;
+    f32 y = n.y / length;
+    if (n.z < 0.0f)
+    {
+        f32 folded_x = (1.0f - abs_T(y)) * (x >= 0.0f ? 1.0f : -1.0f);
+        f32 folded_y = (1.0f - abs_T(x)) * (y >= 0.0f ? 1.0f : -1.0f);
+        x = folded_x;
+        y = folded_y;
+    }
+    encoded[0] = x;
+    encoded[1] = y;
+}
+
+// T(position) * R(rotation) * S(scale), with rotation a unit quaternion (x, y, z, w)
+static inline mat4f transform_compose(vec3f position, vec4f rotation, vec3f scale)
+{
+    f32 x = rotation.x, y = rotation.y, z = rotation.z, w = rotation.w;
+    f32 xx = x * x, yy = y * y, zz = z * z;
+    f32 xy = x * y, xz = x * z, yz = y * z;
+    f32 wx = w * x, wy = w * y, wz = w * z;
+
+    mat4f m;
+    m.row[0].v[0] = (1.0f - 2.0f * (yy + zz)) * scale.x;
+    m.row[0].v[1] = (2.0f * (xy + wz)) * scale.x;
+    m.row[0].v[2] = (2.0f * (xz - wy)) * scale.x;
+    m.row[0].v[3] = 0.0f;
+    m.row[1].v[0] = (2.0f * (xy - wz)) * scale.y;
+    m.row[1].v[1] = (1.0f - 2.0f * (xx + zz)) * scale.y;
+    m.row[1].v[2] = (2.0f * (yz + wx)) * scale.y;
+    m.row[1].v[3] = 0.0f;
+    m.row[2].v[0] = (2.0f * (xz + wy)) * scale.z;
+    m.row[2].v[1] = (2.0f * (yz - wx)) * scale.z;
+    m.row[2].v[2] = (1.0f - 2.0f * (xx + yy)) * scale.z;
+    m.row[2].v[3] = 0.0f;
+    m.row[3].v[0] = position.x;
+    m.row[3].v[1] = position.y;
+    m.row[3].v[2] = position.z;
+    m.row[3].v[3] = 1.0f;
+
+    return m;
+}
+
+/*
+ * Structure-of-arrays transforms: one array per component so the batch kernels load BATCH_LANE_COUNT objects with a
+ * single instruction per component.
+ */
+typedef struct TransformBatch
+{
+    f32* position_x;
+    f32* position_y;
+    f32* position_z;
+    f32* rotation_x;
+    f32* rotation_y;
+    f32* rotation_z;
+    f32* rotation_w;
+    f32* scale_x;
+    f32* scale_y;
+    f32* scale_z;
+    u32 count;
+} TransformBatch;
+
+#define TRANSFORM_BATCH_COMPONENT_COUNT (10)
+
+// Every component array comes out of one allocation and starts at identity
+static inline void TransformBatch_init(TransformBatch* transforms, u32 count)
+{
+    f32* components = NEW(f32, (usize)count * TRANSFORM_BATCH_COMPONENT_COUNT);
+    memset(components, 0, (usize)count * TRANSFORM_BATCH_COMPONENT_COUNT * sizeof(f32));
+    *transforms = (TransformBatch)
+    {
+        .position_x = components,
+        .position_y = components + (usize)count,
+        .position_z = components + (usize)count * 2,
+        .rotation_x = components + (usize)count * 3,
+        .rotation_y = components + (usize)count * 4,
+        .rotation_z = components + (usize)count * 5,
+        .rotation_w = components + (usize)count * 6,
+        .scale_x = components + (usize)count * 7,
+        .scale_y = components + (usize)count * 8,
+        .scale_z = components + (usize)count * 9,
+        .count = count,
+    };
+
+    for (u32 i = 0; i < count; i++)
+    {
+        transforms->rotation_w[i] = 1.0f;
+        transforms->scale_x[i] = 1.0f;
+        transforms->scale_y[i] = 1.0f;
+        transforms->scale_z[i] = 1.0f;
+    }
+}
+
+static inline void TransformBatch_deinit(TransformBatch* transforms)
+{
+    free_chunk(transforms->position_x);
+    *transforms = (TransformBatch) ZERO_INIT;
+}
+
+#define MAT4F_AT_STRIDE(base, i, stride) ((mat4f*)((u8*)(base) + (usize)(i) * (stride)))
+
+#if BATCH_LANE_COUNT > 1
+// On return rows[j] holds lane j of every input register, in register order
+static inline void transpose8_m256(__m256 rows[8])
+{
+    __m256 t0 = _mm256_unpacklo_ps(rows[0], rows[1]);
+    __m256 t1 = _mm256_unpackhi_ps(rows[0], rows[1]);
+    __m256 t2 = _mm256_unpacklo_ps(rows[2], rows[3]);
+    __m256 t3 = _mm256_unpackhi_ps(rows[2], rows[3]);
+    __m256 t4 = _mm256_unpacklo_ps(rows[4], rows[5]);
+    __m256 t5 = _mm256_unpackhi_ps(rows[4], rows[5]);
+    __m256 t6 = _mm256_unpacklo_ps(rows[6], rows[7]);
+    __m256 t7 = _mm256_unpackhi_ps(rows[6], rows[7]);
+
+    __m256 s0 = _mm256_shuffle_ps(t0, t2, _MM_SHUFFLE(1, 0, 1, 0));
+    __m256 s1 = _mm256_shuffle_ps(t0, t2, _MM_SHUFFLE(3, 2, 3, 2));
+    __m256 s2 = _mm256_shuffle_ps(t1, t3, _MM_SHUFFLE(1, 0, 1, 0));
+    __m256 s3 = _mm256_shuffle_ps(t1, t3, _MM_SHUFFLE(3, 2, 3, 2));
+    __m256 s4 = _mm256_shuffle_ps(t4, t6, _MM_SHUFFLE(1, 0, 1, 0));
+    __m256 s5 = _mm256_shuffle_ps(t4, t6, _MM_SHUFFLE(3, 2, 3, 2));
+    __m256 s6 = _mm256_shuffle_ps(t5, t7, _MM_SHUFFLE(1, 0, 1, 0));
+    __m256 s7 = _mm256_shuffle_ps(t5, t7, _MM_SHUFFLE(3, 2, 3, 2));
+
+    rows[0] = _mm256_permute2f128_ps(s0, s4, 0x20);
+    rows[1] = _mm256_permute2f128_ps(s1, s5, 0x20);
+    rows[2] = _mm256_permute2f128_ps(s2, s6, 0x20);
+    rows[3] = _mm256_permute2f128_ps(s3, s7, 0x20);
+    rows[4] = _mm256_permute2f128_ps(s0, s4, 0x31);
+    rows[5] = _mm256_permute2f128_ps(s1, s5, 0x31);
+    rows[6] = _mm256_permute2f128_ps(s2, s6, 0x31);
+    rows[7] = _mm256_permute2f128_ps(s3, s7, 0x31);
+}
+
+// elements[k] holds matrix element k (column-major) of 8 objects; writes those objects as 8 consecutive strided matrices
+static inline void store8_mat4f(__m256 elements[16], mat4f* world, usize world_stride)
+{
+    transpose8_m256(elements);
+    transpose8_m256(elements + 8);
+    for (u32 lane = 0; lane < 8; lane++)
+    {
+        f32* matrix = MAT4F_AT_STRIDE(world, lane, world_stride)->row[0].v;
+        _mm256_storeu_ps(matrix, elements[lane]);
+        _mm256_storeu_ps(matrix + 8, elements[8 + lane]);
+    }
+}
+
+// The reverse of store8_mat4f: elements[k] receives matrix element k of 8 consecutive strided matrices
+static inline void load8_mat4f(const mat4f* matrices, usize stride, __m256 elements[16])
+{
+    for (u32 lane = 0; lane < 8; lane++)
+    {
+        const f32* matrix = ((const mat4f*)((const u8*)matrices + (usize)lane * stride))->row[0].v;
+        elements[lane] = _mm256_loadu_ps(matrix);
+        elements[8 + lane] = _mm256_loadu_ps(matrix + 8);
+    }
+    transpose8_m256(elements);
+    transpose8_m256(elements + 8);
+}
+#endif
+
+#if BATCH_LANE_COUNT == 16
+typedef __m512 BatchLane;
+#define BATCH_LOAD(p) _mm512_loadu_ps(p)
+#define BATCH_SET1(s) _mm512_set1_ps(s)
+#define BATCH_ADD(a, b) _mm512_add_ps(a, b)
+#define BATCH_SUB(a, b) _mm512_sub_ps(a, b)
+#define BATCH_MUL(a, b) _mm512_mul_ps(a, b)
+#elif BATCH_LANE_COUNT == 8
+typedef __m256 BatchLane;
+#define BATCH_LOAD(p) _mm256_loadu_ps(p)
+#define BATCH_SET1(s) _mm256_set1_ps(s)
+#define BATCH_ADD(a, b) _mm256_add_ps(a, b)
+#define BATCH_SUB(a, b) _mm256_sub_ps(a, b)
+#define BATCH_MUL(a, b) _mm256_mul_ps(a, b)
+#endif
+
+/*
+ * world[i - first] = transform_compose(transforms[i]) for i in [first, first + count). Matrices are written
+ * world_stride bytes apart so they can land straight in a larger per-instance struct. Same operation order as
+ * transform_compose, so every lane layout produces the same bits.
+ */
+static inline void transforms_compose_batch(const TransformBatch* transforms, u32 first, u32 count, mat4f* world, usize world_stride)
+{
+    redassert(first + count <= transforms->count);
+    u32 i = 0;
+#if BATCH_LANE_COUNT > 1
+    for (; i + BATCH_LANE_COUNT <= count; i += BATCH_LANE_COUNT)
+    {
+        u32 index = first + i;
+        BatchLane x = BATCH_LOAD(transforms->rotation_x + index);
+        BatchLane y = BATCH_LOAD(transforms->rotation_y + index);
+        BatchLane z = BATCH_LOAD(transforms->rotation_z + index);
+        BatchLane w = BATCH_LOAD(transforms->rotation_w + index);
+        BatchLane sx = BATCH_LOAD(transforms->scale_x + index);
+        BatchLane sy = BATCH_LOAD(transforms->scale_y + index);
+        BatchLane sz = BATCH_LOAD(transforms->scale_z + index);
+
+        BatchLane xx = BATCH_MUL(x, x), yy = BATCH_MUL(y, y), zz = BATCH_MUL(z, z);
+        BatchLane xy = BATCH_MUL(x, y), xz = BATCH_MUL(x, z), yz = BATCH_MUL(y, z);
+        BatchLane wx = BATCH_MUL(w, x), wy = BATCH_MUL(w, y), wz = BATCH_MUL(w, z);
+        BatchLane one = BATCH_SET1(1.0f), two = BATCH_SET1(2.0f), zero = BATCH_SET1(0.0f);
+
+        BatchLane elements[16] =
+        {
+            BATCH_MUL(BATCH_SUB(one, BATCH_MUL(two, BATCH_ADD(yy, zz))), sx),
+            BATCH_MUL(BATCH_MUL(two, BATCH_ADD(xy, wz)), sx),
+            BATCH_MUL(BATCH_MUL(two, BATCH_SUB(xz, wy)), sx),
+            zero,
+            BATCH_MUL(BATCH_MUL(two, BATCH_SUB(xy, wz)), sy),
+            BATCH_MUL(BATCH_SUB(one, BATCH_MUL(two, BATCH_ADD(xx, zz))), sy),
+            BATCH_MUL(BATCH_MUL(two, BATCH_ADD(yz, wx)), sy),
+            zero,
+            BATCH_MUL(BATCH_MUL(two, BATCH_ADD(xz, wy)), sz),
+            BATCH_MUL(BATCH_MUL(two, BATCH_SUB(yz, wx)), sz),
+            BATCH_MUL(BATCH_SUB(one, BATCH_MUL(two, BATCH_ADD(xx, yy))), sz),
+            zero,
+            BATCH_LOAD(transforms->position_x + index),
+            BATCH_LOAD(transforms->position_y + index),
+            BATCH_LOAD(transforms->position_z + index),
+            one,
+        };
+
+#if BATCH_LANE_COUNT == 16
+        // There is no cheap 16x16 transpose, so each half goes through the AVX2 one
+        __m256 low[16], high[16];
+        for (u32 k = 0; k < 16; k++)
+        {
+            low[k] = _mm512_castps512_ps256(elements[k]);
+            high[k] = _mm256_castpd_ps(_mm512_extractf64x4_pd(_mm512_castps_pd(elements[k]), 1));
+        }
+        store8_mat4f(low, MAT4F_AT_STRIDE(world, i, world_stride), world_stride);
+        store8_mat4f(high, MAT4F_AT_STRIDE(world, i + 8, world_stride), world_stride);
+#else
+        store8_mat4f(elements, MAT4F_AT_STRIDE(world, i, world_stride), world_stride);
+#endif
+    }
 #endif
+    for (; i < count; i++)
+    {
+        u32 index = first + i;
+        vec3f position = { transforms->position_x[index], transforms->position_y[index], transforms->position_z[index] };
+        vec4f rotation = { transforms->rotation_x[index], transforms->rotation_y[index], transforms->rotation_z[index], transforms->rotation_w[index] };
+        vec3f scale = { transforms->scale_x[index], transforms->scale_y[index], transforms->scale_z[index] };
+        *MAT4F_AT_STRIDE(world, i, world_stride) = transform_compose(position, rotation, scale);
+    }
+}
+
+/*
+ * result[i] = left * right[i]. BATCH_LANE_COUNT matrices at a time are transposed into one register per element, each
+ * output element is four products with broadcast elements of left, and the results are transposed back. Every element
+ * sums its products in mat4f_mul's order, so the results are bit-identical to it.
+ */
+static inline void mat4_mul_batch(mat4f left, const mat4f* right, u32 count, mat4f* result)
+{
+    u32 i = 0;
+#if BATCH_LANE_COUNT > 1
+    BatchLane l[16];
+    for (u32 k = 0; k < 16; k++)
+    {
+        l[k] = BATCH_SET1(left.row[k / 4].v[k % 4]);
+    }
+
+    for (; i + BATCH_LANE_COUNT <= count; i += BATCH_LANE_COUNT)
+    {
+        BatchLane r[16];
+#if BATCH_LANE_COUNT == 16
+        __m256 low[16], high[16];
+        load8_mat4f(right + i, sizeof(mat4f), low);
+        load8_mat4f(right + i + 8, sizeof(mat4f), high);
+        for (u32 k = 0; k < 16; k++)
+        {
+            r[k] = _mm512_castpd_ps(_mm512_insertf64x4(_mm512_castps_pd(_mm512_castps256_ps512(low[k])), _mm256_castps_pd(high[k]), 1));
+        }
+#else
+        load8_mat4f(right + i, sizeof(mat4f), r);
+#endif
+
+        BatchLane elements[16];
+        for (u32 column = 0; column < 4; column++)
+        {
+            const BatchLane* weights = &r[column * 4];
+            for (u32 k = 0; k < 4; k++)
+            {
+                BatchLane sum = BATCH_ADD(BATCH_MUL(l[k], weights[0]), BATCH_MUL(l[4 + k], weights[1]));
+                sum = BATCH_ADD(sum, BATCH_MUL(l[8 + k], weights[2]));
+                elements[column * 4 + k] = BATCH_ADD(sum, BATCH_MUL(l[12 + k], weights[3]));
+            }
+        }
+
+#if BATCH_LANE_COUNT == 16
+        for (u32 k = 0; k < 16; k++)
+        {
+            low[k] = _mm512_castps512_ps256(elements[k]);
+            high[k] = _mm256_castpd_ps(_mm512_extractf64x4_pd(_mm512_castps_pd(elements[k]), 1));
+        }
+        store8_mat4f(low, &result[i], sizeof(mat4f));
+        store8_mat4f(high, &result[i + 8], sizeof(mat4f));
+#else
+        store8_mat4f(elements, &result[i], sizeof(mat4f));
+#endif
+    }
+#endif
+    for (; i < count; i++)
+    {
+        result[i] = mat4f_mul(left, right[i]);
+    }
 }
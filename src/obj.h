@@ -0,0 +1,580 @@
+#pragma once
+
+#include "types.h"
+#include "os.h"
+#include "maths.h"
+#include <math.h>
+#include <string.h>
+
+/*
+ * Wavefront OBJ parser. The file is mapped and cut at line boundaries into chunks that the job system parses in
+ * parallel. A first pass counts the elements of every chunk; their prefix sums give each chunk the place its
+ * elements take in the merged arrays and the number of elements declared before it, which is what relative
+ * (negative) indices count back from. The second pass parses every chunk straight into the merged arrays.
+ * Only v, vt, vn and f lines are read; everything else is skipped.
+ */
+
+// Indices into the ObjFile attribute arrays. 0 means the corner has no such attribute
+typedef struct ObjIndex
+{
+    u32 p;
+    u32 t;
+    u32 n;
+} ObjIndex;
+
+// Laid out like fast_obj's mesh: element 0 of every attribute array is a dummy, so OBJ's 1-based indices are used as is
+typedef struct ObjFile
+{
+    f32* positions; /* 3 per position */
+    f32* texcoords; /* 2 per texcoord */
+    f32* normals; /* 3 per normal */
+    u32 position_count; /* dummy included */
+    u32 texcoord_count;
+    u32 normal_count;
+
+    u32* face_vertices;
+    u32 face_count;
+    ObjIndex* indices;
+    u32 index_count;
+} ObjFile;
+
+#define OBJ_MIN_CHUNK_SIZE KILOBYTE(64)
+#define OBJ_CHUNKS_PER_THREAD (4)
+// Digits kept in the 64-bit mantissa; anything past them is beyond what a float resolves anyway
+#define OBJ_MAX_MANTISSA_DIGITS (18)
+
+typedef struct ObjChunk
+{
+    const char* start;
+    const char* end;
+    // Counted by the first pass, then turned into offsets into the merged arrays by the prefix sum
+    u32 position_count;
+    u32 texcoord_count;
+    u32 normal_count;
+    u32 face_count;
+    u32 index_count;
+    u32 first_position;
+    u32 first_texcoord;
+    u32 first_normal;
+    u32 first_face;
+    u32 first_index;
+} ObjChunk;
+
+typedef struct ObjParse
+{
+    ObjChunk* chunks;
+    ObjFile* obj;
+} ObjParse;
+
+typedef enum ObjLineType
+{
+    OBJ_LINE_OTHER,
+    OBJ_LINE_POSITION,
+    OBJ_LINE_TEXCOORD,
+    OBJ_LINE_NORMAL,
+    OBJ_LINE_FACE,
+} ObjLineType;
+
+static const u64 obj_powers_of_ten_u64[] =
+{
+    1ull, 10ull, 100ull, 1000ull, 10000ull, 100000ull, 1000000ull, 10000000ull, 100000000ull,
+};
+
+// Every one of them is exact in a double, so scaling a mantissa below 2^53 by one of them rounds only once
+static const f64 obj_powers_of_ten_f64[] =
+{
+    1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+    1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22,
+};
+
+static inline bool obj_is_blank(char c)
+{
+    return c == ' ' || c == '\t' || c == '\r';
+}
+
+static inline bool obj_is_digit(char c)
+{
+    return (u8)(c - '0') < 10;
+}
+
+static inline const char* obj_skip_blanks(const char* p, const char* end)
+{
+    while (p < end && obj_is_blank(*p))
+    {
+        p++;
+    }
+    return p;
+}
+
+static inline const char* obj_skip_line(const char* p, const char* end)
+{
+    const char* newline = (const char*)memchr(p, '\n', (usize)(end - p));
+    return newline ? newline + 1 : end;
+}
+
+// Number of decimal digits starting at p, up to 16 at a time
+static inline u32 obj_digit_run(const char* p, const char* end)
+{
+#if SIMD
+    if (end - p >= 16)
+    {
+        // Bytes below '0' wrap to negative and bytes above '9' compare greater than 9, both as signed bytes
+        __m128i digits = _mm_sub_epi8(_mm_loadu_si128((const __m128i*)p), _mm_set1_epi8('0'));
+        __m128i non_digits = _mm_or_si128(_mm_cmplt_epi8(digits, _mm_setzero_si128()), _mm_cmpgt_epi8(digits, _mm_set1_epi8(9)));
+        u32 mask = (u32)_mm_movemask_epi8(non_digits) | 0x10000u;
+#ifdef RED_OS_WINDOWS
+        unsigned long index;
+        _BitScanForward(&index, mask);
+        return (u32)index;
+#else
+        return (u32)__builtin_ctz(mask);
+#endif
+    }
+#endif
+    u32 count = 0;
+    while (p + count < end && count < 16 && obj_is_digit(p[count]))
+    {
+        count++;
+    }
+    return count;
+}
+
+// Value of the count (0 to 8) digits at p. With 8 readable bytes they are combined in a single register (SWAR), two digits per step
+static inline u64 obj_parse_digits(const char* p, const char* end, u32 count)
+{
+    redassert(count <= 8);
+    if (end - p >= 8)
+    {
+        u64 chunk;
+        memcpy(&chunk, p, sizeof(chunk));
+        // The first digit sits in the lowest byte; shifting the unused bytes out leaves leading zeros in their place.
+        // The shift is split in two so that no digits at all shifts by 64 without being undefined
+        u32 shift = 4 * (8 - count);
+        chunk = ((chunk & 0x0F0F0F0F0F0F0F0Full) << shift) << shift;
+        chunk = (chunk * 2561) >> 8;
+        chunk = ((chunk & 0x00FF00FF00FF00FFull) * 6553601) >> 16;
+        chunk = ((chunk & 0x0000FFFF0000FFFFull) * 42949672960001ull) >> 32;
+        return chunk;
+    }
+
+    u64 value = 0;
+    for (u32 i = 0; i < count; i++)
+    {
+        value = value * 10 + (u64)(p[i] - '0');
+    }
+    return value;
+}
+
+// Appends a run of digits to the mantissa. Digits past OBJ_MAX_MANTISSA_DIGITS are dropped, which integer digits make up for in the exponent
+static inline const char* obj_accumulate_digits(const char* p, const char* end, bool fraction, u64* mantissa, u32* mantissa_digits, s32* exponent)
+{
+    // Leading zeros are not significant, so they do not use up the mantissa
+    if (*mantissa == 0)
+    {
+        while (p < end && *p == '0')
+        {
+            *exponent -= fraction;
+            p++;
+        }
+    }
+
+    for (u32 run; (run = obj_digit_run(p, end)) != 0;)
+    {
+        while (run)
+        {
+            u32 count = MIN(run, 8);
+            u32 kept = MIN(count, OBJ_MAX_MANTISSA_DIGITS - *mantissa_digits);
+            if (kept)
+            {
+                *mantissa = *mantissa * obj_powers_of_ten_u64[kept] + obj_parse_digits(p, end, kept);
+                *mantissa_digits += kept;
+                *exponent -= fraction ? (s32)kept : 0;
+            }
+            *exponent += fraction ? 0 : (s32)(count - kept);
+            p += count;
+            run -= count;
+        }
+    }
+
+    return p;
+}
+
+static inline f32 obj_parse_float(const char** cursor, const char* end)
+{
+    const char* p = obj_skip_blanks(*cursor, end);
+    bool negative = false;
+    if (p < end && (*p == '-' || *p == '+'))
+    {
+        negative = *p == '-';
+        p++;
+    }
+
+    // Fast path for what exporters write: at most 8 digits on either side of the point and no exponent. Each side is
+    // one digit run and one SWAR conversion, with none of the per-digit branches of the general path below
+    // The integer digits are checked first: with at most 8 of them, the point and a 16 digit fraction run still end
+    // within the 32 bytes known to be readable
+    u32 integer_digits = end - p >= 32 ? obj_digit_run(p, end) : UINT32_MAX;
+    if (integer_digits <= 8)
+    {
+        const char* q = p + integer_digits;
+        u32 fraction_digits = *q == '.' ? obj_digit_run(q + 1, end) : 0;
+        const char* last = *q == '.' ? q + 1 + fraction_digits : q;
+        if (fraction_digits <= 8 && *last != 'e' && *last != 'E')
+        {
+            u64 mantissa = obj_parse_digits(p, end, integer_digits) * obj_powers_of_ten_u64[fraction_digits] + obj_parse_digits(q + 1, end, fraction_digits);
+            f64 value = (f64)mantissa / obj_powers_of_ten_f64[fraction_digits];
+            *cursor = last;
+            return (f32)(negative ? -value : value);
+        }
+    }
+
+    u64 mantissa = 0;
+    u32 mantissa_digits = 0;
+    s32 exponent = 0;
+    p = obj_accumulate_digits(p, end, false, &mantissa, &mantissa_digits, &exponent);
+    if (p < end && *p == '.')
+    {
+        p = obj_accumulate_digits(p + 1, end, true, &mantissa, &mantissa_digits, &exponent);
+    }
+
+    if (p < end && (*p == 'e' || *p == 'E'))
+    {
+        p++;
+        bool negative_exponent = false;
+        if (p < end && (*p == '-' || *p == '+'))
+        {
+            negative_exponent = *p == '-';
+            p++;
+        }
+        s32 written_exponent = 0;
+        for (; p < end && obj_is_digit(*p); p++)
+        {
+            written_exponent = MIN(written_exponent * 10 + (*p - '0'), 10000);
+        }
+        exponent += negative_exponent ? -written_exponent : written_exponent;
+    }
+    *cursor = p;
+
+    f64 value = (f64)mantissa;
+    if (mantissa != 0 && exponent < 0)
+    {
+        value = exponent >= -22 ? value / obj_powers_of_ten_f64[-exponent] : value * pow(10.0, (f64)exponent);
+    }
+    else if (mantissa != 0 && exponent > 0)
+    {
+        value = exponent <= 22 ? value * obj_powers_of_ten_f64[exponent] : value * pow(10.0, (f64)exponent);
+    }
+
+    return (f32)(negative ? -value : value);
+}
+
+static inline s64 obj_parse_int(const char** cursor, const char* end)
+{
+    const char* p = *cursor;
+    bool negative = false;
+    if (p < end && *p == '-')
+    {
+        negative = true;
+        p++;
+    }
+
+    // Leading zeros would otherwise count towards the 10 digits a u32 can have
+    while (p + 1 < end && *p == '0' && obj_is_digit(p[1]))
+    {
+        p++;
+    }
+
+    u32 run = obj_digit_run(p, end);
+    s64 value = (s64)obj_parse_digits(p, end, MIN(run, 8));
+    if (run > 8)
+    {
+        u32 count = MIN(run - 8, 2);
+        value = value * (s64)obj_powers_of_ten_u64[count] + (s64)obj_parse_digits(p + 8, end, count);
+    }
+    p += run;
+    if (run > 10 || value > UINT32_MAX)
+    {
+        // Out of the u32 range, so it resolves to the dummy element whatever the remaining digits are
+        value = (s64)UINT32_MAX + 1;
+        while (p < end && obj_is_digit(*p))
+        {
+            p++;
+        }
+    }
+    *cursor = p;
+
+    return negative ? -value : value;
+}
+
+// Classifies the line at p and returns the first byte after its keyword
+static inline ObjLineType obj_line_type(const char** cursor, const char* end)
+{
+    const char* p = obj_skip_blanks(*cursor, end);
+    ObjLineType type = OBJ_LINE_OTHER;
+    if (end - p >= 2 && obj_is_blank(p[1]))
+    {
+        type = p[0] == 'v' ? OBJ_LINE_POSITION : p[0] == 'f' ? OBJ_LINE_FACE : OBJ_LINE_OTHER;
+        p += type != OBJ_LINE_OTHER ? 1 : 0;
+    }
+    else if (end - p >= 3 && p[0] == 'v' && obj_is_blank(p[2]))
+    {
+        type = p[1] == 't' ? OBJ_LINE_TEXCOORD : p[1] == 'n' ? OBJ_LINE_NORMAL : OBJ_LINE_OTHER;
+        p += type != OBJ_LINE_OTHER ? 2 : 0;
+    }
+    *cursor = p;
+
+    return type;
+}
+
+// Number of corners of the face whose corners start at p
+static inline u32 obj_count_face_corners(const char* p, const char* end)
+{
+    u32 count = 0;
+    for (;;)
+    {
+        p = obj_skip_blanks(p, end);
+        if (p == end || *p == '\n' || *p == '#')
+        {
+            return count;
+        }
+        count++;
+        while (p < end && *p != '\n' && !obj_is_blank(*p))
+        {
+            p++;
+        }
+    }
+}
+
+// Turns a written index into an index into the merged array: negative ones count back from the last element declared so far
+static inline u32 obj_resolve_index(s64 written, u32 declared_count, u32 total_count)
+{
+    s64 index = written < 0 ? (s64)declared_count + 1 + written : written;
+    // Out of range, or absent (0): the corner gets the dummy element
+    return index > 0 && index < (s64)total_count ? (u32)index : 0;
+}
+
+static void obj_count_chunks(void* data, u32 start, u32 end)
+{
+    ObjParse* parse = (ObjParse*)data;
+    for (u32 i = start; i < end; i++)
+    {
+        ObjChunk* chunk = &parse->chunks[i];
+        for (const char* p = chunk->start; p < chunk->end; p = obj_skip_line(p, chunk->end))
+        {
+            switch (obj_line_type(&p, chunk->end))
+            {
+                case OBJ_LINE_POSITION:
+                    chunk->position_count++;
+                    break;
+                case OBJ_LINE_TEXCOORD:
+                    chunk->texcoord_count++;
+                    break;
+                case OBJ_LINE_NORMAL:
+                    chunk->normal_count++;
+                    break;
+                case OBJ_LINE_FACE:
+                {
+                    // Points and lines given as faces have no triangles to give
+                    u32 corner_count = obj_count_face_corners(p, chunk->end);
+                    if (corner_count >= 3)
+                    {
+                        chunk->face_count++;
+                        chunk->index_count += corner_count;
+                    }
+                    break;
+                }
+                default:
+                    break;
+            }
+        }
+    }
+}
+
+static void obj_parse_chunks(void* data, u32 start, u32 end)
+{
+    ObjParse* parse = (ObjParse*)data;
+    ObjFile* obj = parse->obj;
+    for (u32 i = start; i < end; i++)
+    {
+        ObjChunk* chunk = &parse->chunks[i];
+        // The dummy elements come first, so an element's place in its array is also its 1-based index
+        u32 position = chunk->first_position + 1;
+        u32 texcoord = chunk->first_texcoord + 1;
+        u32 normal = chunk->first_normal + 1;
+        u32 face = chunk->first_face;
+        u32 index = chunk->first_index;
+        u32 index_end = chunk->first_index + chunk->index_count;
+
+        for (const char* p = chunk->start; p < chunk->end; p = obj_skip_line(p, chunk->end))
+        {
+            switch (obj_line_type(&p, chunk->end))
+            {
+                case OBJ_LINE_POSITION:
+                    for (u32 axis = 0; axis < 3; axis++)
+                    {
+                        obj->positions[position * 3 + axis] = obj_parse_float(&p, chunk->end);
+                    }
+                    position++;
+                    break;
+                case OBJ_LINE_TEXCOORD:
+                    for (u32 axis = 0; axis < 2; axis++)
+                    {
+                        obj->texcoords[texcoord * 2 + axis] = obj_parse_float(&p, chunk->end);
+                    }
+                    texcoord++;
+                    break;
+                case OBJ_LINE_NORMAL:
+                    for (u32 axis = 0; axis < 3; axis++)
+                    {
+                        obj->normals[normal * 3 + axis] = obj_parse_float(&p, chunk->end);
+                    }
+                    normal++;
+                    break;
+                case OBJ_LINE_FACE:
+                {
+                    // Corners are written until the end of the line, which saves going over it twice
+                    u32 corner_count = 0;
+                    for (p = obj_skip_blanks(p, chunk->end); p < chunk->end && *p != '\n' && *p != '#'; p = obj_skip_blanks(p, chunk->end))
+                    {
+                        // p/t/n, p//n, p/t or p
+                        s64 written[3] = { 0 };
+                        for (u32 component = 0; component < 3; component++)
+                        {
+                            written[component] = obj_parse_int(&p, chunk->end);
+                            if (p == chunk->end || *p != '/')
+                            {
+                                break;
+                            }
+                            p++;
+                        }
+                        // Skips whatever is left of a malformed corner
+                        while (p < chunk->end && *p != '\n' && !obj_is_blank(*p))
+                        {
+                            p++;
+                        }
+
+                        // The corners of a face the first pass dropped may not fit in what is left of the chunk's range
+                        if (index + corner_count < index_end)
+                        {
+                            obj->indices[index + corner_count] = (ObjIndex)
+                            {
+                                .p = obj_resolve_index(written[0], position - 1, obj->position_count),
+                                .t = obj_resolve_index(written[1], texcoord - 1, obj->texcoord_count),
+                                .n = obj_resolve_index(written[2], normal - 1, obj->normal_count),
+                            };
+                        }
+                        corner_count++;
+                    }
+
+                    // Faces the first pass dropped leave their corners to be overwritten
+                    if (corner_count >= 3)
+                    {
+                        obj->face_vertices[face++] = corner_count;
+                        index += corner_count;
+                    }
+                    break;
+                }
+                default:
+                    break;
+            }
+        }
+
+        redassert(position == chunk->first_position + chunk->position_count + 1);
+        redassert(index == index_end);
+    }
+}
+
+static inline void obj_free(ObjFile* obj)
+{
+    DELETE(obj->positions);
+    DELETE(obj->texcoords);
+    DELETE(obj->normals);
+    DELETE(obj->face_vertices);
+    DELETE(obj->indices);
+    *obj = (ObjFile) ZERO_INIT;
+}
+
+// Parses the OBJ file at path into obj, spreading the work over the job threads. Free it with obj_free
+static bool obj_parse(const char* path, ObjFile* obj)
+{
+    FileMapping mapping;
+    if (!os_file_map(path, FILE_ACCESS_HINT_SEQUENTIAL, &mapping))
+    {
+        return false;
+    }
+
+    const char* start = (const char*)mapping.ptr;
+    const char* end = start + mapping.size;
+    usize chunk_size = MAX(OBJ_MIN_CHUNK_SIZE, mapping.size / ((usize)os_job_thread_count() * OBJ_CHUNKS_PER_THREAD));
+    u32 chunk_capacity = (u32)(mapping.size / chunk_size) + 1;
+
+    ArenaTemp temp = arena_begin_temp(os_scratch_arena());
+    ObjChunk* chunks = ARENA_NEW(temp.arena, ObjChunk, chunk_capacity);
+    u32 chunk_count = 0;
+    for (const char* chunk_start = start; chunk_start < end;)
+    {
+        // Every chunk but the last ends right after a newline, so no line straddles two chunks
+        const char* chunk_end = (usize)(end - chunk_start) > chunk_size ? obj_skip_line(chunk_start + chunk_size, end) : end;
+        redassert(chunk_count < chunk_capacity);
+        chunks[chunk_count++] = (ObjChunk)
+        {
+            .start = chunk_start,
+            .end = chunk_end,
+        };
+        chunk_start = chunk_end;
+    }
+
+    ObjParse parse =
+    {
+        .chunks = chunks,
+        .obj = obj,
+    };
+    os_parallel_for(chunk_count, 1, obj_count_chunks, &parse);
+
+    u32 position_count = 0;
+    u32 texcoord_count = 0;
+    u32 normal_count = 0;
+    u32 face_count = 0;
+    u32 index_count = 0;
+    for (u32 i = 0; i < chunk_count; i++)
+    {
+        ObjChunk* chunk = &chunks[i];
+        chunk->first_position = position_count;
+        chunk->first_texcoord = texcoord_count;
+        chunk->first_normal = normal_count;
+        chunk->first_face = face_count;
+        chunk->first_index = index_count;
+        position_count += chunk->position_count;
+        texcoord_count += chunk->texcoord_count;
+        normal_count += chunk->normal_count;
+        face_count += chunk->face_count;
+        index_count += chunk->index_count;
+    }
+
+    *obj = (ObjFile)
+    {
+        .position_count = position_count + 1,
+        .texcoord_count = texcoord_count + 1,
+        .normal_count = normal_count + 1,
+        .face_count = face_count,
+        .index_count = index_count,
+    };
+    obj->positions = NEW(f32, (usize)obj->position_count * 3);
+    obj->texcoords = NEW(f32, (usize)obj->texcoord_count * 2);
+    obj->normals = NEW(f32, (usize)obj->normal_count * 3);
+    obj->face_vertices = NEW(u32, (usize)MAX(face_count, 1));
+    obj->indices = NEW(ObjIndex, (usize)MAX(index_count, 1));
+    memset(obj->positions, 0, 3 * sizeof(f32));
+    memset(obj->texcoords, 0, 2 * sizeof(f32));
+    // As in fast_obj, the dummy normal is +Z rather than zero, so corners without a normal still shade
+    obj->normals[0] = 0.0f;
+    obj->normals[1] = 0.0f;
+    obj->normals[2] = 1.0f;
+
+    os_parallel_for(chunk_count, 1, obj_parse_chunks, &parse);
+
+    arena_end_temp(temp);
+    os_file_unmap(&mapping);
+
+    return true;
+}
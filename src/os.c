@@ -2,14 +2,23 @@
 // Created by david on 10/17/20.
 //
 
+#ifdef __linux__
+// pthread_setaffinity_np
+#define _GNU_SOURCE
+#endif
+
 #include "os.h"
 
 #ifdef RED_OS_LINUX
 #define RED_OS_POSIX
 #include <unistd.h>
+#include <pthread.h>
+#include <sched.h>
 #include <linux/limits.h>
 #include <sys/sysinfo.h>
 #include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
 #include <time.h>
 #include <execinfo.h>
 #elif defined RED_OS_WINDOWS
@@ -20,6 +29,10 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <stdarg.h>
+#include <stdatomic.h>
+#if defined(__x86_64__) || defined(_M_X64)
+#include <immintrin.h>
+#endif
 
 typedef struct TimeRecord
 {
@@ -32,36 +45,69 @@ static u32 record_count = 0;
 static usize page_size;
 static u16 logical_thread_count;
 static u16 shared_library_count;
+static HugePageMode huge_page_mode = HUGE_PAGE_MODE_OFF;
 
 #define CACHE_LINE_SIZE BYTE(64)
-#define MAX_ALLOCATED_BLOCK_COUNT 4
 #define BLOCK_ALIGNMENT CACHE_LINE_SIZE
-#define BLOCK_SIZE GIGABYTE(4)
+#define PAGE_ALLOCATOR_RESERVE_SIZE GIGABYTE(64)
+#define HUGE_PAGE_SIZE MEGABYTE(2)
+#define COMMIT_GRANULARITY HUGE_PAGE_SIZE
+#define MAX_COMMIT_STEP MEGABYTE(256)
+#define SLAB_SIZE MEGABYTE(4)
 #define DEFAULT_ALIGNMENT 16
-
-struct MemoryBlock
-{
-    void* address;
-    void* aligned_address;
-    void* available_address;
-};
+#define CHUNK_HEADER_SIZE DEFAULT_ALIGNMENT
+#define SMALL_SIZE_CLASS_LIMIT 256
+#define SMALL_SIZE_CLASS_COUNT (SMALL_SIZE_CLASS_LIMIT / DEFAULT_ALIGNMENT)
+#define SIZE_CLASS_COUNT (SMALL_SIZE_CLASS_COUNT + 4 * 25)
 
 typedef struct Allocation
 {
-    u32 alignment;
-    u32 size;
+    u32 alignment; /* 0 while the chunk sits in a free list */
+    u32 size; /* usable bytes after the header */
 } Allocation;
 
+typedef struct FreeChunk
+{
+    struct FreeChunk* next;
+} FreeChunk;
+
+/*
+ * The allocator reserves one contiguous range of address space up front. Threads carve slabs out of it
+ * with an atomic bump and serve their allocations from their own slab and free lists, so NEW/RENEW do
+ * not contend with each other. Only committing more of the reserve takes a lock.
+ */
 typedef struct PageAllocator
 {
-    void* available_address;
-    usize allocation_count;
-    usize allocated_block_count;
-    void* blob;
+    u8* blob;
+    usize reserved;
     usize page_size;
+    atomic_bool ready;
+    // Offset of the first byte of the reserve that no thread owns yet
+    atomic_size_t slab_cursor;
+    atomic_flag commit_lock;
+    usize committed; /* guarded by commit_lock */
+    _Atomic(struct ThreadHeap*) heaps;
 } PageAllocator;
 
-static struct PageAllocator m_page_allocator;
+/*
+ * Allocation state owned by one thread. A chunk freed on another thread goes to that thread's free lists,
+ * which is fine because chunks carry their size in the header.
+ */
+typedef struct ThreadHeap
+{
+    u8* slab_start;
+    u8* available_address;
+    u8* slab_end;
+    // Everything from here to the end of the slab has never been handed out and is still zero
+    u8* zeroed_address;
+    FreeChunk* free_lists[SIZE_CLASS_COUNT];
+    usize free_list_bytes;
+    usize allocation_count;
+    struct ThreadHeap* next;
+} ThreadHeap;
+
+static struct PageAllocator m_page_allocator = { .commit_lock = ATOMIC_FLAG_INIT };
+static _Thread_local ThreadHeap* t_heap;
 
 // Static cached structures 
 #ifdef RED_OS_WINDOWS
@@ -189,6 +235,92 @@ void* os_ask_virtual_memory_block_with_address(void* target_address, size_t bloc
     return address;
 }
 
+// Reserves address space without backing it. The returned address is aligned to the huge page size
+void* os_reserve_virtual_memory(usize size)
+{
+    void* address = NULL;
+#ifdef RED_OS_WINDOWS
+    address = VirtualAlloc(NULL, size, MEM_RESERVE, PAGE_NOACCESS);
+#elif defined(RED_OS_LINUX)
+    // Over-reserve so the range can start on a huge page boundary, then give the slack back
+    usize reserve_size = size + HUGE_PAGE_SIZE;
+    u8* raw_address = (u8*)mmap(NULL, reserve_size, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (raw_address == MAP_FAILED)
+    {
+        return NULL;
+    }
+
+    u8* aligned_address = (u8*)(((uptr)raw_address + HUGE_PAGE_SIZE - 1) & ~((uptr)HUGE_PAGE_SIZE - 1));
+    usize head = (usize)(aligned_address - raw_address);
+    usize tail = reserve_size - head - size;
+    if (head)
+    {
+        munmap(raw_address, head);
+    }
+    if (tail)
+    {
+        munmap(aligned_address + size, tail);
+    }
+    address = aligned_address;
+#else
+#error
+#endif
+    return address;
+}
+
+// Backs a range inside a reservation with read/write memory. Fresh memory reads as zero
+bool os_commit_virtual_memory(void* address, usize size, HugePageMode mode)
+{
+#ifdef RED_OS_WINDOWS
+    // Large pages on Windows need SeLockMemoryPrivilege and have to be requested at reservation time
+    (void)mode;
+    return VirtualAlloc(address, size, MEM_COMMIT, PAGE_READWRITE) != NULL;
+#elif defined(RED_OS_LINUX)
+    if (mode == HUGE_PAGE_MODE_EXPLICIT)
+    {
+        // The range is ours, so replacing it in place with hugetlbfs pages cannot clobber anything else
+        void* huge_address = mmap(address, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED | MAP_HUGETLB, -1, 0);
+        if (huge_address != MAP_FAILED)
+        {
+            return true;
+        }
+
+        static bool warned = false;
+        if (!warned)
+        {
+            print("Explicit huge pages are not available (%s). Falling back to transparent huge pages\n", strerror(errno));
+            warned = true;
+        }
+        // A failed MAP_FIXED mapping may have left the range unmapped: restore the reservation
+        void* reserved_address = mmap(address, size, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED | MAP_NORESERVE, -1, 0);
+        if (reserved_address == MAP_FAILED)
+        {
+            return false;
+        }
+        mode = HUGE_PAGE_MODE_TRANSPARENT;
+    }
+
+    if (mprotect(address, size, PROT_READ | PROT_WRITE) != 0)
+    {
+        return false;
+    }
+
+    if (mode == HUGE_PAGE_MODE_TRANSPARENT)
+    {
+        madvise(address, size, MADV_HUGEPAGE);
+    }
+
+    return true;
+#else
+#error
+#endif
+}
+
+void os_set_huge_page_mode(HugePageMode mode)
+{
+    huge_page_mode = mode;
+}
+
 void* os_ask_heap_memory(size_t size)
 {
     void* address = NULL;
@@ -436,6 +568,187 @@ StringBuffer* os_file_load(const char *name)
     return file_buffer;
 }
 
+bool os_file_get_info(const char* name, FileInfo* info)
+{
+#ifdef RED_OS_WINDOWS
+    WIN32_FILE_ATTRIBUTE_DATA attributes;
+    if (!GetFileAttributesExA(name, GetFileExInfoStandard, &attributes))
+    {
+        return false;
+    }
+
+    info->size = ((u64)attributes.nFileSizeHigh << 32) | (u64)attributes.nFileSizeLow;
+    // FILETIME counts 100-nanosecond intervals
+    info->modification_time = (((u64)attributes.ftLastWriteTime.dwHighDateTime << 32) | (u64)attributes.ftLastWriteTime.dwLowDateTime) * 100;
+#elif defined(RED_OS_LINUX)
+    struct stat file_stat;
+    if (stat(name, &file_stat) != 0)
+    {
+        return false;
+    }
+
+    info->size = (u64)file_stat.st_size;
+    info->modification_time = (u64)file_stat.st_mtim.tv_sec * 1000000000 + (u64)file_stat.st_mtim.tv_nsec;
+#else
+#error
+#endif
+    return true;
+}
+
+bool os_file_write(const char* name, const FileChunk* chunks, u32 chunk_count)
+{
+    FILE* file = fopen(name, "wb");
+    if (!file)
+    {
+        print("Could not open file %s for writing\n", name);
+        return false;
+    }
+
+    for (u32 i = 0; i < chunk_count; i++)
+    {
+        if (chunks[i].size == 0)
+        {
+            continue;
+        }
+
+        usize written = fwrite(chunks[i].data, 1, chunks[i].size, file);
+        if (written != chunks[i].size)
+        {
+            print("Written characters differ from chunk length in file %s\n", name);
+            fclose(file);
+            return false;
+        }
+    }
+
+    if (fclose(file))
+    {
+        print("Error closing file %s\n", name);
+        return false;
+    }
+
+    return true;
+}
+
+// Maps the whole file read-only. The contents are only valid until os_file_unmap is called
+bool os_file_map(const char* name, FileAccessHint hint, FileMapping* mapping)
+{
+    *mapping = (FileMapping) ZERO_INIT;
+#ifdef RED_OS_WINDOWS
+    DWORD flags = hint == FILE_ACCESS_HINT_SEQUENTIAL ? FILE_FLAG_SEQUENTIAL_SCAN : FILE_ATTRIBUTE_NORMAL;
+    HANDLE file = CreateFileA(name, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, flags, NULL);
+    if (file == INVALID_HANDLE_VALUE)
+    {
+        print("File %s not found\n", name);
+        return false;
+    }
+
+    LARGE_INTEGER size;
+    if (!GetFileSizeEx(file, &size))
+    {
+        print("Cannot get the size of the file %s\n", name);
+        CloseHandle(file);
+        return false;
+    }
+
+    mapping->size = (usize)size.QuadPart;
+    if (mapping->size == 0)
+    {
+        CloseHandle(file);
+        return true;
+    }
+
+    HANDLE file_mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+    if (!file_mapping)
+    {
+        print("Could not create a file mapping for %s\n", name);
+        CloseHandle(file);
+        return false;
+    }
+
+    mapping->ptr = MapViewOfFile(file_mapping, FILE_MAP_READ, 0, 0, 0);
+    if (!mapping->ptr)
+    {
+        print("Could not map file %s\n", name);
+        CloseHandle(file_mapping);
+        CloseHandle(file);
+        return false;
+    }
+
+    mapping->win32_file_handle = file;
+    mapping->win32_mapping_handle = file_mapping;
+#elif defined(RED_OS_LINUX)
+    s32 fd = open(name, O_RDONLY);
+    if (fd < 0)
+    {
+        print("File %s not found\n", name);
+        return false;
+    }
+
+    struct stat file_stat;
+    if (fstat(fd, &file_stat) != 0)
+    {
+        print("Cannot get the size of the file %s\n", name);
+        close(fd);
+        return false;
+    }
+
+    mapping->size = (usize)file_stat.st_size;
+    if (mapping->size == 0)
+    {
+        close(fd);
+        return true;
+    }
+
+    // The mapping keeps its own reference to the file, so the descriptor can be closed right away
+    void* address = mmap(NULL, mapping->size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (address == MAP_FAILED)
+    {
+        print("Could not map file %s: %s\n", name, strerror(errno));
+        mapping->size = 0;
+        return false;
+    }
+
+    switch (hint)
+    {
+        case FILE_ACCESS_HINT_NORMAL:
+            break;
+        case FILE_ACCESS_HINT_SEQUENTIAL:
+            madvise(address, mapping->size, MADV_SEQUENTIAL);
+            break;
+        case FILE_ACCESS_HINT_WILLNEED:
+            madvise(address, mapping->size, MADV_WILLNEED);
+            break;
+        default:
+            RED_UNREACHABLE;
+            break;
+    }
+
+    mapping->ptr = address;
+#else
+#error
+#endif
+    return true;
+}
+
+void os_file_unmap(FileMapping* mapping)
+{
+    if (mapping->ptr)
+    {
+#ifdef RED_OS_WINDOWS
+        UnmapViewOfFile(mapping->ptr);
+        CloseHandle(mapping->win32_mapping_handle);
+        CloseHandle(mapping->win32_file_handle);
+#elif defined(RED_OS_LINUX)
+        munmap(mapping->ptr, mapping->size);
+#else
+#error
+#endif
+    }
+
+    *mapping = (FileMapping) ZERO_INIT;
+}
+
 typedef enum AllocationResult
 {
     ALLOCATION_RESULT_ERROR,
@@ -473,16 +786,82 @@ static inline Allocation* find_allocation_metadata(void* visible_address)
     u8* it = (u8*)((uptr)visible_address - sizeof(Allocation));
     u32* alignment_ptr = (u32*)it;
 
-    if (*alignment_ptr != 16)
+    if (*alignment_ptr != DEFAULT_ALIGNMENT)
     {
-        print("Probably uninitialized memory. Alignment is %u; should be 16\n", *alignment_ptr);
+        print("Probably uninitialized or already freed memory. Alignment is %u; should be %u\n", *alignment_ptr, DEFAULT_ALIGNMENT);
     }
 
-    redassert(*alignment_ptr == 16);
+    redassert(*alignment_ptr == DEFAULT_ALIGNMENT);
     redassert(it < (u8*)visible_address);
     return (Allocation*)it;
 }
 
+static inline u32 highest_bit_index(u64 value)
+{
+    redassert(value != 0);
+#ifdef RED_OS_WINDOWS
+    unsigned long index;
+    _BitScanReverse64(&index, value);
+    return (u32)index;
+#else
+    return 63 - (u32)__builtin_clzll(value);
+#endif
+}
+
+/*
+ * Size classes: 16-byte steps up to 256 bytes, then four classes per power of two
+ * (320, 384, 448, 512, 640, 768, ...), so rounding a request up wastes at most 25%.
+ */
+static inline usize size_class_size(u32 size_class)
+{
+    redassert(size_class < SIZE_CLASS_COUNT);
+    if (size_class < SMALL_SIZE_CLASS_COUNT)
+    {
+        return (usize)(size_class + 1) * DEFAULT_ALIGNMENT;
+    }
+
+    u32 k = size_class - SMALL_SIZE_CLASS_COUNT;
+    u32 shift = k >> 2;
+    u32 sub = k & 3;
+    return ((usize)SMALL_SIZE_CLASS_LIMIT << shift) + ((usize)(SMALL_SIZE_CLASS_LIMIT / 4) << shift) * (sub + 1);
+}
+
+// Smallest class that can hold the requested size
+static inline u32 size_class_up(usize size)
+{
+    size = MAX(size, DEFAULT_ALIGNMENT);
+    if (size <= SMALL_SIZE_CLASS_LIMIT)
+    {
+        return (u32)((size + DEFAULT_ALIGNMENT - 1) / DEFAULT_ALIGNMENT) - 1;
+    }
+
+    u32 shift = highest_bit_index(size - 1) - highest_bit_index(SMALL_SIZE_CLASS_LIMIT);
+    usize base = (usize)SMALL_SIZE_CLASS_LIMIT << shift;
+    usize step = (usize)(SMALL_SIZE_CLASS_LIMIT / 4) << shift;
+    u32 sub = (u32)((size - base + step - 1) / step) - 1;
+    u32 size_class = SMALL_SIZE_CLASS_COUNT + shift * 4 + sub;
+    redassert(size_class_size(size_class) >= size);
+    return size_class;
+}
+
+// Biggest class a chunk with this capacity can serve, so any request popped from that free list fits
+static inline u32 size_class_down(usize capacity)
+{
+    redassert(capacity >= DEFAULT_ALIGNMENT);
+    if (capacity < size_class_size(SMALL_SIZE_CLASS_COUNT))
+    {
+        return (u32)MIN(capacity / DEFAULT_ALIGNMENT, SMALL_SIZE_CLASS_COUNT) - 1;
+    }
+
+    u32 shift = highest_bit_index(capacity) - highest_bit_index(SMALL_SIZE_CLASS_LIMIT);
+    usize base = (usize)SMALL_SIZE_CLASS_LIMIT << shift;
+    usize step = (usize)(SMALL_SIZE_CLASS_LIMIT / 4) << shift;
+    usize steps = (capacity - base) / step;
+    u32 size_class = steps == 0 ? SMALL_SIZE_CLASS_COUNT + shift * 4 - 1 : SMALL_SIZE_CLASS_COUNT + shift * 4 + (u32)steps - 1;
+    redassert(size_class_size(size_class) <= capacity);
+    return size_class;
+}
+
 //static inline void buffer_zero_check(void* address, size_t size)
 //{
 //    if (address)
@@ -498,137 +877,1046 @@ static inline Allocation* find_allocation_metadata(void* visible_address)
 //    }
 //}
 
-static inline void allocate_new_block(void)
+// Commits the reserve up to (at least) required_size bytes, growing the committed range geometrically
+static inline bool commit_reserve(u8* base, usize reserved, usize* committed, usize required_size)
 {
-    void* target_address = NULL;
-    if (m_page_allocator.allocation_count > 0)
+    if (required_size <= *committed)
     {
-        void* original_address = m_page_allocator.blob;
-        target_address = (void*)((uptr)original_address * (m_page_allocator.allocation_count + 1));
+        return true;
     }
-    void* address = os_ask_virtual_memory_block_with_address(target_address, BLOCK_SIZE);
-    redassert(address != NULL);
-    if (target_address)
+
+    if (required_size > reserved)
     {
-        redassert(address == target_address);
+        return false;
     }
 
-#if RED_BUFFER_MEM_CHECK
-    buffer_zero_check(address, block_size);
-#endif
+    usize commit_step = MAX(*committed, (usize)COMMIT_GRANULARITY);
+    commit_step = MIN(commit_step, (usize)MAX_COMMIT_STEP);
+    usize new_committed = MAX(required_size, *committed + commit_step);
+    new_committed = (new_committed + COMMIT_GRANULARITY - 1) & ~((usize)COMMIT_GRANULARITY - 1);
+    new_committed = MIN(new_committed, reserved);
 
-    if (address)
+    if (!os_commit_virtual_memory(base + *committed, new_committed - *committed, huge_page_mode))
     {
-        void* aligned_address = align_address(address, BLOCK_ALIGNMENT);
-        if (aligned_address != address)
-        {
-            print("Aligned address is %p, raw address is %p\n", aligned_address, address);
-            redassert(aligned_address == address);
-        }
-        usize lost_memory = (uptr)aligned_address - (uptr)address;
-        redassert(lost_memory == 0);
-        usize aligned_size = BLOCK_SIZE - lost_memory;
-        redassert(aligned_size == BLOCK_SIZE);
-        if (target_address == NULL)
-        {
-            m_page_allocator.blob = address;
-            m_page_allocator.available_address = address;
-        }
-        else
+        return false;
+    }
+
+    *committed = new_committed;
+    return true;
+}
+
+static inline void lock_commit(void)
+{
+    while (atomic_flag_test_and_set_explicit(&m_page_allocator.commit_lock, memory_order_acquire))
+    {
+    }
+}
+
+static inline void unlock_commit(void)
+{
+    atomic_flag_clear_explicit(&m_page_allocator.commit_lock, memory_order_release);
+}
+
+static inline void reserve_page_allocator(void)
+{
+    lock_commit();
+    if (!atomic_load_explicit(&m_page_allocator.ready, memory_order_relaxed))
+    {
+        u8* address = (u8*)os_reserve_virtual_memory(PAGE_ALLOCATOR_RESERVE_SIZE);
+        if (!address)
         {
-            m_page_allocator.available_address = target_address;
+            os_exit_with_message("Address space reservation failed!");
         }
-        m_page_allocator.allocated_block_count++;
+
+        redassert(align_address(address, BLOCK_ALIGNMENT) == address);
+        m_page_allocator.blob = address;
+        m_page_allocator.reserved = PAGE_ALLOCATOR_RESERVE_SIZE;
+        m_page_allocator.committed = 0;
+        atomic_store_explicit(&m_page_allocator.ready, true, memory_order_release);
     }
-    else
+    unlock_commit();
+}
+
+static inline void page_allocator_commit(usize end_offset)
+{
+    lock_commit();
+    bool committed = commit_reserve(m_page_allocator.blob, m_page_allocator.reserved, &m_page_allocator.committed, end_offset);
+    unlock_commit();
+
+    if (!committed)
     {
-        os_exit_with_message("Block allocation failed!");
+        os_exit_with_message("Out of memory: could not commit %zu bytes of the allocator reserve\n", end_offset);
     }
 }
 
-static inline uptr top_address(void)
+// Hands a fresh, zeroed range of the reserve to the calling thread
+static inline u8* take_slab(usize size)
 {
-    return (uptr)m_page_allocator.blob + (m_page_allocator.allocated_block_count * BLOCK_SIZE);
+    if (!atomic_load_explicit(&m_page_allocator.ready, memory_order_acquire))
+    {
+        reserve_page_allocator();
+    }
+
+    usize offset = atomic_fetch_add_explicit(&m_page_allocator.slab_cursor, size, memory_order_relaxed);
+    page_allocator_commit(offset + size);
+    return m_page_allocator.blob + offset;
 }
 
-void* allocate_chunk(usize size)
+// Grows the current slab in place if no other thread has taken the range right after it
+static inline bool try_extend_slab(ThreadHeap* heap, usize size)
 {
-#if RED_BUFFER_MEM_CHECK
-    buffer_zero_check(m_page_allocator.available_address, (uptr)m_page_allocator.blob +  block_size - (uptr)m_page_allocator.available_address);
-#endif
-    redassert(m_page_allocator.allocated_block_count <= MAX_ALLOCATED_BLOCK_COUNT);
-    // TODO:
-    usize max_required_size = size + DEFAULT_ALIGNMENT;
-    redassert(sizeof(Allocation) < DEFAULT_ALIGNMENT);
+    usize expected = (usize)(heap->slab_end - m_page_allocator.blob);
+    if (!atomic_compare_exchange_strong_explicit(&m_page_allocator.slab_cursor, &expected, expected + size, memory_order_relaxed, memory_order_relaxed))
+    {
+        return false;
+    }
+
+    page_allocator_commit(expected + size);
+    heap->slab_end += size;
+    return true;
+}
+
+static inline void push_free_chunk(ThreadHeap* heap, void* allocated_address, Allocation* allocation)
+{
+    allocation->alignment = 0;
+    u32 size_class = size_class_down(allocation->size);
+    FreeChunk* chunk = (FreeChunk*)allocated_address;
+    chunk->next = heap->free_lists[size_class];
+    heap->free_lists[size_class] = chunk;
+    heap->free_list_bytes += allocation->size;
+}
+
+// The unused tail of a slab that is being replaced becomes an ordinary free chunk
+static inline void retire_slab(ThreadHeap* heap)
+{
+    usize remaining = (usize)(heap->slab_end - heap->available_address);
+    if (remaining >= CHUNK_HEADER_SIZE + DEFAULT_ALIGNMENT)
+    {
+        void* allocated_address = heap->available_address + CHUNK_HEADER_SIZE;
+        Allocation* allocation = (Allocation*)((uptr)allocated_address - sizeof(Allocation));
+        allocation->size = (u32)(remaining - CHUNK_HEADER_SIZE);
+        push_free_chunk(heap, allocated_address, allocation);
+    }
+}
+
+static inline ThreadHeap* thread_heap(void)
+{
+    ThreadHeap* heap = t_heap;
+    if (heap)
+    {
+        return heap;
+    }
+
+    // The heap lives at the start of its first slab, so it outlives the thread and keeps its statistics
+    u8* slab = take_slab(SLAB_SIZE);
+    heap = (ThreadHeap*)slab;
+    heap->slab_start = (u8*)align_address(slab + sizeof(ThreadHeap), DEFAULT_ALIGNMENT);
+    heap->available_address = heap->slab_start;
+    heap->zeroed_address = heap->slab_start;
+    heap->slab_end = slab + SLAB_SIZE;
+
+    heap->next = atomic_load_explicit(&m_page_allocator.heaps, memory_order_relaxed);
+    while (!atomic_compare_exchange_weak_explicit(&m_page_allocator.heaps, &heap->next, heap, memory_order_release, memory_order_relaxed))
+    {
+    }
+
+    t_heap = heap;
+    return heap;
+}
+
+static inline usize round_up_to_slab(usize size)
+{
+    return (size + SLAB_SIZE - 1) & ~((usize)SLAB_SIZE - 1);
+}
 
-    bool first_allocation = m_page_allocator.allocated_block_count == 0;
-    bool can_allocate_in_current_block = !first_allocation;
+// Callers rely on new memory being zeroed, as it is when it comes fresh from the OS
+static inline void ensure_zeroed(ThreadHeap* heap, void* start, void* end)
+{
+    if ((uptr)start < (uptr)heap->zeroed_address)
+    {
+        uptr zero_end = MIN((uptr)end, (uptr)heap->zeroed_address);
+        memset(start, 0, zero_end - (uptr)start);
+    }
 
-    if (!first_allocation)
+    if ((uptr)end > (uptr)heap->zeroed_address)
     {
-        uptr available_address = (uptr)m_page_allocator.available_address;
-        usize free_space = top_address() - available_address;
-        bool no_need_to_allocate_another_block = max_required_size < free_space;
-        can_allocate_in_current_block = can_allocate_in_current_block && no_need_to_allocate_another_block;
+        heap->zeroed_address = end;
     }
+}
+
+// Only chunks that sit at the top of this thread's current slab can give memory back to the bump pointer
+static inline bool is_top_chunk(ThreadHeap* heap, void* allocated_address, Allocation* allocation)
+{
+    return (uptr)allocated_address - CHUNK_HEADER_SIZE >= (uptr)heap->slab_start && (uptr)allocated_address + allocation->size == (uptr)heap->available_address;
+}
+
+static inline void* bump_allocate(ThreadHeap* heap, usize capacity)
+{
+    redassert(sizeof(Allocation) < DEFAULT_ALIGNMENT);
 
-    if (!can_allocate_in_current_block)
+    usize chunk_size = CHUNK_HEADER_SIZE + capacity;
+    usize remaining = (usize)(heap->slab_end - heap->available_address);
+    if (remaining < chunk_size && !try_extend_slab(heap, round_up_to_slab(chunk_size - remaining)))
     {
-        allocate_new_block();
+        retire_slab(heap);
+        usize slab_size = round_up_to_slab(chunk_size);
+        u8* slab = take_slab(slab_size);
+        heap->slab_start = slab;
+        heap->available_address = slab;
+        heap->zeroed_address = slab;
+        heap->slab_end = slab + slab_size;
     }
 
     // This is the address with the allocation metadata
-    void* address = m_page_allocator.available_address;
+    void* address = heap->available_address;
     void* aligned_address = align_address((void*)((uptr)address + sizeof(Allocation)), DEFAULT_ALIGNMENT);
+    // Chunks are always a multiple of the alignment, so the header padding is constant
+    redassert((uptr)aligned_address - (uptr)address == CHUNK_HEADER_SIZE);
+    ensure_zeroed(heap, aligned_address, (void*)((uptr)aligned_address + capacity));
 
     fill_with_allocation_garbage(address, aligned_address);
 
-    usize pointer_displacement = (uptr)aligned_address - (uptr)address + size;
-    uptr new_available_address_number = (uptr)address + pointer_displacement;
+    uptr new_available_address_number = (uptr)aligned_address + capacity;
     void* new_available_address = (void*)new_available_address_number;
-    redassert(new_available_address_number < top_address());
     Allocation* allocation = (Allocation*)((uptr)aligned_address - sizeof(Allocation));
     redassert(sizeof(Allocation) == (sizeof(u32) * 2));
     allocation->alignment = DEFAULT_ALIGNMENT;
-    allocation->size = pointer_displacement;
+    allocation->size = capacity;
     redassert(allocation->size != 0);
-    m_page_allocator.available_address = new_available_address;
-    m_page_allocator.allocation_count++;
+    heap->available_address = new_available_address;
 
 #if RED_BUFFER_MEM_CHECK
-    buffer_zero_check(aligned_address, size);
-#endif
-#if RED_ALLOCATION_VERBOSE
-    print("[ALLOCATOR] (#%zu) Allocating %zu bytes at address 0x%p. Total allocated: %zu\n", m_page_allocator.allocation_count, allocation->size, address, (usize)((uptr)m_page_allocator.available_address - (uptr)m_page_allocator.blob));
+    buffer_zero_check(aligned_address, capacity);
 #endif
     redassert(new_available_address != address);
 
-#if RED_BUFFER_MEM_CHECK
-    buffer_zero_check(m_page_allocator.available_address, (uptr)m_page_allocator.blob +  block_size - (uptr)m_page_allocator.available_address);
-#endif
-    return (void*)aligned_address;
+    return aligned_address;
 }
 
-void* reallocate_chunk(void* allocated_address, usize size)
+void* allocate_chunk(usize size)
 {
-    redassert(size > 0);
-    redassert(size < UINT32_MAX);
-    if (!allocated_address)
+    ThreadHeap* heap = thread_heap();
+    u32 size_class = size_class_up(size);
+    usize capacity = size_class_size(size_class);
+    redassert(capacity < UINT32_MAX);
+
+    void* aligned_address;
+    FreeChunk* chunk = heap->free_lists[size_class];
+    if (chunk)
     {
-        return allocate_chunk(size);
+        heap->free_lists[size_class] = chunk->next;
+        aligned_address = chunk;
+        Allocation* allocation = (Allocation*)((uptr)aligned_address - sizeof(Allocation));
+        redassert(allocation->alignment == 0);
+        redassert(allocation->size >= capacity);
+        allocation->alignment = DEFAULT_ALIGNMENT;
+        heap->free_list_bytes -= allocation->size;
+        // Reused memory is handed out zeroed, like fresh pages from the OS
+        memset(aligned_address, 0, allocation->size);
+    }
+    else
+    {
+        aligned_address = bump_allocate(heap, capacity);
     }
-    
-    Allocation* allocation_metadata = find_allocation_metadata(allocated_address);
-    usize difference = (uptr)allocated_address - (uptr)allocation_metadata;
-    usize real_size = allocation_metadata->size - difference;
-    redassert(real_size < size);
-    void* new_address = allocate_chunk(size);
-    memcpy(new_address, allocated_address, real_size);
 
-    return new_address;
-}
+    heap->allocation_count++;
 
-void print(const char* format, ...)
+#if RED_ALLOCATION_VERBOSE
+    print("[ALLOCATOR] (#%zu) Allocating %zu bytes at address 0x%p\n", heap->allocation_count, capacity, aligned_address);
+#endif
+
+    return aligned_address;
+}
+
+void free_chunk(void* allocated_address)
+{
+    if (!allocated_address)
+    {
+        return;
+    }
+
+    ThreadHeap* heap = thread_heap();
+    Allocation* allocation = find_allocation_metadata(allocated_address);
+
+    if (is_top_chunk(heap, allocated_address, allocation))
+    {
+        // The last chunk of the slab goes back to the bump pointer
+        allocation->alignment = 0;
+        heap->available_address = (u8*)allocated_address - CHUNK_HEADER_SIZE;
+        return;
+    }
+
+    push_free_chunk(heap, allocated_address, allocation);
+}
+
+void* reallocate_chunk(void* allocated_address, usize size)
+{
+    redassert(size > 0);
+    redassert(size < UINT32_MAX);
+    if (!allocated_address)
+    {
+        return allocate_chunk(size);
+    }
+    
+    Allocation* allocation = find_allocation_metadata(allocated_address);
+    if (size <= allocation->size)
+    {
+        return allocated_address;
+    }
+
+    ThreadHeap* heap = thread_heap();
+    usize capacity = size_class_size(size_class_up(size));
+    if (is_top_chunk(heap, allocated_address, allocation))
+    {
+        u8* new_available_address = (u8*)allocated_address + capacity;
+        if (new_available_address <= heap->slab_end || try_extend_slab(heap, round_up_to_slab((usize)(new_available_address - heap->slab_end))))
+        {
+            // Growing the last chunk of the slab only needs to move the bump pointer
+            ensure_zeroed(heap, (void*)((uptr)allocated_address + allocation->size), new_available_address);
+            allocation->size = capacity;
+            heap->available_address = new_available_address;
+            return allocated_address;
+        }
+    }
+
+    void* new_address = allocate_chunk(size);
+    memcpy(new_address, allocated_address, allocation->size);
+    free_chunk(allocated_address);
+
+    return new_address;
+}
+
+#define SCRATCH_ARENA_SIZE GIGABYTE(1)
+
+static _Thread_local Arena t_scratch_arena;
+
+void arena_init(Arena* arena, usize reserved_size)
+{
+    void* address = os_reserve_virtual_memory(reserved_size);
+    if (address == NULL)
+    {
+        os_exit_with_message("Arena reservation of %zu bytes failed!", reserved_size);
+    }
+
+    *arena = (Arena)
+    {
+        .base = (u8*)address,
+        .reserved = reserved_size,
+    };
+}
+
+void* arena_allocate(Arena* arena, usize size)
+{
+    redassert(arena->base);
+    usize offset = (arena->used + DEFAULT_ALIGNMENT - 1) & ~((usize)DEFAULT_ALIGNMENT - 1);
+    usize end = offset + size;
+    if (!commit_reserve(arena->base, arena->reserved, &arena->committed, end))
+    {
+        RED_PANIC("Arena out of memory: %zu bytes requested, %zu bytes left", size, arena->reserved - offset);
+    }
+
+    // Only memory that was handed out before and released needs to be cleared again
+    if (offset < arena->zeroed)
+    {
+        memset(arena->base + offset, 0, MIN(end, arena->zeroed) - offset);
+    }
+    arena->zeroed = MAX(arena->zeroed, end);
+    arena->used = end;
+
+    return arena->base + offset;
+}
+
+void arena_reset(Arena* arena)
+{
+    arena->used = 0;
+}
+
+ArenaTemp arena_begin_temp(Arena* arena)
+{
+    ArenaTemp temp =
+    {
+        .arena = arena,
+        .used = arena->used,
+    };
+    return temp;
+}
+
+void arena_end_temp(ArenaTemp temp)
+{
+    redassert(temp.arena->used >= temp.used);
+    temp.arena->used = temp.used;
+}
+
+// Per-thread arena for transient data. Callers bracket their use with arena_begin_temp/arena_end_temp
+Arena* os_scratch_arena(void)
+{
+    if (!t_scratch_arena.base)
+    {
+        arena_init(&t_scratch_arena, SCRATCH_ARENA_SIZE);
+    }
+
+    return &t_scratch_arena;
+}
+
+#define JOB_DEQUE_CAPACITY 4096
+#define MAX_JOB_THREAD_COUNT 64
+#define MAX_EXTERNAL_JOB_THREAD_COUNT 8
+#define JOB_SPIN_COUNT 256
+
+/*
+ * Chase-Lev deque (Le, Pop, Cohen, Zappa Nardelli: "Correct and Efficient Work-Stealing for Weak Memory Models").
+ * The owner pushes and takes at the bottom, any other thread steals from the top.
+ */
+typedef struct JobDeque
+{
+    // Thieves hammer top and the owner hammers bottom, so they live on separate cache lines
+    atomic_llong top;
+    u8 top_padding[CACHE_LINE_SIZE - sizeof(atomic_llong)];
+    atomic_llong bottom;
+    u8 bottom_padding[CACHE_LINE_SIZE - sizeof(atomic_llong)];
+    _Atomic(Job*) jobs[JOB_DEQUE_CAPACITY];
+} JobDeque;
+
+// Aligned so that neighbouring threads' deques never share a cache line, which also rounds the size up to one
+typedef struct JobThread
+{
+    _Alignas(CACHE_LINE_SIZE) JobDeque deque;
+    u32 index;
+    u32 random_state;
+#ifdef RED_OS_WINDOWS
+    HANDLE handle;
+#else
+    pthread_t handle;
+#endif
+} JobThread;
+
+typedef struct JobSystem
+{
+    // Workers first, then the slots of the external threads registered with os_job_register_thread
+    JobThread* threads;
+    void* thread_allocation; /* threads, before aligning it to a cache line */
+    u32 thread_count;
+    atomic_uint external_thread_count;
+    atomic_bool quit;
+    // Jobs pushed but not yet taken by anyone; sleeping workers wait for it to become non-zero
+    atomic_int pending_job_count;
+    atomic_int sleeping_thread_count;
+#ifdef RED_OS_WINDOWS
+    SRWLOCK sleep_lock;
+    CONDITION_VARIABLE wake_condition;
+#else
+    pthread_mutex_t sleep_lock;
+    pthread_cond_t wake_condition;
+#endif
+} JobSystem;
+
+static JobSystem m_job_system;
+static _Thread_local JobThread* t_job_thread;
+
+static inline void cpu_relax(void)
+{
+#if defined(__x86_64__) || defined(_M_X64)
+    _mm_pause();
+#endif
+}
+
+static inline bool JobDeque_push(JobDeque* deque, Job* job)
+{
+    s64 bottom = atomic_load_explicit(&deque->bottom, memory_order_relaxed);
+    s64 top = atomic_load_explicit(&deque->top, memory_order_acquire);
+    if (bottom - top >= JOB_DEQUE_CAPACITY)
+    {
+        return false;
+    }
+
+    atomic_store_explicit(&deque->jobs[bottom & (JOB_DEQUE_CAPACITY - 1)], job, memory_order_relaxed);
+    atomic_store_explicit(&deque->bottom, bottom + 1, memory_order_release);
+    return true;
+}
+
+static inline Job* JobDeque_take(JobDeque* deque)
+{
+    s64 bottom = atomic_load_explicit(&deque->bottom, memory_order_relaxed) - 1;
+    atomic_store_explicit(&deque->bottom, bottom, memory_order_relaxed);
+    atomic_thread_fence(memory_order_seq_cst);
+    s64 top = atomic_load_explicit(&deque->top, memory_order_relaxed);
+
+    if (top > bottom)
+    {
+        atomic_store_explicit(&deque->bottom, bottom + 1, memory_order_relaxed);
+        return null;
+    }
+
+    Job* job = atomic_load_explicit(&deque->jobs[bottom & (JOB_DEQUE_CAPACITY - 1)], memory_order_relaxed);
+    if (top == bottom)
+    {
+        // Last job: race the thieves for it
+        if (!atomic_compare_exchange_strong_explicit(&deque->top, &top, top + 1, memory_order_seq_cst, memory_order_relaxed))
+        {
+            job = null;
+        }
+        atomic_store_explicit(&deque->bottom, bottom + 1, memory_order_relaxed);
+    }
+
+    return job;
+}
+
+static inline Job* JobDeque_steal(JobDeque* deque)
+{
+    s64 top = atomic_load_explicit(&deque->top, memory_order_acquire);
+    atomic_thread_fence(memory_order_seq_cst);
+    s64 bottom = atomic_load_explicit(&deque->bottom, memory_order_acquire);
+    if (top >= bottom)
+    {
+        return null;
+    }
+
+    Job* job = atomic_load_explicit(&deque->jobs[top & (JOB_DEQUE_CAPACITY - 1)], memory_order_relaxed);
+    if (!atomic_compare_exchange_strong_explicit(&deque->top, &top, top + 1, memory_order_seq_cst, memory_order_relaxed))
+    {
+        return null;
+    }
+
+    return job;
+}
+
+static inline void execute_job(Job* job)
+{
+    job->function(job->data);
+    if (job->counter)
+    {
+        atomic_fetch_sub_explicit(&job->counter->value, 1, memory_order_release);
+    }
+}
+
+// Runs one job from this thread's deque or, failing that, one stolen from a random victim
+static bool run_one_job(JobThread* thread)
+{
+    Job* job = JobDeque_take(&thread->deque);
+    // External threads only run their own jobs, since per-thread data is sized by os_job_thread_count()
+    if (!job && thread->index < m_job_system.thread_count)
+    {
+        // Thread 0 drives the renderer, so it leaves the external threads' jobs, which may be long, to the workers
+        u32 thread_count = m_job_system.thread_count;
+        u32 victim_count = thread->index ? thread_count + atomic_load_explicit(&m_job_system.external_thread_count, memory_order_acquire) : thread_count;
+        // xorshift32
+        thread->random_state ^= thread->random_state << 13;
+        thread->random_state ^= thread->random_state >> 17;
+        thread->random_state ^= thread->random_state << 5;
+        u32 first_victim = thread->random_state % victim_count;
+        for (u32 i = 0; i < victim_count && !job; i++)
+        {
+            u32 victim = (first_victim + i) % victim_count;
+            if (victim != thread->index)
+            {
+                job = JobDeque_steal(&m_job_system.threads[victim].deque);
+            }
+        }
+    }
+
+    if (!job)
+    {
+        return false;
+    }
+
+    atomic_fetch_sub_explicit(&m_job_system.pending_job_count, 1, memory_order_relaxed);
+    execute_job(job);
+    return true;
+}
+
+static void wake_workers(void)
+{
+    if (atomic_load(&m_job_system.sleeping_thread_count) == 0)
+    {
+        return;
+    }
+
+#ifdef RED_OS_WINDOWS
+    AcquireSRWLockExclusive(&m_job_system.sleep_lock);
+    WakeAllConditionVariable(&m_job_system.wake_condition);
+    ReleaseSRWLockExclusive(&m_job_system.sleep_lock);
+#else
+    pthread_mutex_lock(&m_job_system.sleep_lock);
+    pthread_cond_broadcast(&m_job_system.wake_condition);
+    pthread_mutex_unlock(&m_job_system.sleep_lock);
+#endif
+}
+
+static void wait_for_jobs(void)
+{
+#ifdef RED_OS_WINDOWS
+    AcquireSRWLockExclusive(&m_job_system.sleep_lock);
+#else
+    pthread_mutex_lock(&m_job_system.sleep_lock);
+#endif
+    atomic_fetch_add(&m_job_system.sleeping_thread_count, 1);
+    while (atomic_load(&m_job_system.pending_job_count) <= 0 && !atomic_load(&m_job_system.quit))
+    {
+#ifdef RED_OS_WINDOWS
+        SleepConditionVariableSRW(&m_job_system.wake_condition, &m_job_system.sleep_lock, INFINITE, 0);
+#else
+        pthread_cond_wait(&m_job_system.wake_condition, &m_job_system.sleep_lock);
+#endif
+    }
+    atomic_fetch_sub(&m_job_system.sleeping_thread_count, 1);
+#ifdef RED_OS_WINDOWS
+    ReleaseSRWLockExclusive(&m_job_system.sleep_lock);
+#else
+    pthread_mutex_unlock(&m_job_system.sleep_lock);
+#endif
+}
+
+#ifdef RED_OS_WINDOWS
+static DWORD WINAPI job_worker_main(LPVOID argument)
+#else
+static void* job_worker_main(void* argument)
+#endif
+{
+    JobThread* thread = (JobThread*)argument;
+    t_job_thread = thread;
+
+    while (!atomic_load_explicit(&m_job_system.quit, memory_order_relaxed))
+    {
+        u32 spin = 0;
+        while (!run_one_job(thread) && spin < JOB_SPIN_COUNT)
+        {
+            cpu_relax();
+            spin++;
+        }
+
+        if (spin == JOB_SPIN_COUNT)
+        {
+            wait_for_jobs();
+        }
+    }
+
+    return 0;
+}
+
+static void pin_thread_to_core(JobThread* thread, u32 core)
+{
+#ifdef RED_OS_WINDOWS
+    SetThreadAffinityMask(thread->handle, (DWORD_PTR)1 << core);
+#else
+    cpu_set_t cpu_set;
+    CPU_ZERO(&cpu_set);
+    CPU_SET(core, &cpu_set);
+    pthread_setaffinity_np(thread->handle, sizeof(cpu_set), &cpu_set);
+#endif
+}
+
+// A thread_count of 0 uses every logical core. The calling thread becomes job thread 0
+void os_job_system_init(u32 thread_count)
+{
+    redassert(!m_job_system.threads);
+    if (thread_count == 0)
+    {
+        thread_count = logical_thread_count;
+    }
+    thread_count = MAX(1, MIN(thread_count, MAX_JOB_THREAD_COUNT));
+
+    // NEW only aligns to 16 bytes
+    usize threads_size = (thread_count + MAX_EXTERNAL_JOB_THREAD_COUNT) * sizeof(JobThread);
+    m_job_system.thread_allocation = NEW(u8, (threads_size + CACHE_LINE_SIZE));
+    m_job_system.threads = (JobThread*)align_address(m_job_system.thread_allocation, CACHE_LINE_SIZE);
+    memset(m_job_system.threads, 0, threads_size);
+    m_job_system.thread_count = thread_count;
+#ifdef RED_OS_WINDOWS
+    InitializeSRWLock(&m_job_system.sleep_lock);
+    InitializeConditionVariable(&m_job_system.wake_condition);
+#else
+    pthread_mutex_init(&m_job_system.sleep_lock, null);
+    pthread_cond_init(&m_job_system.wake_condition, null);
+#endif
+
+    for (u32 i = 0; i < thread_count + MAX_EXTERNAL_JOB_THREAD_COUNT; i++)
+    {
+        m_job_system.threads[i].index = i;
+        m_job_system.threads[i].random_state = 0x9e3779b9u * (i + 1);
+    }
+    t_job_thread = &m_job_system.threads[0];
+
+    for (u32 i = 1; i < thread_count; i++)
+    {
+        JobThread* thread = &m_job_system.threads[i];
+#ifdef RED_OS_WINDOWS
+        thread->handle = CreateThread(null, 0, job_worker_main, thread, 0, null);
+        if (!thread->handle)
+#else
+        if (pthread_create(&thread->handle, null, job_worker_main, thread) != 0)
+#endif
+        {
+            os_exit_with_message("Failed to create job worker thread %u\n", i);
+        }
+        // Thread 0 is left to the scheduler: it is the caller's thread and also drives the renderer
+        pin_thread_to_core(thread, i % logical_thread_count);
+    }
+
+    print("Job system running on %u threads\n", thread_count);
+}
+
+void os_job_system_shutdown(void)
+{
+    if (!m_job_system.threads)
+    {
+        return;
+    }
+
+    redassert(t_job_thread == &m_job_system.threads[0]);
+    atomic_store(&m_job_system.quit, true);
+#ifdef RED_OS_WINDOWS
+    AcquireSRWLockExclusive(&m_job_system.sleep_lock);
+    WakeAllConditionVariable(&m_job_system.wake_condition);
+    ReleaseSRWLockExclusive(&m_job_system.sleep_lock);
+#else
+    pthread_mutex_lock(&m_job_system.sleep_lock);
+    pthread_cond_broadcast(&m_job_system.wake_condition);
+    pthread_mutex_unlock(&m_job_system.sleep_lock);
+#endif
+
+    for (u32 i = 1; i < m_job_system.thread_count; i++)
+    {
+#ifdef RED_OS_WINDOWS
+        WaitForSingleObject(m_job_system.threads[i].handle, INFINITE);
+        CloseHandle(m_job_system.threads[i].handle);
+#else
+        pthread_join(m_job_system.threads[i].handle, null);
+#endif
+    }
+
+#ifndef RED_OS_WINDOWS
+    pthread_cond_destroy(&m_job_system.wake_condition);
+    pthread_mutex_destroy(&m_job_system.sleep_lock);
+#endif
+    DELETE(m_job_system.thread_allocation);
+    m_job_system = (JobSystem) { 0 };
+    t_job_thread = null;
+}
+
+/*
+ * Gives a thread the job system did not create (see os_thread_create) a deque of its own. Jobs it runs are then
+ * stolen by the workers instead of running in place, and it runs its own while it waits on them.
+ */
+void os_job_register_thread(void)
+{
+    redassert(m_job_system.threads && !t_job_thread);
+    u32 external_index = atomic_load(&m_job_system.external_thread_count);
+    do
+    {
+        if (external_index == MAX_EXTERNAL_JOB_THREAD_COUNT)
+        {
+            // Out of slots: this thread's jobs keep running in place
+            return;
+        }
+    } while (!atomic_compare_exchange_weak(&m_job_system.external_thread_count, &external_index, external_index + 1));
+
+    t_job_thread = &m_job_system.threads[m_job_system.thread_count + external_index];
+}
+
+u32 os_job_thread_count(void)
+{
+    return MAX(m_job_system.thread_count, 1);
+}
+
+// Index of the calling job thread, for per-thread data such as command pools
+u32 os_job_thread_index(void)
+{
+    return t_job_thread ? t_job_thread->index : 0;
+}
+
+void os_job_run(Job* jobs, u32 job_count, JobCounter* counter)
+{
+    if (counter)
+    {
+        atomic_fetch_add_explicit(&counter->value, (s32)job_count, memory_order_relaxed);
+    }
+
+    JobThread* thread = t_job_thread;
+    for (u32 i = 0; i < job_count; i++)
+    {
+        Job* job = &jobs[i];
+        job->counter = counter;
+
+        // Without a job system, or with a full deque, the job runs right away on the caller
+        if (!thread)
+        {
+            execute_job(job);
+            continue;
+        }
+
+        atomic_fetch_add(&m_job_system.pending_job_count, 1);
+        if (!JobDeque_push(&thread->deque, job))
+        {
+            atomic_fetch_sub(&m_job_system.pending_job_count, 1);
+            execute_job(job);
+            continue;
+        }
+
+        wake_workers();
+    }
+}
+
+void os_job_wait(JobCounter* counter)
+{
+    JobThread* thread = t_job_thread;
+    redassert(thread || atomic_load(&counter->value) == 0);
+
+    while (atomic_load_explicit(&counter->value, memory_order_acquire) > 0)
+    {
+        if (!run_one_job(thread))
+        {
+            cpu_relax();
+        }
+    }
+}
+
+typedef struct ParallelForBatch
+{
+    ParallelForFunction* function;
+    void* data;
+    u32 start;
+    u32 end;
+} ParallelForBatch;
+
+static void parallel_for_job(void* data)
+{
+    ParallelForBatch* batch = (ParallelForBatch*)data;
+    batch->function(batch->data, batch->start, batch->end);
+}
+
+// Calls function over [0, count) in batches of batch_size items spread across the job threads, and waits for all of them
+void os_parallel_for(u32 count, u32 batch_size, ParallelForFunction* function, void* data)
+{
+    if (count == 0)
+    {
+        return;
+    }
+
+    redassert(batch_size > 0);
+    u32 batch_count = (count + batch_size - 1) / batch_size;
+    if (batch_count == 1 || !t_job_thread)
+    {
+        function(data, 0, count);
+        return;
+    }
+
+    ArenaTemp temp = arena_begin_temp(os_scratch_arena());
+    ParallelForBatch* batches = ARENA_NEW(temp.arena, ParallelForBatch, batch_count);
+    Job* jobs = ARENA_NEW(temp.arena, Job, batch_count);
+    for (u32 i = 0; i < batch_count; i++)
+    {
+        batches[i] = (ParallelForBatch)
+        {
+            .function = function,
+            .data = data,
+            .start = i * batch_size,
+            .end = MIN(count, (i + 1) * batch_size),
+        };
+        jobs[i] = (Job)
+        {
+            .function = parallel_for_job,
+            .data = &batches[i],
+        };
+    }
+
+    JobCounter counter = { 0 };
+    os_job_run(jobs, batch_count, &counter);
+    os_job_wait(&counter);
+    arena_end_temp(temp);
+}
+
+struct Thread
+{
+    ThreadFunction* function;
+    void* data;
+#ifdef RED_OS_WINDOWS
+    HANDLE handle;
+#else
+    pthread_t handle;
+#endif
+};
+
+#ifdef RED_OS_WINDOWS
+static DWORD WINAPI thread_main(LPVOID argument)
+#else
+static void* thread_main(void* argument)
+#endif
+{
+    Thread* thread = (Thread*)argument;
+    thread->function(thread->data);
+    return 0;
+}
+
+// The thread is not a job thread until it calls os_job_register_thread: os_job_run from it executes jobs in place
+Thread* os_thread_create(ThreadFunction* function, void* data)
+{
+    Thread* thread = NEW(Thread, 1);
+    thread->function = function;
+    thread->data = data;
+#ifdef RED_OS_WINDOWS
+    thread->handle = CreateThread(null, 0, thread_main, thread, 0, null);
+    if (!thread->handle)
+#else
+    if (pthread_create(&thread->handle, null, thread_main, thread) != 0)
+#endif
+    {
+        os_exit_with_message("Failed to create thread\n");
+    }
+
+    return thread;
+}
+
+void os_thread_join(Thread* thread)
+{
+#ifdef RED_OS_WINDOWS
+    WaitForSingleObject(thread->handle, INFINITE);
+    CloseHandle(thread->handle);
+#else
+    pthread_join(thread->handle, null);
+#endif
+    DELETE(thread);
+}
+
+struct ThreadQueue
+{
+    void** items;
+    u32 capacity;
+    u32 head;
+    u32 count;
+    bool closed;
+#ifdef RED_OS_WINDOWS
+    SRWLOCK lock;
+    CONDITION_VARIABLE not_empty;
+    CONDITION_VARIABLE not_full;
+#else
+    pthread_mutex_t lock;
+    pthread_cond_t not_empty;
+    pthread_cond_t not_full;
+#endif
+};
+
+static inline void ThreadQueue_lock(ThreadQueue* queue)
+{
+#ifdef RED_OS_WINDOWS
+    AcquireSRWLockExclusive(&queue->lock);
+#else
+    pthread_mutex_lock(&queue->lock);
+#endif
+}
+
+static inline void ThreadQueue_unlock(ThreadQueue* queue)
+{
+#ifdef RED_OS_WINDOWS
+    ReleaseSRWLockExclusive(&queue->lock);
+#else
+    pthread_mutex_unlock(&queue->lock);
+#endif
+}
+
+static inline void ThreadQueue_sleep(ThreadQueue* queue, bool wait_for_space)
+{
+#ifdef RED_OS_WINDOWS
+    SleepConditionVariableSRW(wait_for_space ? &queue->not_full : &queue->not_empty, &queue->lock, INFINITE, 0);
+#else
+    pthread_cond_wait(wait_for_space ? &queue->not_full : &queue->not_empty, &queue->lock);
+#endif
+}
+
+static inline void ThreadQueue_wake(ThreadQueue* queue, bool space_available)
+{
+#ifdef RED_OS_WINDOWS
+    WakeAllConditionVariable(space_available ? &queue->not_full : &queue->not_empty);
+#else
+    pthread_cond_broadcast(space_available ? &queue->not_full : &queue->not_empty);
+#endif
+}
+
+ThreadQueue* os_thread_queue_create(u32 capacity)
+{
+    redassert(capacity > 0);
+    ThreadQueue* queue = NEW(ThreadQueue, 1);
+    *queue = (ThreadQueue)
+    {
+        .items = NEW(void*, capacity),
+        .capacity = capacity,
+    };
+#ifdef RED_OS_WINDOWS
+    InitializeSRWLock(&queue->lock);
+    InitializeConditionVariable(&queue->not_empty);
+    InitializeConditionVariable(&queue->not_full);
+#else
+    pthread_mutex_init(&queue->lock, null);
+    pthread_cond_init(&queue->not_empty, null);
+    pthread_cond_init(&queue->not_full, null);
+#endif
+    return queue;
+}
+
+void os_thread_queue_destroy(ThreadQueue* queue)
+{
+#ifndef RED_OS_WINDOWS
+    pthread_cond_destroy(&queue->not_full);
+    pthread_cond_destroy(&queue->not_empty);
+    pthread_mutex_destroy(&queue->lock);
+#endif
+    DELETE(queue->items);
+    DELETE(queue);
+}
+
+void os_thread_queue_push(ThreadQueue* queue, void* item)
+{
+    redassert(item);
+    ThreadQueue_lock(queue);
+    redassert(!queue->closed);
+    while (queue->count == queue->capacity)
+    {
+        ThreadQueue_sleep(queue, true);
+    }
+    queue->items[(queue->head + queue->count) % queue->capacity] = item;
+    queue->count++;
+    ThreadQueue_wake(queue, false);
+    ThreadQueue_unlock(queue);
+}
+
+static inline void* ThreadQueue_take(ThreadQueue* queue)
+{
+    void* item = queue->items[queue->head];
+    queue->head = (queue->head + 1) % queue->capacity;
+    queue->count--;
+    ThreadQueue_wake(queue, true);
+    return item;
+}
+
+void* os_thread_queue_pop(ThreadQueue* queue)
+{
+    ThreadQueue_lock(queue);
+    while (queue->count == 0 && !queue->closed)
+    {
+        ThreadQueue_sleep(queue, false);
+    }
+    void* item = queue->count ? ThreadQueue_take(queue) : null;
+    ThreadQueue_unlock(queue);
+    return item;
+}
+
+void* os_thread_queue_try_pop(ThreadQueue* queue)
+{
+    ThreadQueue_lock(queue);
+    void* item = queue->count ? ThreadQueue_take(queue) : null;
+    ThreadQueue_unlock(queue);
+    return item;
+}
+
+// Wakes every consumer: once the queue drains, pop returns null instead of blocking
+void os_thread_queue_close(ThreadQueue* queue)
+{
+    ThreadQueue_lock(queue);
+    queue->closed = true;
+    ThreadQueue_wake(queue, false);
+    ThreadQueue_unlock(queue);
+}
+
+void print(const char* format, ...)
 {
     va_list args;
     va_start(args, format);
@@ -662,13 +1950,26 @@ void red_panic(const char* file, size_t line, const char* function, const char*
 #endif
 }
 
+// Reads other threads' counters without synchronization, so the numbers are only a snapshot
 void os_print_memory_usage(void)
 {
-    redassert(m_page_allocator.allocated_block_count == 1);
-    u64 mem_usage = (usize)((uptr)m_page_allocator.available_address - (uptr)m_page_allocator.blob);
-    u64 block_size = BLOCK_SIZE;
-    u64 alloc_count = m_page_allocator.allocation_count;
-    print("\nMemory usage: %llu bytes. Available: %llu bytes. Relative usage: %02.02f%%. Total allocations: %llu\n", mem_usage, block_size, ((f64)mem_usage / (f64)block_size) * 100.0f, alloc_count);
+    u64 handed_out = atomic_load_explicit(&m_page_allocator.slab_cursor, memory_order_relaxed);
+    u64 unused_slab_bytes = 0;
+    u64 alloc_count = 0;
+    u64 free_list_bytes = 0;
+    u32 thread_count = 0;
+    for (ThreadHeap* heap = atomic_load_explicit(&m_page_allocator.heaps, memory_order_acquire); heap; heap = heap->next)
+    {
+        unused_slab_bytes += (u64)(heap->slab_end - heap->available_address);
+        alloc_count += heap->allocation_count;
+        free_list_bytes += heap->free_list_bytes;
+        thread_count++;
+    }
+
+    u64 mem_usage = handed_out - unused_slab_bytes;
+    u64 committed = m_page_allocator.committed;
+    u64 reserved = m_page_allocator.reserved;
+    print("\nMemory usage: %llu bytes (%llu bytes in free lists) across %u thread heaps. Committed: %llu bytes. Reserved: %llu bytes. Relative usage: %02.02f%%. Total allocations: %llu\n", mem_usage, free_list_bytes, thread_count, committed, reserved, committed ? ((f64)mem_usage / (f64)committed) * 100.0f : 0.0, alloc_count);
 }
 
 void os_debug_break(void)
@@ -8,6 +8,7 @@
 #include <inttypes.h>
 #include <string.h>
 #include <stdarg.h>
+#include <stdatomic.h>
 
 
 #if __linux__
@@ -55,6 +56,13 @@ typedef struct Termination
     s32 code;
 } Termination;
 
+typedef enum HugePageMode
+{
+    HUGE_PAGE_MODE_OFF,
+    HUGE_PAGE_MODE_TRANSPARENT, /* madvise(MADV_HUGEPAGE) on committed memory */
+    HUGE_PAGE_MODE_EXPLICIT, /* MAP_HUGETLB pages from the preallocated pool, transparent ones as a fallback */
+} HugePageMode;
+
 typedef struct ExplicitTimer
 {
     u64 start_time;
@@ -69,6 +77,33 @@ typedef enum FileLoadResult
     FILE_LOAD_RESULT_ERROR,
     FILE_LOAD_RESULT_SUCCESS,
 } FileLoadResult;
+
+typedef struct FileInfo
+{
+    u64 size;
+    u64 modification_time; /* nanoseconds */
+} FileInfo;
+
+typedef struct FileChunk
+{
+    const void* data;
+    usize size;
+} FileChunk;
+
+typedef enum FileAccessHint
+{
+    FILE_ACCESS_HINT_NORMAL,
+    FILE_ACCESS_HINT_SEQUENTIAL, /* pages are read once, front to back */
+    FILE_ACCESS_HINT_WILLNEED, /* the whole file is going to be touched soon; start reading it ahead */
+} FileAccessHint;
+
+typedef struct FileMapping
+{
+    void* ptr;
+    usize size;
+    void* win32_file_handle;
+    void* win32_mapping_handle;
+} FileMapping;
 typedef const char* os_arg;
 typedef os_arg* os_arg_list;
 
@@ -80,6 +115,7 @@ void os_abort();
 void os_exit(s32 code);
 void* allocate_chunk(size_t size);
 void* reallocate_chunk(void* allocated_address, usize size);
+void free_chunk(void* allocated_address);
 void  mem_init(void);
 void os_print_memory_usage(void);
 void os_debug_break(void);
@@ -101,6 +137,84 @@ void print(const char* format, ...);
 
 #define NEW(T, count) (T*)(allocate_chunk(count * sizeof(T)))
 #define RENEW(T, old_ptr, count) (T*)(reallocate_chunk(old_ptr, count * sizeof(T)))
+#define DELETE(ptr) free_chunk(ptr)
+
+/*
+ * Linear arena for transient data. Allocating is a pointer bump and everything allocated after
+ * arena_begin_temp is released at once by arena_end_temp. Memory comes back zeroed, like NEW.
+ */
+typedef struct Arena
+{
+    u8* base;
+    usize reserved;
+    usize committed;
+    usize used;
+    usize zeroed; /* bytes past this offset have never been handed out */
+} Arena;
+
+typedef struct ArenaTemp
+{
+    Arena* arena;
+    usize used;
+} ArenaTemp;
+
+void arena_init(Arena* arena, usize reserved_size);
+void* arena_allocate(Arena* arena, usize size);
+void arena_reset(Arena* arena);
+ArenaTemp arena_begin_temp(Arena* arena);
+void arena_end_temp(ArenaTemp temp);
+Arena* os_scratch_arena(void);
+
+#define ARENA_NEW(arena, T, count) (T*)(arena_allocate(arena, (count) * sizeof(T)))
+
+/*
+ * Job system: one worker thread per logical core, each with a work-stealing deque. The thread that
+ * initializes it takes part as thread 0. Jobs signal completion through a counter; waiting on a counter
+ * runs other jobs until it drops to zero, so a job can wait on the jobs it depends on without blocking a
+ * worker. Job arrays are owned by the caller and must stay alive until their counter reaches zero.
+ */
+typedef void JobFunction(void* data);
+
+typedef struct JobCounter
+{
+    atomic_int value;
+} JobCounter;
+
+typedef struct Job
+{
+    JobFunction* function;
+    void* data;
+    JobCounter* counter;
+} Job;
+
+typedef void ParallelForFunction(void* data, u32 start, u32 end);
+
+void os_job_system_init(u32 thread_count);
+void os_job_system_shutdown(void);
+void os_job_register_thread(void);
+u32 os_job_thread_count(void);
+u32 os_job_thread_index(void);
+void os_job_run(Job* jobs, u32 job_count, JobCounter* counter);
+void os_job_wait(JobCounter* counter);
+void os_parallel_for(u32 count, u32 batch_size, ParallelForFunction* function, void* data);
+
+/*
+ * Long-lived threads for work that blocks, such as file I/O, and so does not belong on the job threads.
+ * ThreadQueue is a bounded FIFO of pointers connecting them: push blocks while it is full, pop blocks while it
+ * is empty and returns null once the queue has been closed and drained. try_pop never blocks.
+ */
+typedef void ThreadFunction(void* data);
+typedef struct Thread Thread;
+typedef struct ThreadQueue ThreadQueue;
+
+Thread* os_thread_create(ThreadFunction* function, void* data);
+void os_thread_join(Thread* thread);
+ThreadQueue* os_thread_queue_create(u32 capacity);
+void os_thread_queue_destroy(ThreadQueue* queue);
+void os_thread_queue_push(ThreadQueue* queue, void* item);
+void* os_thread_queue_pop(ThreadQueue* queue);
+void* os_thread_queue_try_pop(ThreadQueue* queue);
+void os_thread_queue_close(ThreadQueue* queue);
 
 
 #define GEN_BUFFER_FUNCTIONS(p_type_prefix, buffer_name, t_type, elem_type)\
@@ -112,9 +226,12 @@ static inline elem_type* p_type_prefix##_ptr(t_type* buffer_name)\
 {\
     return buffer_name->ptr;\
 }\
-static inline void p_type_prefix##_deinit()\
+static inline void p_type_prefix##_deinit(t_type* buffer_name)\
 {\
-    RED_NOT_IMPLEMENTED;\
+    DELETE(buffer_name->ptr);\
+    buffer_name->ptr = null;\
+    buffer_name->len = 0;\
+    buffer_name->cap = 0;\
 }\
 \
 static inline void p_type_prefix##_ensure_capacity(t_type* buffer_name, u32 new_capacity)\
@@ -183,6 +300,9 @@ SB* os_get_cwd(void);
 void* os_ask_virtual_memory_block(size_t block_bytes);
 void* os_ask_virtual_memory_block_with_address(void* target_address, size_t block_bytes);
 void* os_ask_heap_memory(size_t size);
+void* os_reserve_virtual_memory(usize size);
+bool os_commit_virtual_memory(void* address, usize size, HugePageMode mode);
+void os_set_huge_page_mode(HugePageMode mode);
 size_t os_get_page_size(void);
 void os_spawn_process(const char* exe, os_arg_list args, Termination* termination);
 void os_abort(void);
@@ -194,6 +314,10 @@ f64 os_compute_ms(u64 pc_start, u64 pc_end);
 s32 os_load_dynamic_library(const char* dyn_lib_name);
 void* os_load_procedure_from_dynamic_library(s32 dyn_lib_index, const char* proc_name);
 StringBuffer* os_file_load(const char *name);
+bool os_file_get_info(const char* name, FileInfo* info);
+bool os_file_write(const char* name, const FileChunk* chunks, u32 chunk_count);
+bool os_file_map(const char* name, FileAccessHint hint, FileMapping* mapping);
+void os_file_unmap(FileMapping* mapping);
 
 
 
@@ -0,0 +1,28 @@
+#version 450
+
+// PackedVertex: the fetch turns every attribute back into floats
+layout (location = 0) in vec3 position; // unorm16, [0, 1] across the mesh bounds
+layout (location = 1) in vec2 normal; // octahedral (see octahedral_encode in maths.h), snorm16; not shaded with yet
+layout (location = 2) in vec3 color; // unorm8
+
+// per-instance attributes, advanced once per gl_InstanceIndex
+layout (location = 3) in mat4 instance_model;
+layout (location = 7) in vec4 instance_color;
+
+layout (location = 0) out vec3 out_color;
+
+// push constants block
+layout(push_constant) uniform constants
+{
+    vec4 data;
+    mat4 render_matrix; // view-projection, shared by every instance of a draw
+    vec4 position_scale; // mesh bounds extent, pushed with the mesh
+    vec4 position_offset; // mesh bounds minimum
+} PushConstants;
+
+void main()
+{
+    vec3 object_position = position * PushConstants.position_scale.xyz + PushConstants.position_offset.xyz;
+    gl_Position = PushConstants.render_matrix * instance_model * vec4(object_position, 1.0f);
+    out_color = color * instance_color.rgb;
+}
@@ -4,17 +4,23 @@ layout (location = 0) in vec3 position;
 layout (location = 1) in vec3 normal;
 layout (location = 2) in vec3 color;
 
+// per-instance attributes, advanced once per gl_InstanceIndex
+layout (location = 3) in mat4 instance_model;
+layout (location = 7) in vec4 instance_color;
+
 layout (location = 0) out vec3 out_color;
 
 // push constants block
 layout(push_constant) uniform constants
 {
     vec4 data;
-    mat4 render_matrix;
+    mat4 render_matrix; // view-projection, shared by every instance of a draw
+    vec4 position_scale; // packed meshes only, see triangle_mesh_packedv.vert
+    vec4 position_offset;
 } PushConstants;
 
 void main()
 {
-    gl_Position = PushConstants.render_matrix * vec4(position, 1.0f);
-    out_color = color;
+    gl_Position = PushConstants.render_matrix * instance_model * vec4(position, 1.0f);
+    out_color = color * instance_color.rgb;
 }